@@ -1,7 +1,18 @@
 { pkgs, k4apkgs, tolHeader, jsonHeader,  libmediapipepkg }:
-{
-  default = pkgs.cudaPackages.backendStdenv.mkDerivation {
-    pname = "volumetricSim";
+let
+  # cudaSupport = false builds for machines without an NVIDIA GPU: no CUDA toolkit,
+  # dlib and OpenCV built without it, and the tracker preprocesses frames on the CPU.
+  # countAllocations replaces the global operator new so the benchmarks can count heap allocations,
+  # never in the library the study normally loads since every allocation in the process would pay for it
+  mkVolsim = { cudaSupport, countAllocations ? false }:
+  let
+    dlib = if cudaSupport then pkgs.dlib else pkgs.dlib.override { cudaSupport = false; };
+    opencv = if cudaSupport then pkgs.opencv else pkgs.opencv.override { enableCuda = false; };
+    stdenv = if cudaSupport then pkgs.cudaPackages.backendStdenv else pkgs.stdenv;
+  in
+  stdenv.mkDerivation {
+    pname = (if cudaSupport then "volumetricSim" else "volumetricSim-cpu")
+      + pkgs.lib.optionalString countAllocations "-benchmark";
     version = "0.0.1";
 
     enableParallelBuilding = true;
@@ -14,9 +25,10 @@
       glxinfo
     ];
 
-    buildInputs = with pkgs; [
+    buildInputs = [
       dlib
       opencv
+    ] ++ (with pkgs; [
       glfw
       glm
       stb
@@ -25,11 +37,12 @@
       xorg.libXi
       udev
       mkl
-    ] ++ (with k4apkgs; [
+      libjpeg_turbo
+    ]) ++ (with k4apkgs; [
       libk4a-dev
       k4a-tools
     ]) 
-    ++ (with cudaPackages; [
+    ++ pkgs.lib.optionals cudaSupport (with pkgs.cudaPackages; [
       cudnn
       cuda_nvcc
       cuda_cudart
@@ -95,34 +108,40 @@
           "-lm"
           "-ludev"
           "-lk4a"
+          "-lk4arecord"
+          "-lturbojpeg"
           "-lopencv_core"
           "-lopencv_imgproc"
           "-lopencv_highgui"
           "-lopencv_imgcodecs"
+          "-lopencv_features2d"
+          "-lopencv_flann"
+          "-lopencv_dnn"
+          "-ldlib"
+          "-lmkl_intel_lp64"
+          "-lmediapipe"
+        ] ++ pkgs.lib.optionals cudaSupport [
           "-lopencv_cudafeatures2d"
           "-lopencv_cudafilters"
           "-lopencv_cudawarping"
-          "-lopencv_features2d"
           "-lopencv_cudaimgproc"
-          "-lopencv_flann"
-          "-ldlib"
           "-lcudart"
           "-lcudnn"
           "-lcublas"
           "-lcurand"
           "-lcusolver"
-          "-lmkl_intel_lp64"
-          "-lmediapipe"
         ];
         headers = [
-          "-I ${pkgs.dlib}/include"
-          "-I ${pkgs.opencv}/include/opencv4"
+          "-I ${dlib}/include"
+          "-I ${opencv}/include/opencv4"
           "-I ${gladBuildDir}/include"
           "-I ${k4apkgs.libk4a-dev}/include"
           "-I ${libmediapipepkg}/include"
           "-I include"
         ];
-        macros = [ ''-DPACKAGE_PATH=\"$out\"'' ];
+        macros = [ ''-DPACKAGE_PATH=\"$out\"'' ]
+          ++ pkgs.lib.optionals (!cudaSupport) [ "-DVOLSIM_NO_CUDA" ]
+          ++ pkgs.lib.optionals countAllocations [ "-DVOLSIM_COUNT_ALLOCATIONS" ];
         openGLVersion =
           "glxinfo | grep -oP '(?<=OpenGL version string: )[0-9]+.?[0-9]'";
       in
@@ -134,10 +153,69 @@
         } -o libvolsim.so
       '';
 
+    doCheck = true;
+    checkPhase =
+      let
+        # Each test is a program of its own, tests/<name>.cpp plus the sources it exercises
+        tests = [
+          { name = "mailbox"; }
+          { name = "stagequeue"; }
+          { name = "preprocess"; sources = [ "src/preprocess.cpp" ]; libs = [ "-lopencv_core" ]; simd = true; }
+          { name = "background"; sources = [ "src/background.cpp" ]; libs = [ "-lopencv_core" "-lopencv_imgproc" ]; simd = true; }
+          {
+            name = "pinch";
+            sources = [ "src/pinch.cpp" ];
+            libs = [
+              "-L ${k4apkgs.libk4a-dev}/lib/x86_64-linux-gnu"
+              "-Wl,-rpath,${k4apkgs.libk4a-dev}/lib/x86_64-linux-gnu"
+              "-lk4a"
+              "-lopencv_core"
+              "-lopencv_imgproc"
+            ];
+          }
+        ];
+        # Tests of code with SIMD paths are built once for each instruction set, so the scalar, SSE and AVX2 loops
+        # are all checked whatever the build machine would pick
+        instructionSets = {
+          scalar = "-march=x86-64";
+          sse = "-march=x86-64 -mssse3 -msse4.1";
+          avx2 = "-march=skylake";
+        };
+        headers = [
+          "-I ${opencv}/include/opencv4"
+          "-I ${k4apkgs.libk4a-dev}/include"
+          "-I include"
+        ];
+        buildAndRun = test: isa: flags:
+          let
+            binary = "build/tests/${test.name}-${isa}";
+          in
+          ''
+            g++ -O2 -Wall ${flags} ${
+              pkgs.lib.strings.concatStringsSep " "
+              (headers ++ [ "tests/${test.name}.cpp" ] ++ (test.sources or [ ]) ++ (test.libs or [ ]) ++ [ "-lpthread" ])
+            } -o ${binary}
+            ./${binary}
+          '';
+        runTest = test:
+          if test.simd or false
+          then pkgs.lib.strings.concatStrings (pkgs.lib.mapAttrsToList (buildAndRun test) instructionSets)
+          else buildAndRun test "default" "";
+      in
+      ''
+        mkdir -p build/tests
+        ${pkgs.lib.strings.concatMapStrings runTest tests}
+      '';
+
     installPhase = ''
       mkdir -p $out/bin
       cp libvolsim.so $out/bin
       cp -a data $out/data
     '';
   };
+in
+{
+  default = mkVolsim { cudaSupport = true; };
+  cpu = mkVolsim { cudaSupport = false; };
+  benchmark = mkVolsim { cudaSupport = true; countAllocations = true; };
 }
@@ -24,7 +24,7 @@ def cli():
 ############
 @cli.group
 def run():
-	""" [ debug | eval | demo | task | next ]"""
+	""" [ debug | replay | synthetic | profiles | benchmark | eval | demo | task | next ]"""
 	pass
 
 @run.command()
@@ -34,6 +34,111 @@ def debug():
     # study.run_simulation("to", 1, "True",1,False)
     # visualize.visualize_point_cloud_pyvista("misc/pointCloud.csv")   
     
+@run.command()
+@click.argument("recordings", nargs=-1, required=True)
+@click.option("--unthrottled", is_flag=True, default=False, help="Replay as fast as possible instead of at the recorded frame rate")
+@click.option("--extrinsics", type=click.Path(exists=True, dir_okay=False), default=None, help="JSON list of {\"position\": [x, y, z], \"rotation\": [x, y, z]} for each recording after the first")
+@click.option("-t", "--timeout", type=int, default=30, help="Seconds to run for")
+def replay(recordings, unthrottled, extrinsics, timeout):
+    """ Run the tracker against k4arecord (mkv) files instead of live cameras, one camera per recording. """
+    options = {"source": "playback", "recording": recordings[0], "realtime": not unthrottled}
+    if len(recordings) > 1:
+        if extrinsics is None:
+            raise click.UsageError("--extrinsics is needed to place the extra cameras")
+        with open(extrinsics) as f:
+            placements = json.load(f)
+        if len(placements) != len(recordings) - 1:
+            raise click.UsageError(f"--extrinsics has {len(placements)} entries for {len(recordings) - 1} extra recordings")
+        options["cameras"] = [{"source": "playback", "recording": recording, "realtime": not unthrottled, **placement}
+                              for recording, placement in zip(recordings[1:], placements)]
+    output = study.run_simulation("t", 1, False, timeout, False, options)
+
+    data = json.loads(output)
+    tracking = data["trackerLogs"].get("tracking", [])
+    print(f"Tracked {len(tracking)} frames in {timeout}s ({len(tracking) / timeout:.1f} fps)")
+    print(json.dumps(data["trackerLogs"]["source"], indent=4))
+    print_latency(data)
+
+@run.command()
+@click.option("--fps", type=float, default=30.0, help="Synthetic frame rate")
+@click.option("--unthrottled", is_flag=True, default=False, help="Generate frames as fast as possible instead of at --fps")
+@click.option("-t", "--timeout", type=int, default=30, help="Seconds to run for")
+def synthetic(fps, unthrottled, timeout):
+    """ Run the tracker against generated frames with known eye and fingertip positions. """
+    options = {"source": "synthetic", "fps": fps, "realtime": not unthrottled}
+    output = study.run_simulation("t", 1, False, timeout, False, options)
+
+    data = json.loads(output)
+    tracker_logs = data["trackerLogs"]
+    truth = {entry["deviceTime"]: entry["points"] for entry in tracker_logs["source"]["groundTruth"]}
+
+    # Error of each tracked point against the pose it was rendered at
+    for key, log_name in [("leftEye", "leftEye"), ("index", "hand")]:
+        errors = []
+        for log in tracker_logs.get(log_name, []):
+            tracked = log[key] if key in log else log
+            actual = truth.get(log["deviceTime"], {}).get(key)
+            if actual is not None:
+                errors.append(math.dist([tracked["x"], tracked["y"], tracked["z"]], [actual["x"], actual["y"], actual["z"]]))
+        if errors:
+            print(f"{key}: {len(errors)} samples, mean error {mean(errors):.2f}cm, max {max(errors):.2f}cm")
+        else:
+            print(f"{key}: no samples")
+    print_latency(data)
+
+def print_latency(data):
+    """ Summarise how old results were by the time they reached the screen. """
+    for stream, stages in data.get("latency", {}).items():
+        total = stages["captureToSwap"]
+        if total["count"] == 0:
+            print(f"{stream} latency: no samples")
+            continue
+        print(f"{stream} capture->swap latency: p50 {total['p50Ms']:.1f}ms, p95 {total['p95Ms']:.1f}ms, p99 {total['p99Ms']:.1f}ms")
+    face = data.get("trackerLogs", {}).get("faceTracking")
+    if face and face["frames"] > 0:
+        print(f"face detector: {face['detectorRunsPerSecond']:.1f} runs/s, {face['trackedFrames']}/{face['frames']} frames tracked without it")
+
+@run.command()
+@click.argument("name", type=click.Choice(["preprocess", "frame", "background", "tracker", "faceDetectors"]))
+@click.option("-n", "--iterations", type=int, default=200, help="Timed runs (after a short warm up), or frames of the recording")
+@click.option("-r", "--recording", type=click.Path(exists=True), help="Recording to run on, needed by faceDetectors")
+def benchmark(name, iterations, recording):
+    """ Time one of the tracker's per frame stages on generated 1536P frames (or a recording), no camera needed. """
+    output = study.run_benchmark(name, iterations, recording)
+    if "error" in output:
+        print(output["error"])
+        return
+    for stage, stats in output["results"].items():
+        if isinstance(stats, dict) and "agreement" in stats:
+            print(f"{stage}: {stats['framesPerSecond']:.1f} fps, p95 {stats['p95Ms']:.1f}ms, agrees with cnn on {stats['agreement'] * 100:.1f}% of frames (mean IoU {stats['meanIoU']:.2f})")
+        elif isinstance(stats, dict) and "p50Ms" in stats:
+            print(f"{stage}: p50 {stats['p50Ms']:.2f}ms, p95 {stats['p95Ms']:.2f}ms, p99 {stats['p99Ms']:.2f}ms")
+        elif stage == "allocations" and isinstance(stats, dict):
+            for part, counts in stats.items():
+                print(f"{part} allocations: {counts['meanPerFrame']:.1f} per frame, at most {counts['maxPerFrame']}")
+        else:
+            print(f"{stage}: {stats}")
+
+@run.command()
+@click.option("-s", "--switch-every", type=int, default=20, help="Seconds to spend on each profile")
+def profiles(switch_every):
+    """ Cycle the live camera through every capture profile and compare what each one costs. """
+    names = ["default", "lowLatency", "demo", "ir"]
+    schedule = [{"at": i * switch_every, "profile": name} for i, name in enumerate(names[1:], start=1)]
+    output = study.run_simulation("t", 1, False, switch_every * len(names), False, {"profile": names[0], "profileSchedule": schedule})
+
+    data = json.loads(output)
+    tracker_logs = data["trackerLogs"]
+    for switch in tracker_logs.get("profileSwitches", []):
+        print(f"{switch['from']} -> {switch['to']}: {'ok' if switch['success'] else 'failed'} in {switch['switchTime']}ms")
+    for name, cost in tracker_logs.get("profiles", {}).items():
+        capture = cost.get("capture", {})
+        tracking = cost.get("tracking", {})
+        if tracking.get("count", 0) == 0:
+            print(f"{name}: no frames tracked")
+            continue
+        print(f"{name}: capture p50 {capture['p50Ms']:.1f}ms, tracking p50 {tracking['p50Ms']:.1f}ms p95 {tracking['p95Ms']:.1f}ms over {tracking['count']} frames")
+
 @run.command()
 @click.argument("user")
 @click.argument("distance")
@@ -80,7 +185,19 @@ def demo():
     default=False, 
     help="Enable testing mode"
 )
-def task(m, n, user_id, test):
+@click.option(
+    "--record",
+    type=click.Path(dir_okay=False),
+    default=None,
+    help="Archive the camera stream to this mkv file"
+)
+@click.option(
+    "--profile",
+    type=click.Choice(["default", "lowLatency", "demo", "ir"]),
+    default="default",
+    help="Camera resolution/depth mode/frame rate to capture with"
+)
+def task(m, n, user_id, test, record, profile):
     mode = m
     num = n
     user = user_id
@@ -102,7 +219,10 @@ def task(m, n, user_id, test):
             print(f"Result for User ID {user} with Mode {study.mode_map[mode]} and Challenge Number {num} already exists.")
             return
 
-    output = study.run_simulation(mode,num)
+    options = {"profile": profile}
+    if record:
+        options["record"] = record
+    output = study.run_simulation(mode, num, options=options)
     
     if not test:
         # Convert the JSON string to a Python dictionary
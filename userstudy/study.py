@@ -1,4 +1,5 @@
 import ctypes
+import json
 import os
 import sys
 
@@ -17,7 +18,14 @@ mode_map_inverse = {v: k for k, v in mode_map.items()}
 # Map from shorthand mode to an integer for ctypes
 mode_ctypes_map = {"TRACKER": 0,  "TRACKER_OFFSET": 1, "STATIC": 2, "STATIC_OFFSET": 3}
 
-def run_simulation(mode, challenge_num, debug=False, timeout=60, beep=True):
+def load_library():
+    # Set the path to the library
+    dir_path = os.path.dirname(os.path.realpath(__file__))
+    parent_dir = os.path.dirname(dir_path)
+    lib_path = os.path.join(parent_dir, "result/bin/libvolsim.so")
+    return ctypes.CDLL(lib_path)
+
+def run_simulation(mode, challenge_num, debug=False, timeout=60, beep=True, options=None):
     if beep:
         utility.play_beep()
     # Convert input mode shorthand to full mode
@@ -25,16 +33,23 @@ def run_simulation(mode, challenge_num, debug=False, timeout=60, beep=True):
     # Convert full mode to ctypes
     mode_ctypes = mode_ctypes_map[mode_full]
 
-    # Set the path to the library
-    dir_path = os.path.dirname(os.path.realpath(__file__))
-    parent_dir = os.path.dirname(dir_path)
-    lib_path = os.path.join(parent_dir, "result/bin/libvolsim.so")
-    handle = ctypes.CDLL(lib_path)
+    handle = load_library()
 
     # Specify the types of the input parameters and the return type for runSimulation
-    handle.runSimulation.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_bool]
+    handle.runSimulation.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_float, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_bool, ctypes.c_char_p]
     handle.runSimulation.restype = ctypes.c_char_p
 
-    result = handle.runSimulation(mode_ctypes, challenge_num, camera_x, camera_y, camera_z, camera_rot, mainMonitor, offsetMonitor, timeout, debug)
+    # Extra tracker settings are passed through as a JSON object
+    tracker_options = json.dumps(options or {}).encode("utf-8")
+
+    result = handle.runSimulation(mode_ctypes, challenge_num, camera_x, camera_y, camera_z, camera_rot, mainMonitor, offsetMonitor, timeout, debug, tracker_options)
+
+    return result.decode("utf-8")  # Decode the result from bytes to string
+
+def run_benchmark(name, iterations=200, recording=None):
+    handle = load_library()
+    handle.runBenchmark.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p]
+    handle.runBenchmark.restype = ctypes.c_char_p
 
-    return result.decode("utf-8")  # Decode the result from bytes to string
\ No newline at end of file
+    result = handle.runBenchmark(name.encode("utf-8"), iterations, (recording or "").encode("utf-8"))
+    return json.loads(result.decode("utf-8"))
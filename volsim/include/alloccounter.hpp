@@ -0,0 +1,23 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+// Counts operator new calls made on the constructing thread while it is alive, for checking a hot path doesn't allocate.
+// Only sees C++ allocations (std containers, dlib), not malloc based ones such as cv::Mat buffers.
+// Counters don't nest, the innermost one wins. Counts nothing unless built with VOLSIM_COUNT_ALLOCATIONS.
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+    uint64_t getCount() const;
+    // Whether this build replaces operator new, the counts are meaningless otherwise
+    static bool isCounting();
+
+private:
+    uint64_t count = 0;
+    uint64_t *previous;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <opencv2/core.hpp>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "json.hpp"
+#include "latency.hpp"
+
+// background = max(background, depth) for one row, except where the background is still unknown (0) once learned.
+// Uses AVX2 or SSE4.1 when the build targets them.
+void learnBackground(const uint16_t *depth, uint16_t *background, int width, bool learned);
+// Depth where it is at least margin mm in front of the background (or the background is unknown), 0 elsewhere.
+// Also learns, as learnBackground(..., true) would.
+void segmentForeground(const uint16_t *depth, uint16_t *background, uint16_t *foreground, int width, uint16_t margin);
+
+// The room is static during a session, only the participant moves. Learns the farthest depth each pixel shows over
+// the first few seconds and from then on zeroes everything that isn't in front of it, so the depth consumers
+// (head search, hand crops, point cloud) only see what moved. Anything that stays perfectly still for the whole
+// learning time is learnt as background, consumers should treat an empty foreground as "don't know".
+// Keeps its model between calls, only use from one thread.
+class BackgroundModel
+{
+public:
+    explicit BackgroundModel(const nlohmann::json &options);
+    // Learns from the frame, and once learning is over writes it with the static pixels zeroed to foreground
+    // (same size) and returns true. A new frame size starts learning again.
+    bool segment(const uint16_t *depth, int depthStride, int width, int height, std::chrono::steady_clock::time_point time, uint16_t *foreground, int foregroundStride);
+    // Bounding boxes (depth pixels) of the moving parts of the last segmented frame, largest first
+    const std::vector<cv::Rect> &getRegions() const;
+    nlohmann::json returnJson() const;
+
+private:
+    void findRegions(const uint16_t *foreground, int foregroundStride, int width, int height);
+
+    std::chrono::steady_clock::duration learnTime;
+    uint16_t margin;
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint16_t> background;
+    std::chrono::steady_clock::time_point learnStart;
+    bool learned = false;
+    std::vector<cv::Rect> regions;
+
+    uint64_t relearns = 0;
+    uint64_t learnFrames = 0;
+    uint64_t segmentedFrames = 0;
+    double foregroundCellSum = 0.0;
+    LatencyStats segmentCost;
+
+    cv::Mat cells;
+    cv::Mat labels;
+    cv::Mat stats;
+    cv::Mat centroids;
+};
+
+#endif
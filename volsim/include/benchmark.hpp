@@ -0,0 +1,9 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Micro benchmarks of the tracker's per frame stages, run without a camera or a window.
+// input is a recording for the benchmarks that need real footage ("faceDetectors"), otherwise ignored.
+// Returns a JSON string, or a JSON object with an "error" key for an unknown benchmark.
+extern "C" const char *runBenchmark(const char *name, int iterations, const char *input);
+
+#endif
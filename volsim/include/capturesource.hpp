@@ -0,0 +1,106 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+// A named camera setup, trading resolution for latency or the other way round
+struct CaptureProfile
+{
+    std::string name;
+    k4a_color_resolution_t colorResolution;
+    k4a_depth_mode_t depthMode;
+    k4a_fps_t fps;
+    k4a_image_format_t colorFormat;
+
+    static const std::vector<CaptureProfile> &all();
+    static std::optional<CaptureProfile> find(const std::string &name);
+};
+
+// Somewhere the tracker can pull k4a captures and the matching calibration from
+class CaptureSource
+{
+public:
+    virtual ~CaptureSource() = default;
+    // Waits up to timeout ms for the next capture, the caller owns (and must release) the capture
+    virtual k4a_wait_result_t getCapture(k4a_capture_t *capture, int32_t timeout) = 0;
+    virtual k4a_result_t getCalibration(k4a_calibration_t *calibration) = 0;
+    // The camera settings the captures look like they were taken with
+    virtual k4a_device_configuration_t getConfiguration() = 0;
+    // Calibration blob as stored by the device, empty if the source has none
+    virtual std::vector<uint8_t> getRawCalibration();
+    // Reconfigures the cameras, false if the source can't (recordings are fixed) or the profile failed to start.
+    // Must be called from the thread pulling captures, the calibration changes with it.
+    virtual bool setProfile(const CaptureProfile &profile);
+    virtual std::string getProfileName();
+    virtual nlohmann::json returnJson();
+
+    static std::unique_ptr<CaptureSource> create(const nlohmann::json &options);
+};
+
+// A physically attached Azure Kinect
+class DeviceCaptureSource : public CaptureSource
+{
+public:
+    // forceBgra overrides the color format of every profile
+    DeviceCaptureSource(uint32_t index, const CaptureProfile &profile, bool forceBgra = false);
+    ~DeviceCaptureSource();
+    k4a_wait_result_t getCapture(k4a_capture_t *capture, int32_t timeout) override;
+    k4a_result_t getCalibration(k4a_calibration_t *calibration) override;
+    k4a_device_configuration_t getConfiguration() override;
+    std::vector<uint8_t> getRawCalibration() override;
+    bool setProfile(const CaptureProfile &profile) override;
+    std::string getProfileName() override;
+
+private:
+    k4a_device_configuration_t toConfiguration(const CaptureProfile &profile);
+
+    k4a_device_t device = NULL;
+    k4a_device_configuration_t config;
+    std::string profileName;
+    bool forceBgra;
+};
+
+// A k4arecord (mkv) file, replayed either at the recorded frame rate or as fast as it can be read
+class PlaybackCaptureSource : public CaptureSource
+{
+public:
+    PlaybackCaptureSource(const std::string &path, bool realtime);
+    ~PlaybackCaptureSource();
+    k4a_wait_result_t getCapture(k4a_capture_t *capture, int32_t timeout) override;
+    k4a_result_t getCalibration(k4a_calibration_t *calibration) override;
+    k4a_device_configuration_t getConfiguration() override;
+    std::vector<uint8_t> getRawCalibration() override;
+    nlohmann::json returnJson() override;
+
+private:
+    // Next capture with both images, failed after a whole pass through the recording without one
+    k4a_wait_result_t readNext(k4a_capture_t *capture);
+    // Sleeps until the capture is due, false if that's further off than timeout (ms) and it should be kept
+    bool pace(k4a_capture_t capture, int32_t timeout);
+
+    k4a_playback_t playback = NULL;
+    k4a_record_configuration_t recordConfig;
+    std::string path;
+    bool realtime;
+
+    // Maps recorded device time onto the host clock when pacing
+    std::optional<uint64_t> firstTimestamp;
+    std::chrono::steady_clock::time_point playbackStart;
+    // Read but not yet due
+    k4a_capture_t pending = NULL;
+    // Read all the way through without finding a usable capture
+    bool unusable = false;
+
+    uint64_t framesRead = 0;
+    uint64_t framesSkipped = 0;
+    uint64_t loops = 0;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef DEPTH_RECT_H
+#define DEPTH_RECT_H
+
+#include <k4a/k4a.h>
+#include <opencv2/core.hpp>
+
+// Where a rectangle of native depth pixels, taken to be z mm away, lands in another camera's image. Only the corners
+// are moved, so the depth searches never need the whole image registered to the color camera. The result is in
+// pixels of that camera divided by scale (2 for the half size tracking frame), empty if no corner lands in it.
+cv::Rect2f depthRectTo(const k4a_calibration_t &calibration, const cv::Rect2f &rect, float z, k4a_calibration_type_t camera, float scale);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef FACE_DETECTOR_H
+#define FACE_DETECTOR_H
+
+#include <dlib/geometry.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "framebuffer.hpp"
+
+// Finds faces in a tracking frame. Backends trade accuracy for speed:
+//  "cnn"  dlib's MMOD CNN, the most robust, slow without CUDA
+//  "hog"  dlib's HOG frontal face detector, fast on CPU but only finds roughly frontal faces
+//  "dnn"  OpenCV's DNN module running a Caffe SSD (res10_300x300), fast on CPU
+// Confidences are each backend's own score, they are only comparable between detections from the same backend.
+class FaceDetector
+{
+public:
+    struct Detection
+    {
+        dlib::rectangle rect;
+        float confidence;
+    };
+
+    virtual ~FaceDetector() = default;
+    // Highest confidence first
+    virtual std::vector<Detection> detect(FrameBuffer &frame) = 0;
+    virtual std::string getName() const = 0;
+    // Searches only region, scaled down if needed so a face faceSize pixels wide comes out just above the smallest
+    // face the backends find reliably. The small crop leaves the detector's image pyramid only a few levels.
+    // Boxes are in frame coordinates, highest confidence first.
+    std::vector<Detection> detectIn(FrameBuffer &frame, const dlib::rectangle &region, float faceSize);
+
+    // Picks the backend from options["faceDetector"] (default "cnn"), the dnn backend's files can be moved with
+    // options["faceDetectorModel"] and options["faceDetectorConfig"]
+    static std::unique_ptr<FaceDetector> create(const nlohmann::json &options);
+    static std::unique_ptr<FaceDetector> create(const std::string &name, const nlohmann::json &options = nlohmann::json::object());
+    static const std::vector<std::string> &names();
+
+private:
+    FrameBuffer crop;
+};
+
+#endif
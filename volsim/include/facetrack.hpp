@@ -0,0 +1,85 @@
+#ifndef FACE_TRACK_H
+#define FACE_TRACK_H
+
+#include <dlib/geometry.h>
+#include <dlib/image_processing/full_object_detection.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <map>
+#include <string>
+#include "json.hpp"
+#include "latency.hpp"
+
+// Follows one face between detections by re-running only the 5 point landmark predictor where the face is
+// expected to be next. The landmarks are checked against the shape they had when the face was detected and the
+// track is dropped as soon as they stop agreeing, so the caller knows to run the detector again.
+// Only used by the face stage thread.
+class FaceTrack
+{
+public:
+    // Why the detector has to run on a frame
+    enum class Reason
+    {
+        NONE,     // the tracked box can be reused
+        NO_FACE,  // nothing is being tracked (start up, or the last detection found nothing)
+        LOST,     // the landmarks stopped looking like the detected face
+        EDGE,     // the predicted box leaves the frame
+        INTERVAL, // periodic re-detection to catch drift
+    };
+
+    // redetectInterval is the most frames to go without the detector, 0 runs it on every frame
+    explicit FaceTrack(int redetectInterval);
+
+    Reason needsDetection(long frameWidth, long frameHeight) const;
+    // Where to run the predictor: the last box moved by the last frame's motion and grown to cover it
+    dlib::rectangle predictedBox() const;
+    // Start a new track from a detector box and the landmarks found in it
+    void detected(const dlib::rectangle &box, const dlib::full_object_detection &shape);
+    void notDetected();
+    // Confidence (0-1) that the landmarks still belong to the tracked face, the track is dropped below MIN_CONFIDENCE
+    float tracked(const dlib::full_object_detection &shape);
+
+    // Time spent on a frame's face stage, with why the detector ran
+    void addDetectCost(Reason reason, std::chrono::steady_clock::duration duration);
+    void addTrackCost(std::chrono::steady_clock::duration duration);
+    nlohmann::json returnJson() const;
+
+    static const char *reasonName(Reason reason);
+    static constexpr float MIN_CONFIDENCE = 0.7f;
+
+private:
+    struct Shape
+    {
+        glm::vec2 centroid;
+        // Distance between the eye centres
+        float span;
+        // How far the nose sits below the eye line, in spans
+        float noseDrop;
+    };
+    static Shape measure(const dlib::full_object_detection &shape);
+    void place(const Shape &shape);
+
+    int redetectInterval;
+    bool active = false;
+    Reason lossReason = Reason::NO_FACE;
+    int framesSinceDetection = 0;
+
+    dlib::drectangle box;
+    glm::vec2 velocity{0.0f};
+    Shape last;
+    Shape reference;
+    // The detector box relative to the landmarks, in spans, so the box can be rebuilt from tracked landmarks
+    glm::vec2 boxOffset;
+    glm::vec2 boxSize;
+
+    uint64_t detectorRuns = 0;
+    uint64_t trackedFrames = 0;
+    uint64_t losses = 0;
+    std::map<std::string, uint64_t> detectionReasons;
+    std::chrono::steady_clock::time_point firstFrame;
+    std::chrono::steady_clock::time_point lastFrame;
+    LatencyStats detectCost;
+    LatencyStats trackCost;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <cstdint>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <opencv2/core.hpp>
+#include "mediapipe.h"
+
+// One RGB frame for the detectors, stored the way dlib's CNN takes it, with non-owning OpenCV and MediaPipe views
+// of the same pixels. Fill it through cvView() so the channel order is only ever converted by whoever writes it.
+// Views are only valid until the next resize that changes the size.
+class FrameBuffer
+{
+public:
+    // Only reallocates when the size changes
+    void resize(int width, int height);
+    int getWidth() const;
+    int getHeight() const;
+
+    const dlib::matrix<dlib::rgb_pixel> &dlibImage() const;
+    // CV_8UC3 in RGB order
+    cv::Mat cvView();
+    mp_image mpView();
+
+    uint64_t getReallocations() const;
+
+private:
+    dlib::matrix<dlib::rgb_pixel> pixels;
+    uint64_t reallocations = 0;
+};
+
+#endif
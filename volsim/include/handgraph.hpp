@@ -0,0 +1,84 @@
+#ifndef HAND_GRAPH_H
+#define HAND_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include "json.hpp"
+
+#include "mediapipe.h"
+#include "latency.hpp"
+#include "stagequeue.hpp"
+#include "threadstats.hpp"
+
+#define CHECK_MP_RESULT(result)                            \
+    if (!result)                                           \
+    {                                                      \
+        const char *error = mp_get_last_error();           \
+        std::cerr << "[MediaPipe] " << error << std::endl; \
+        mp_free_error(error);                              \
+        std::exit(1);                                      \
+    }
+
+// The MediaPipe hand landmark graph on a thread of its own, so the tracker hands it a frame and carries on
+// with the face while the graph works. The C API stamps packets itself and has no way to read a timestamp back,
+// so results are matched to frames by only ever having one frame in the graph: frames submitted while the graph
+// is busy wait in the hand stage's queue.
+class HandGraph
+{
+public:
+    struct Result
+    {
+        // Whatever the frame was submitted with
+        uint64_t frameId;
+        bool found;
+        // In pixels of the submitted frame, MediaPipe scales z with x
+        glm::vec3 landmarks[21];
+        glm::vec2 centre;
+        glm::vec2 size;
+        float rotation;
+        std::chrono::steady_clock::time_point submittedTime;
+        std::chrono::steady_clock::time_point finishedTime;
+    };
+
+    // Called on the graph thread for every frame that went through the graph
+    HandGraph(std::function<void(const Result &)> onResult, size_t queueDepth, QueuePolicy policy);
+    ~HandGraph();
+    // Copies the image, only blocks when the queue is full and set to block
+    void submit(const mp_image &image, uint64_t frameId);
+    // Stops the graph thread, frames still queued are dropped
+    void stop();
+    // Only once stopped
+    nlohmann::json returnJson();
+
+private:
+    struct Job
+    {
+        mp_packet *packet = nullptr;
+        uint64_t frameId;
+        int width;
+        int height;
+        std::chrono::steady_clock::time_point submittedTime;
+    };
+
+    void run();
+    void collect(const Job &job, Result &result);
+
+    std::function<void(const Result &)> onResult;
+    mp_instance *instance;
+    mp_poller *landmarks_poller;
+    mp_poller *rects_poller;
+
+    StageQueue<Job> queue;
+    std::thread worker;
+
+    // Only touched by the graph thread until it stops
+    ThreadStats threadStats;
+    LatencyStats graphCost;
+    LatencyStats submitToResult;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef HAND_ROI_H
+#define HAND_ROI_H
+
+#include <k4a/k4a.h>
+#include <opencv2/core.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "json.hpp"
+#include "latency.hpp"
+
+// Picks the part of the frame the hand graph is given. While the hand is being found it gets a crop around
+// where it was last seen; after maxMisses misses in a row, a crop around the nearest thing the depth camera
+// sees (a hand reaching for the screen is usually closest); after as many misses again, the whole frame.
+// Not thread safe, the tracker calls it under its hand lock.
+class HandRoi
+{
+public:
+    enum class Source
+    {
+        TRACKED,
+        DEPTH,
+        FULL
+    };
+
+    struct Crop
+    {
+        // In tracking frame pixels, clipped to the frame
+        cv::Rect rect;
+        Source source;
+    };
+
+    explicit HandRoi(const nlohmann::json &options);
+    // Which source the next frame should come from, ask for the depth hint only when this says DEPTH
+    Source nextSource() const;
+    // Held still while the hand stays well inside it
+    Crop trackedCrop(int frameWidth, int frameHeight);
+    // Empty rect if nothing is in range. Searches the native depth image and moves only the crop into the tracking
+    // frame, taken from camera at scale of its pixels (see depthRectTo)
+    Crop depthCrop(k4a_image_t depthImage, const k4a_calibration_t &calibration, k4a_calibration_type_t camera, float scale, int frameWidth, int frameHeight);
+    static Crop fullFrame(int frameWidth, int frameHeight);
+
+    // Results, box in tracking frame pixels
+    void found(const Crop &crop, const cv::RotatedRect &box, std::chrono::steady_clock::duration handTime);
+    void missed(const Crop &crop, std::chrono::steady_clock::duration handTime);
+
+    nlohmann::json returnJson() const;
+    static std::string sourceName(Source source);
+
+private:
+    struct Score
+    {
+        uint64_t frames = 0;
+        uint64_t found = 0;
+        LatencyStats handTime;
+    };
+
+    void count(Source source, bool hit, std::chrono::steady_clock::duration handTime);
+
+    float scale;
+    int maxMisses;
+    float minDepth;
+    float maxDepth;
+    float depthBand;
+
+    bool tracking = false;
+    cv::RotatedRect lastBox;
+    // The crop the hand is being tracked in, empty until one is picked
+    cv::Rect held;
+    uint64_t moves = 0;
+    // Misses in a row with the current source
+    int misses = 0;
+    Source coldSource = Source::DEPTH;
+
+    Score scores[3];
+    uint64_t lost = 0;
+    uint64_t recovered = 0;
+    uint64_t framesLost = 0;
+
+    cv::Mat mask;
+    cv::Mat labels;
+    cv::Mat stats;
+    cv::Mat centroids;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef HEAD_SEARCH_H
+#define HEAD_SEARCH_H
+
+#include <k4a/k4a.h>
+#include <dlib/geometry.h>
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Uses the native depth image to find where a head could be: the top of anything within the seating distance of
+// the screen. Each region comes with the face size its depth implies, so a detector only has to search that crop
+// at a narrow band of scales instead of the whole frame at every scale. Regions are in depth pixels, move them into
+// the frame the detector runs on with toFrame.
+// Keeps scratch buffers between calls, only use from one thread.
+class HeadSearch
+{
+public:
+    struct Region
+    {
+        // In depth pixels
+        dlib::rectangle rect;
+        // Expected face width in depth pixels
+        float faceSize;
+        float depth;
+    };
+
+    HeadSearch(float minDepth, float maxDepth);
+    // Largest candidates first, empty if nothing is in range (the caller should fall back to the whole frame)
+    // fx is the depth camera's focal length (pixels)
+    std::vector<Region> find(k4a_image_t depthImage, float fx);
+    // Moves a region into the frame the detector runs on, taken from camera at scale of its pixels (see
+    // depthRectTo), and clips it to the frame. False if none of it is in the frame.
+    static bool toFrame(Region &region, const k4a_calibration_t &calibration, k4a_calibration_type_t camera, float scale, int frameWidth, int frameHeight);
+
+private:
+    float minDepth;
+    float maxDepth;
+    cv::Mat mask;
+    cv::Mat depth;
+    cv::Mat labels;
+    cv::Mat stats;
+    cv::Mat centroids;
+};
+
+#endif
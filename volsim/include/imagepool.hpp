@@ -0,0 +1,40 @@
+#ifndef IMAGE_POOL_H
+#define IMAGE_POOL_H
+
+#include <k4a/k4a.h>
+#include <mutex>
+#include <vector>
+#include "json.hpp"
+
+// A fixed set of same sized k4a images backed by memory allocated once up front.
+// Buffers go back to the pool when the last reference to their k4a image is released.
+// Anyone holding pooled images must also hold a shared_ptr to the pool so it outlives them.
+class ImagePool
+{
+public:
+    ImagePool(k4a_image_format_t format, int width, int height, int strideBytes, size_t count);
+    // A pooled image if one is free, otherwise a freshly allocated one (counted as exhaustion)
+    k4a_image_t acquire();
+    nlohmann::json returnJson();
+
+private:
+    static void release(void *buffer, void *context);
+    void giveBack(uint8_t *buffer);
+
+    k4a_image_format_t format;
+    int width;
+    int height;
+    int strideBytes;
+    size_t bufferSize;
+
+    std::vector<std::vector<uint8_t>> storage;
+    std::mutex mutex;
+    std::vector<uint8_t *> freeBuffers;
+
+    size_t inUse = 0;
+    size_t highWaterMark = 0;
+    uint64_t acquired = 0;
+    uint64_t exhausted = 0;
+};
+
+#endif
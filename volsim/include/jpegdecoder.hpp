@@ -0,0 +1,24 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <k4a/k4a.h>
+#include <turbojpeg.h>
+#include <opencv2/core.hpp>
+
+// Decodes MJPEG color frames with libjpeg-turbo.
+// Scaling happens inside the IDCT so a reduced size decode never touches the full resolution image.
+// A decoder (and its tjhandle) must only be used from one thread at a time.
+class JpegDecoder
+{
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+    // Decodes an MJPG k4a image at 1/scaleDenom of its size into out, pixelFormat is TJPF_BGR, TJPF_RGB or TJPF_BGRA.
+    // If out is already the right size and type (e.g. a view over someone else's buffer) it is decoded into in place.
+    bool decode(k4a_image_t image, int scaleDenom, int pixelFormat, cv::Mat &out);
+
+private:
+    tjhandle handle = NULL;
+};
+
+#endif
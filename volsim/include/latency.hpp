@@ -0,0 +1,125 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "json.hpp"
+
+// Keeps every sample of one latency so percentiles can be reported at the end of a session
+class LatencyStats
+{
+public:
+    void add(std::chrono::steady_clock::duration duration)
+    {
+        samples.push_back(std::chrono::duration<double, std::milli>(duration).count());
+    }
+
+    nlohmann::json returnJson() const
+    {
+        nlohmann::json stats;
+        stats["count"] = samples.size();
+        if (samples.empty())
+        {
+            return stats;
+        }
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double sample : sorted)
+        {
+            total += sample;
+        }
+        stats["meanMs"] = total / sorted.size();
+        stats["p50Ms"] = percentile(sorted, 0.50);
+        stats["p95Ms"] = percentile(sorted, 0.95);
+        stats["p99Ms"] = percentile(sorted, 0.99);
+        stats["maxMs"] = sorted.back();
+        return stats;
+    }
+
+private:
+    // Nearest rank
+    static double percentile(const std::vector<double> &sorted, double fraction)
+    {
+        size_t rank = (size_t)std::ceil(fraction * sorted.size());
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    std::vector<double> samples;
+};
+
+// Follows tracker results from the capture they came from to the buffer swap that first shows them.
+// All times are steady_clock, device timestamps are only carried along to line frames up with other logs.
+// Only the render thread should use it.
+class FrameLatency
+{
+public:
+    // A result has just been handed to the renderer, results from a capture already seen are ignored
+    void submitted(uint64_t deviceTimestamp, std::chrono::steady_clock::time_point arrivalTime, std::chrono::steady_clock::time_point trackedTime)
+    {
+        if (lastArrivalTime.has_value() && lastArrivalTime.value() == arrivalTime)
+        {
+            return;
+        }
+        lastArrivalTime = arrivalTime;
+        pending = Pending{deviceTimestamp, arrivalTime, trackedTime, std::chrono::steady_clock::now()};
+    }
+
+    // Call straight after the swap, gives the breakdown for the result that just went on screen (if any)
+    std::optional<nlohmann::json> swapped()
+    {
+        if (!pending.has_value())
+        {
+            return {};
+        }
+        auto swapTime = std::chrono::steady_clock::now();
+        Pending frame = pending.value();
+        pending.reset();
+
+        captureToTrack.add(frame.trackedTime - frame.arrivalTime);
+        trackToSubmit.add(frame.submitTime - frame.trackedTime);
+        submitToSwap.add(swapTime - frame.submitTime);
+        captureToSwap.add(swapTime - frame.arrivalTime);
+
+        nlohmann::json latency;
+        latency["deviceTime"] = frame.deviceTimestamp;
+        latency["captureToTrackMs"] = std::chrono::duration<double, std::milli>(frame.trackedTime - frame.arrivalTime).count();
+        latency["trackToSubmitMs"] = std::chrono::duration<double, std::milli>(frame.submitTime - frame.trackedTime).count();
+        latency["submitToSwapMs"] = std::chrono::duration<double, std::milli>(swapTime - frame.submitTime).count();
+        latency["captureToSwapMs"] = std::chrono::duration<double, std::milli>(swapTime - frame.arrivalTime).count();
+        return latency;
+    }
+
+    nlohmann::json returnJson() const
+    {
+        nlohmann::json latency;
+        latency["captureToTrack"] = captureToTrack.returnJson();
+        latency["trackToSubmit"] = trackToSubmit.returnJson();
+        latency["submitToSwap"] = submitToSwap.returnJson();
+        latency["captureToSwap"] = captureToSwap.returnJson();
+        return latency;
+    }
+
+private:
+    struct Pending
+    {
+        uint64_t deviceTimestamp;
+        std::chrono::steady_clock::time_point arrivalTime;
+        std::chrono::steady_clock::time_point trackedTime;
+        std::chrono::steady_clock::time_point submitTime;
+    };
+
+    std::optional<Pending> pending;
+    std::optional<std::chrono::steady_clock::time_point> lastArrivalTime;
+
+    LatencyStats captureToTrack;
+    LatencyStats trackToSubmit;
+    LatencyStats submitToSwap;
+    LatencyStats captureToSwap;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Hands the newest value from one producer thread to one consumer thread (a triple buffer).
+// Both sides only ever swap slot indices with a single atomic exchange: no locks, no allocation,
+// and a value the consumer never got round to is simply replaced and counted as superseded.
+// A consumer with nothing else to do can sleep in waitForFresh instead of polling.
+template <typename T>
+class LatestMailbox
+{
+public:
+    // Producer side
+    void publish(T value)
+    {
+        slots[back] = std::move(value);
+        uint8_t previous = state.exchange(back | FRESH, std::memory_order_seq_cst);
+        back = previous & INDEX;
+        if (previous & FRESH)
+        {
+            superseded.fetch_add(1, std::memory_order_relaxed);
+        }
+        published.fetch_add(1, std::memory_order_relaxed);
+
+        // Only pay for the wakeup when the consumer is actually asleep
+        if (waiting.load(std::memory_order_seq_cst))
+        {
+            {
+                std::lock_guard<std::mutex> lock(waitMutex);
+            }
+            waitCondition.notify_one();
+        }
+    }
+
+    // Consumer side, blocks until something new is published or the timeout passes
+    bool waitForFresh(std::chrono::milliseconds timeout)
+    {
+        if (state.load(std::memory_order_acquire) & FRESH)
+        {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(waitMutex);
+        waiting.store(true, std::memory_order_seq_cst);
+        bool fresh = waitCondition.wait_for(lock, timeout, [this]
+                                            { return (state.load(std::memory_order_seq_cst) & FRESH) != 0; });
+        waiting.store(false, std::memory_order_relaxed);
+        return fresh;
+    }
+
+    // Consumer side, false if nothing new has been published since the last call
+    bool consume(T &value)
+    {
+        if (!(state.load(std::memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+        front = state.exchange(front, std::memory_order_acq_rel) & INDEX;
+        value = slots[front];
+        return true;
+    }
+
+    uint64_t getPublished() const
+    {
+        return published.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getSuperseded() const
+    {
+        return superseded.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    T slots[3];
+    // Index of the middle slot plus whether it holds something the consumer hasn't seen
+    std::atomic<uint8_t> state{1};
+    // Only touched by the producer
+    uint8_t back = 0;
+    // Only touched by the consumer
+    uint8_t front = 2;
+
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> superseded{0};
+
+    std::atomic<bool> waiting{false};
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+};
+
+#endif
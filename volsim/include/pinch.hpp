@@ -0,0 +1,87 @@
+#ifndef PINCH_H
+#define PINCH_H
+
+#include <k4a/k4a.h>
+#include <opencv2/core.hpp>
+#include <glm/glm.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "json.hpp"
+#include "latency.hpp"
+
+// Finds the fingertips of the hand nearest the depth camera without the hand graph: the nearest blob's outline,
+// and the corners of its convex hull sharp enough to be a finger. A hand reaching for the screen leads with its
+// index and middle fingers, so the two nearest tips stand in for them (which is which doesn't matter for a grab).
+// Held together for a grab they make one tip about two fingers wide, which is reported as both.
+// Only trusted once the hand graph has agreed with it, and the graph keeps checking it every few frames.
+// detect and shouldValidate are for the preprocessing thread, validate for the hand graph thread.
+class PinchDetector
+{
+public:
+    // In depth pixels, nearest first. Both are the same tip when the fingers are held together.
+    struct Tips
+    {
+        cv::Point2f points[2];
+        uint16_t depths[2];
+    };
+
+    explicit PinchDetector(const nlohmann::json &options);
+    // fx is the depth camera's focal length (pixels), false if there's no hand in range, or its only tip is one
+    // finger wide (pointing)
+    bool detect(k4a_image_t depth, float fx, Tips &tips);
+    // Whether the hand graph should see this frame too: always until it's trusted, or when nothing was found,
+    // otherwise every validateEvery frames
+    bool shouldValidate(bool detected);
+    // Screen space fingertips from both for the same frame, either missing if it found nothing
+    void validate(const std::optional<std::array<glm::vec3, 2>> &depthTips, const std::optional<std::array<glm::vec3, 2>> &graphTips);
+    bool isTrusted() const;
+    nlohmann::json returnJson();
+
+private:
+    float minDepth;
+    float maxDepth;
+    float depthBand;
+    int validateEvery;
+    float maxError;
+
+    std::atomic<bool> trusted{false};
+    // Frames since the graph last checked, preprocessing thread only
+    int unvalidated = 0;
+
+    cv::Mat mask;
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<int> hull;
+    struct Candidate
+    {
+        uint16_t depth;
+        cv::Point pixel;
+        // Of the outline a reach back from the tip, in finger widths
+        float width;
+    };
+    std::vector<Candidate> candidates;
+
+    // Preprocessing thread only
+    uint64_t frames = 0;
+    uint64_t found = 0;
+    uint64_t together = 0;
+    uint64_t fastFrames = 0;
+    LatencyStats detectCost;
+
+    // The rest is written by the hand graph thread
+    std::mutex mutex;
+    uint64_t validations = 0;
+    uint64_t agreed = 0;
+    uint64_t disagreed = 0;
+    // Found by the graph but not by depth, and by depth but not the graph
+    uint64_t depthMissed = 0;
+    uint64_t graphMissed = 0;
+    double errorSum = 0.0;
+    float worstError = 0.0f;
+};
+
+#endif
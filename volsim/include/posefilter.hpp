@@ -0,0 +1,114 @@
+#ifndef POSE_FILTER_H
+#define POSE_FILTER_H
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include "json.hpp"
+
+// Smooths one tracked point (cm) and extrapolates it forward in time, so the renderer can ask where the point will
+// be when the frame it is drawing actually reaches the screen rather than where it was a capture ago.
+// Measurements are stamped with when their capture reached the host, queries with the expected photon time.
+// Only used from one thread (the render loop).
+class PoseFilter
+{
+public:
+    virtual ~PoseFilter() = default;
+    // Measurements at or before the last one's time are ignored (the same tracking result seen twice)
+    void update(glm::vec3 measurement, std::chrono::steady_clock::time_point time);
+    // Nothing until the first measurement. Extrapolation stops maxPrediction after the last measurement, and once
+    // a measurement is overdue the last filtered position is held
+    std::optional<glm::vec3> predict(std::chrono::steady_clock::time_point time);
+    virtual std::string getName() const = 0;
+    nlohmann::json returnJson() const;
+
+    // options["poseFilter"]: "oneEuro" (default), "kalman" or "none", tuning is read from the same object
+    static std::unique_ptr<PoseFilter> create(const nlohmann::json &options);
+
+protected:
+    explicit PoseFilter(const nlohmann::json &options);
+    // Start again from a single measurement
+    virtual void reset(glm::vec3 measurement) = 0;
+    virtual void correct(glm::vec3 measurement, float dt) = 0;
+    virtual glm::vec3 extrapolate(float horizon) const = 0;
+
+private:
+    std::chrono::duration<float> maxPrediction;
+    // A gap this long means tracking was lost, old velocity says nothing about the new measurement
+    std::chrono::duration<float> maxGap;
+    std::optional<std::chrono::steady_clock::time_point> lastTime;
+    // When the last measurement was handed in, and the usual time between them
+    std::chrono::steady_clock::time_point lastReceived;
+    std::chrono::duration<float> interval;
+
+    uint64_t updates = 0;
+    uint64_t resets = 0;
+    uint64_t predictions = 0;
+    uint64_t stalePredictions = 0;
+    double horizonSumMs = 0.0;
+};
+
+// Casiez et al.'s 1 Euro filter: a low pass whose cutoff rises with speed, so it is steady at rest and keeps up when
+// moving. Predicts with its own smoothed velocity.
+class OneEuroFilter : public PoseFilter
+{
+public:
+    explicit OneEuroFilter(const nlohmann::json &options);
+    std::string getName() const override;
+
+protected:
+    void reset(glm::vec3 measurement) override;
+    void correct(glm::vec3 measurement, float dt) override;
+    glm::vec3 extrapolate(float horizon) const override;
+
+private:
+    static float alpha(float cutoff, float dt);
+
+    float minCutoff;
+    float beta;
+    float derivativeCutoff;
+    glm::vec3 position;
+    glm::vec3 velocity;
+};
+
+// Constant velocity Kalman filter, the same model on each axis so they share one covariance
+class KalmanFilter : public PoseFilter
+{
+public:
+    explicit KalmanFilter(const nlohmann::json &options);
+    std::string getName() const override;
+
+protected:
+    void reset(glm::vec3 measurement) override;
+    void correct(glm::vec3 measurement, float dt) override;
+    glm::vec3 extrapolate(float horizon) const override;
+
+private:
+    // Acceleration noise (cm^2/s^3) and measurement variance (cm^2)
+    float processNoise;
+    float measurementNoise;
+    glm::vec3 position;
+    glm::vec3 velocity;
+    // Covariance of [position, velocity]
+    float p00, p01, p11;
+};
+
+// Hands measurements straight back, for comparing against the raw tracker
+class PassthroughFilter : public PoseFilter
+{
+public:
+    explicit PassthroughFilter(const nlohmann::json &options);
+    std::string getName() const override;
+
+protected:
+    void reset(glm::vec3 measurement) override;
+    void correct(glm::vec3 measurement, float dt) override;
+    glm::vec3 extrapolate(float horizon) const override;
+
+private:
+    glm::vec3 position;
+};
+
+#endif
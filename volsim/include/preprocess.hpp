@@ -0,0 +1,21 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// BGRA -> BGR and a 2x2 box downsample in a single pass over the source, two rows at a time.
+// Stands in for cvtColor + pyrDown (the box filter is slightly softer than pyrDown's gaussian,
+// which makes no difference to the detectors). Uses AVX2 or SSSE3 when the build targets them.
+void halfScaleBgraToBgr(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride);
+// Allocates (or reuses) bgr as a (width / 2) x (height / 2) CV_8UC3 image
+void halfScaleBgraToBgr(const cv::Mat &bgra, cv::Mat &bgr);
+// The same with red and blue swapped on the way out, for dlib and MediaPipe
+void halfScaleBgraToRgb(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride);
+void halfScaleBgraToRgb(const cv::Mat &bgra, cv::Mat &rgb);
+// Brightness of a 16 bit IR image the detectors should see as white
+uint16_t irWhitePoint(const uint16_t *src, int srcStride, int width, int height);
+// 16 bit IR to 8 bit grey in all three channels of an RGB image, same size, white and above saturate
+void irToRgb(const uint16_t *src, int srcStride, int width, int height, uint16_t white, uint8_t *dst, int dstStride);
+
+#endif
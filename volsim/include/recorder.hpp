@@ -0,0 +1,47 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <k4a/k4a.h>
+#include <k4arecord/record.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+#include "spscqueue.hpp"
+
+// Archives captures to a k4arecord (mkv) file on its own I/O thread.
+// push never blocks: when the disk falls behind and the queue is full the capture is dropped and counted.
+class SessionRecorder
+{
+public:
+    SessionRecorder(const std::string &path, k4a_device_configuration_t config, const std::vector<uint8_t> &rawCalibration, size_t queueSize = 60);
+    ~SessionRecorder();
+    void push(k4a_capture_t capture);
+    void close();
+    nlohmann::json returnJson();
+
+private:
+    void writeLoop();
+
+    k4a_record_t recording = NULL;
+    std::string path;
+    SpscQueue<k4a_capture_t> queue;
+    std::thread writer;
+    std::atomic<bool> running;
+    // The writer sleeps on this while the queue is empty
+    std::atomic<bool> waiting{false};
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+
+    std::atomic<uint64_t> framesQueued{0};
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<uint64_t> framesDropped{0};
+    std::atomic<uint64_t> writeErrors{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<size_t> maxQueueDepth{0};
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef RIG_H
+#define RIG_H
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "json.hpp"
+#include "tracker.hpp"
+
+// Several cameras watching the same user, each a Tracker with its own capture source, extrinsics and worker threads.
+// Eye and fingertip estimates are fused by confidence, leaving out cameras whose latest result is much older than the newest.
+// A rig of one camera behaves exactly like that camera's Tracker.
+class TrackerRig
+{
+public:
+    TrackerRig(std::vector<std::unique_ptr<Tracker>> trackers);
+    // The primary camera from the top level options plus one per entry in options["cameras"]. Each entry is merged over
+    // the top level options (less "record"), so it only lists what differs: its source settings and "position"/"rotation"
+    // (screen space cm, degrees) in place of the primary's offset/rotation
+    static std::unique_ptr<TrackerRig> create(const nlohmann::json &options, glm::vec3 primaryOffset, glm::vec3 primaryRotation, bool debug);
+
+    size_t size();
+    Tracker &getTracker(size_t index);
+    // The camera the debug images come from
+    Tracker &getPrimary();
+
+    // Changes whenever any camera has a new tracking frame
+    uint64_t getFrameSequence();
+    std::optional<glm::vec3> getLeftEyePos();
+    std::optional<std::vector<glm::vec3>> getHandLandmarks();
+    // Timing of the newest capture that went into the current fused results
+    std::optional<Tracker::FrameTimes> getFaceFrameTimes();
+    std::optional<Tracker::FrameTimes> getHandFrameTimes();
+
+    bool isReady();
+    bool requestProfile(const std::string &name);
+    void close();
+    nlohmann::json returnJson();
+
+private:
+    std::optional<Tracker::Estimate> fuse(const std::vector<std::optional<Tracker::Estimate>> &estimates, const char *logKey);
+
+    std::vector<std::unique_ptr<Tracker>> trackers;
+    std::optional<Tracker::Estimate> eye;
+    std::optional<Tracker::Estimate> hand;
+    nlohmann::json fusionLog;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock free queue for exactly one producer thread and one consumer thread.
+// Neither side ever blocks, a full queue just refuses the push.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    bool tryPush(const T &value)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % slots.size();
+        if (next == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        slots[tail] = value;
+        this->tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &value)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = slots[head];
+        this->head.store((head + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t head = this->head.load(std::memory_order_acquire);
+        size_t tail = this->tail.load(std::memory_order_acquire);
+        return (tail + slots.size() - head) % slots.size();
+    }
+
+    size_t capacity() const
+    {
+        return slots.size() - 1;
+    }
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+#endif
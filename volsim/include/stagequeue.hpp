@@ -0,0 +1,141 @@
+#ifndef STAGE_QUEUE_H
+#define STAGE_QUEUE_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+#include "latency.hpp"
+
+// What a full stage queue does with a new frame: drop the oldest one, since only the newest result is ever shown,
+// or wait for the consumer to make room so every frame is processed
+enum class QueuePolicy
+{
+    DROP_OLDEST,
+    BLOCK
+};
+
+// "block", anything else is drop oldest
+inline QueuePolicy parseQueuePolicy(const std::string &name)
+{
+    return name == "block" ? QueuePolicy::BLOCK : QueuePolicy::DROP_OLDEST;
+}
+
+// Bounded queue between two stages of the tracking pipeline, one producer thread and one consumer thread
+template <typename T>
+class StageQueue
+{
+public:
+    StageQueue(size_t capacity, QueuePolicy policy) : capacity(std::max<size_t>(capacity, 1)), policy(policy) {}
+
+    // False once closed, the value is then left where it was. Whatever had to go to make room is handed back in
+    // dropped so the producer can recycle it.
+    bool push(T &&value, std::optional<T> &dropped)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (policy == QueuePolicy::BLOCK)
+        {
+            room.wait(lock, [this]
+                      { return entries.size() < capacity || closed; });
+        }
+        if (closed)
+        {
+            return false;
+        }
+        if (entries.size() >= capacity)
+        {
+            dropped = std::move(entries.front().first);
+            entries.pop_front();
+            droppedCount++;
+        }
+        entries.emplace_back(std::move(value), std::chrono::steady_clock::now());
+        pushed++;
+        depthSum += entries.size();
+        maxDepth = std::max(maxDepth, entries.size());
+        lock.unlock();
+        ready.notify_one();
+        return true;
+    }
+
+    // Waits for the oldest entry, false once closed
+    bool pop(T &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]
+                   { return !entries.empty() || closed; });
+        if (closed)
+        {
+            return false;
+        }
+        value = std::move(entries.front().first);
+        queueTime.add(std::chrono::steady_clock::now() - entries.front().second);
+        entries.pop_front();
+        lock.unlock();
+        room.notify_one();
+        return true;
+    }
+
+    // Wakes both sides for good, anything still queued is left for drain
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+        room.notify_all();
+    }
+
+    std::vector<T> drain()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<T> left;
+        for (auto &entry : entries)
+        {
+            left.push_back(std::move(entry.first));
+        }
+        droppedCount += entries.size();
+        entries.clear();
+        return left;
+    }
+
+    // Depth is sampled as each frame goes in
+    nlohmann::json returnJson()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nlohmann::json queueLog;
+        queueLog["capacity"] = capacity;
+        queueLog["policy"] = policy == QueuePolicy::BLOCK ? "block" : "dropOldest";
+        queueLog["pushed"] = pushed;
+        queueLog["dropped"] = droppedCount;
+        queueLog["meanDepth"] = pushed > 0 ? (double)depthSum / pushed : 0.0;
+        queueLog["maxDepth"] = maxDepth;
+        queueLog["queueTime"] = queueTime.returnJson();
+        return queueLog;
+    }
+
+private:
+    const size_t capacity;
+    const QueuePolicy policy;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable room;
+    std::deque<std::pair<T, std::chrono::steady_clock::time_point>> entries;
+    bool closed = false;
+
+    uint64_t pushed = 0;
+    uint64_t droppedCount = 0;
+    uint64_t depthSum = 0;
+    size_t maxDepth = 0;
+    LatencyStats queueTime;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <k4a/k4a.h>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <vector>
+#include "json.hpp"
+#include "capturesource.hpp"
+
+// Renders a parametric head and hand on scripted trajectories into the same color/depth
+// geometry as the live device (1536P BGRA, WFOV 2x2 binned DEPTH16) and logs where the
+// eyes and fingertips really were so tracker output can be checked against it
+class SyntheticCaptureSource : public CaptureSource
+{
+public:
+    // Throws for an fps that isn't above 0
+    SyntheticCaptureSource(float fps, bool realtime);
+    k4a_wait_result_t getCapture(k4a_capture_t *capture, int32_t timeout) override;
+    k4a_result_t getCalibration(k4a_calibration_t *calibration) override;
+    k4a_device_configuration_t getConfiguration() override;
+    nlohmann::json returnJson() override;
+
+private:
+    struct Ellipsoid
+    {
+        glm::vec3 centre;
+        glm::vec3 radii;
+        glm::vec3 color; // BGR
+    };
+
+    // Ground truth in depth camera space (mm)
+    struct Pose
+    {
+        glm::vec3 leftEye;
+        glm::vec3 rightEye;
+        glm::vec3 indexTip;
+        glm::vec3 middleTip;
+    };
+
+    Pose buildScene(double t, std::vector<Ellipsoid> &scene);
+    void renderDepth(const std::vector<Ellipsoid> &scene, uint16_t *buffer);
+    void renderColor(const std::vector<Ellipsoid> &scene, uint8_t *buffer, int stride);
+
+    k4a_calibration_t calibration;
+    float fps;
+    bool realtime;
+    uint64_t frameIndex = 0;
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<float> zBuffer;
+    nlohmann::json groundTruth = nlohmann::json::array();
+};
+
+#endif
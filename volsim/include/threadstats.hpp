@@ -0,0 +1,41 @@
+#ifndef THREAD_STATS_H
+#define THREAD_STATS_H
+
+#include <chrono>
+#include "json.hpp"
+
+// Splits a worker thread's wall time into time spent waiting for work and time spent doing it.
+// Only the owning thread should add to it; read it once the thread has stopped.
+class ThreadStats
+{
+public:
+    void addIdle(std::chrono::steady_clock::duration duration)
+    {
+        idle += duration;
+    }
+
+    void addBusy(std::chrono::steady_clock::duration duration)
+    {
+        busy += duration;
+        iterations++;
+    }
+
+    nlohmann::json returnJson() const
+    {
+        double idleMs = std::chrono::duration<double, std::milli>(idle).count();
+        double busyMs = std::chrono::duration<double, std::milli>(busy).count();
+        nlohmann::json stats;
+        stats["idleMs"] = idleMs;
+        stats["busyMs"] = busyMs;
+        stats["busyFraction"] = (idleMs + busyMs) > 0.0 ? busyMs / (idleMs + busyMs) : 0.0;
+        stats["iterations"] = iterations;
+        return stats;
+    }
+
+private:
+    std::chrono::steady_clock::duration idle{0};
+    std::chrono::steady_clock::duration busy{0};
+    uint64_t iterations = 0;
+};
+
+#endif
@@ -5,43 +5,82 @@
 #include <glm/glm.hpp>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing/shape_predictor.h>
-#include <dlib/dnn.h>
 #include <optional>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <map>
+#include <thread>
 #include "json.hpp"
 
 #include "mediapipe.h"
-
-template <long num_filters, typename SUBNET>
-using con5d = dlib::con<num_filters, 5, 5, 2, 2, SUBNET>;
-template <long num_filters, typename SUBNET>
-using con5 = dlib::con<num_filters, 5, 5, 1, 1, SUBNET>;
-
-template <typename SUBNET>
-using downsampler = dlib::relu<dlib::affine<con5d<32, dlib::relu<dlib::affine<con5d<32, dlib::relu<dlib::affine<con5d<16, SUBNET>>>>>>>>>;
-template <typename SUBNET>
-using rcon5 = dlib::relu<dlib::affine<con5<45, SUBNET>>>;
-
-using net_type = dlib::loss_mmod<dlib::con<1, 9, 9, 1, 1, rcon5<rcon5<rcon5<downsampler<dlib::input_rgb_image_pyramid<dlib::pyramid_down<6>>>>>>>>;
-
-#define CHECK_MP_RESULT(result)                            \
-    if (!result)                                           \
-    {                                                      \
-        const char *error = mp_get_last_error();           \
-        std::cerr << "[MediaPipe] " << error << std::endl; \
-        mp_free_error(error);                              \
-        std::exit(1);                                      \
-    }
+#include "capturesource.hpp"
+#include "recorder.hpp"
+#include "mailbox.hpp"
+#include "threadstats.hpp"
+#include "imagepool.hpp"
+#include "jpegdecoder.hpp"
+#include "latency.hpp"
+#include "framebuffer.hpp"
+#include "facetrack.hpp"
+#include "facedetector.hpp"
+#include "headsearch.hpp"
+#include "handgraph.hpp"
+#include "handroi.hpp"
+#include "background.hpp"
+#include "xytable.hpp"
+#include "stagequeue.hpp"
+#include "pinch.hpp"
 
 class Tracker
 {
 public:
-    Tracker(glm::vec3 initCameraOffset, float yRot, bool debug = false);
+    // Where a result came from, host times are all steady_clock so they can be subtracted from each other
+    struct FrameTimes
+    {
+        uint64_t deviceTimestamp;
+        std::chrono::steady_clock::time_point arrivalTime;
+        std::chrono::steady_clock::time_point trackedTime;
+    };
+
+    // All 21 MediaPipe hand landmarks (indexed by mp_hand_landmark) in screen space.
+    // Landmarks with no depth around them aren't valid and their points are meaningless.
+    struct HandSkeleton
+    {
+        glm::vec3 points[21];
+        bool valid[21];
+    };
+
+    // A result with how much to trust it, for weighing cameras against each other.
+    // Confidence is 0 when there was no depth behind the result.
+    struct Estimate
+    {
+        std::vector<glm::vec3> points;
+        float confidence;
+        FrameTimes times;
+    };
+
+    // rotation is the camera's orientation in degrees about x, then y, then z
+    Tracker(std::unique_ptr<CaptureSource> source, glm::vec3 initCameraOffset, glm::vec3 rotation, bool debug = false, const nlohmann::json &options = nlohmann::json::object());
     ~Tracker();
     void update();
     void close();
+    // Bumped every time a new tracking frame is ready, so readers can skip unchanged frames.
+    // Also takes the newest tracking frame for the getters below, which only ever read that one frame, so call it
+    // once per render frame from the thread that uses them.
+    uint64_t getFrameSequence();
     std::optional<glm::vec3> getLeftEyePos();
     std::optional<glm::vec3> getRightEyePos();
     std::optional<std::vector<glm::vec3>> getHandLandmarks();
+    std::optional<HandSkeleton> getHandSkeleton();
+    // Timing of the captures the current eye and hand results were found in
+    std::optional<FrameTimes> getFaceFrameTimes();
+    std::optional<FrameTimes> getHandFrameTimes();
+    // The left eye, and the index and middle fingertips, with their confidence
+    std::optional<Estimate> getEyeEstimate();
+    std::optional<Estimate> getHandEstimate();
     cv::Mat getDepthImage();
 	cv::Mat getDepthImageImportant();
 	cv::Mat getDepthImageOriginal();
@@ -52,52 +91,145 @@ public:
 	cv::Mat getColorImageSkeletonHand();
     std::vector<glm::vec3> getPointCloud();
     void getLatestCapture();
+    // Asks the capture thread to restart the cameras with another profile, false if the name is unknown
+    // or the session is being recorded (a recording can only have one camera configuration)
+    bool requestProfile(const std::string &name);
     nlohmann::json returnJson();
 	bool isReady();
 
 private:
+    // The camera geometry for one capture profile.
+    // Captures hold on to the model they were taken with, so a profile switch never changes it under an in flight frame.
+    class CameraModel
+    {
+    public:
+        // registersDepth pools color sized images for getRegisteredDepth (only the debug images ask for it),
+        // segmentsBackground pools the foreground images
+        CameraModel(const k4a_calibration_t &calibration, const std::string &profile, bool registersDepth, bool segmentsBackground);
+        ~CameraModel();
+        k4a_calibration_t calibration;
+        k4a_transformation_t transformation;
+        std::string profile;
+        // Preallocated per frame images sized for this calibration so a 30fps stream doesn't churn the allocator.
+        // Null when not asked for.
+        std::shared_ptr<ImagePool> registeredDepthPool;
+        std::shared_ptr<ImagePool> pointCloudPool;
+        // Depth with the static background zeroed
+        std::shared_ptr<ImagePool> foregroundPool;
+        // Rays through each depth pixel
+        std::unique_ptr<XyTable> xyTable;
+    };
+
     class Capture
     {
     public:
-        Capture(k4a_device_t device, k4a_transformation_t transformation);
+        Capture(k4a_capture_t capture, std::shared_ptr<CameraModel> camera);
         ~Capture();
+        k4a_capture_t getHandle();
+        // Depth registered to the color camera, computed the first time it's asked for (NULL without color)
+        k4a_image_t getRegisteredDepth();
+        // Full resolution BGRA, decoded the first time it's asked for if the camera sent MJPG
+        cv::Mat getFullColor(JpegDecoder &decoder);
         struct ImageSpace
         {
             int height;
             int width;
             k4a_image_t colorImage;
+            // Only set in color space once getRegisteredDepth has been called
             k4a_image_t depthImage;
-            // k4a_image_t IRImage;
+            // Only set in depth space
+            k4a_image_t irImage;
         };
+        // False for IR only captures, which are tracked in depth space
+        bool hasColor() const;
 
         // color coord space
         ImageSpace colorSpace;
         // depth/ir coord space
         ImageSpace depthSpace;
+        // Depth with everything the background model thinks is static zeroed, NULL until it has learnt the room
+        k4a_image_t foregroundDepth = NULL;
+        // Bounding boxes of what moved in depth pixels, largest first
+        std::vector<cv::Rect> foregroundRegions;
+        // Device time of the depth exposure (usec)
+        uint64_t deviceTimestamp;
+        // When the host received the capture and when the tracker finished with it
+        std::chrono::steady_clock::time_point arrivalTime;
+        std::chrono::steady_clock::time_point trackedTime;
+        std::shared_ptr<CameraModel> camera;
+        // Which camera the tracking frame came from, and how many of its pixels one tracking frame pixel covers
+        k4a_calibration_type_t trackingSpace = K4A_CALIBRATION_TYPE_COLOR;
+        float trackingScale = 2.0f;
 
     private:
+        k4a_image_t registerDepth(k4a_image_t depth);
+
         k4a_capture_t capture = NULL;
-        int32_t timeout = K4A_WAIT_INFINITE;
+        std::once_flag registered;
+        std::once_flag fullDecoded;
+        cv::Mat fullColor;
     };
 
-    void createNewTrackingFrame(cv::Mat inputColorImage, std::shared_ptr<Capture> cInst);
-    void debugDraw();
+    // Runs on the hand graph thread
+    void handTracked(const HandGraph::Result &result);
+    std::vector<FaceDetector::Detection> detectFaces(FrameBuffer &frame, std::shared_ptr<Capture> capture, nlohmann::json &headTrack);
+    void segmentBackground(std::shared_ptr<Capture> capture);
+    // Overlays the face tracked in this capture on its images, and the hand if the graph has already found it.
+    // Call with debugMutex held.
+    void debugDraw(std::shared_ptr<Capture> capture);
     glm::vec3 calculate3DPos(int x, int y, k4a_calibration_type_t source_type, std::shared_ptr<Capture> capture);
+    void switchProfile(const CaptureProfile &profile);
     glm::vec3 toScreenSpace(glm::vec3 pos);
-    glm::vec3 getFilteredPoint(glm::vec3 point, std::shared_ptr<Capture> capture);
     glm::vec3 cameraOffset;
     
+	// Written by the face stage thread until it stops
 	nlohmann::json jsonLog;
+	nlohmann::json captureLog;
+
+    std::unique_ptr<CaptureSource> source;
+    std::unique_ptr<SessionRecorder> recorder;
+
+    // Current camera geometry, replaced by the capture thread when the profile changes
+    std::shared_ptr<CameraModel> camera;
+    // Index into CaptureProfile::all() waiting to be switched to, -1 for none
+    std::atomic<int> pendingProfile{-1};
+    nlohmann::json profileLog;
+    // Per frame cost of each profile, written by the capture and face stage thread respectively
+    std::map<std::string, LatencyStats> captureCostByProfile;
+    std::map<std::string, LatencyStats> trackingCostByProfile;
+    // Preprocessing (tracker) thread only
+    std::unique_ptr<JpegDecoder> jpegDecoder;
+    // The debug images are drawn on the face stage thread, which can't share the preprocessing decoder
+    std::unique_ptr<JpegDecoder> debugJpegDecoder;
+    bool gpuPreprocess = false;
+    // Face stage thread only, like the detector, head search and predictor
+    FaceTrack faceTrack{30};
+    // Score of the detection the current face track started from
+    float lastDetectionConfidence = 0.0f;
 
-    std::shared_ptr<Capture> latestCapture;
+    // Newest capture from the capture thread, waiting for the tracker thread
+    LatestMailbox<std::shared_ptr<Capture>> captures;
 
-    k4a_device_t device;
-    k4a_device_configuration_t config;
-    k4a_calibration_t calibration;
-    k4a_transformation_t transformation;
+    ThreadStats captureThreadStats;
+    // The tracker thread is the preprocessing stage
+    ThreadStats trackerThreadStats;
+    LatencyStats preprocessCost;
+    // operator new calls each frame made in each stage, written by that stage's thread.
+    // Only recorded by the benchmark build (see AllocationCounter).
+    std::vector<uint64_t> captureAllocations;
+    std::vector<uint64_t> preprocessAllocations;
+    std::vector<uint64_t> faceAllocations;
 
     glm::mat4 toScreenSpaceMat;
-    net_type cnn_face_detector;
+    // Face stage thread only
+    std::unique_ptr<FaceDetector> faceDetector;
+    std::unique_ptr<HeadSearch> headSearch;
+    // Null unless asked for, only used by the tracker thread
+    std::unique_ptr<BackgroundModel> background;
+    // Point clouds of only what moved, when there's a foreground
+    bool foregroundPointCloud = false;
+    LatencyStats guidedDetectCost;
+    LatencyStats fullDetectCost;
 
     dlib::shape_predictor predictor;
 
@@ -106,7 +238,11 @@ private:
 
 	//Debug Images
 	bool debug;
+    // Guards the debug images, drawn by the face stage and by the hand graph thread when the hand comes in later
+    std::mutex debugMutex;
     cv::Mat colorImage;
+    // Capture pixels per tracking frame pixel for the frame being drawn
+    float debugScale = 2.0f;
 	cv::Mat colorImageSkeletons;
 	cv::Mat colorImageSkeletonFace;
 	cv::Mat colorImageSkeletonHand;
@@ -115,9 +251,29 @@ private:
     cv::Mat depthImage;
 	cv::Mat depthImageImportant;
 
-    mp_instance *instance;
-    mp_poller *landmarks_poller;
-    mp_poller *rects_poller;
+    // Hand landmarks run alongside the face on their own thread, the captures of frames in the graph wait here
+    struct HandFrame
+    {
+        std::shared_ptr<Capture> capture;
+        HandRoi::Crop crop;
+        // What the pinch detector made of the same frame, for the graph to check it against
+        std::optional<std::array<glm::vec3, 2>> pinchTips;
+    };
+    std::unique_ptr<HandGraph> handGraph;
+    std::map<uint64_t, HandFrame> handFrames;
+    uint64_t nextHandFrame = 0;
+    // Which part of the frame the hand graph gets, null to always give it the whole frame
+    std::unique_ptr<HandRoi> handRoi;
+    FrameBuffer handCrop;
+    // Guards handFrames, handRoi's tracking state and the hand logs
+    std::mutex handMutex;
+    nlohmann::json handLog = nlohmann::json::array();
+    // Fingertips in screen space per hand found, what getHandLandmarks used to log when first asked
+    nlohmann::json handPointLog = nlohmann::json::array();
+    // Fingertips straight from depth between the hand graph's checks, null unless asked for
+    std::unique_ptr<PinchDetector> pinch;
+    // Whether the newest frame has a pinch in it, only used by the tracker thread
+    bool pinchPublished = false;
 
     struct Rectangle
     {
@@ -133,26 +289,97 @@ private:
         std::shared_ptr<Capture> capture;
         glm::vec3 landmarks[21];
         Rectangle box;
-		std::optional<glm::vec3> cachedIndexFinger;
-		std::optional<glm::vec3> cachedMiddleFinger;
+		// When the graph finished with it, later than the capture's own trackedTime
+		std::chrono::steady_clock::time_point trackedTime;
+		// Every landmark lifted to 3D as soon as it's found, in depth camera space (cm, as calculate3DPos) and screen space
+		glm::vec3 cameraPoints[21];
+		glm::vec3 screenPoints[21];
+		// Index and middle fingertips in screen space, pushed in from the surface to the middle of the finger
+		glm::vec3 fingertips[2];
+		// Valid depth samples (of 9) around each landmark, none means its 3D position is unknown
+		int depthSamples[21];
+		// Fraction of the depth samples around the fingertips that were valid
+		float depthCoverage = 0.0f;
     };
+    void liftHand(HandLandmarks &hand);
+    // The capture the debug images are of
+    std::shared_ptr<Capture> debugCapture;
+    // Hands found in captures the face stage hasn't drawn yet, oldest first
+    std::deque<std::shared_ptr<const HandLandmarks>> debugHands;
+    // Draws a hand over the debug images of its capture, call with debugMutex held
+    void debugDrawHand(const HandLandmarks &hand);
 
     struct FaceLandmarks
     {
         std::shared_ptr<Capture> capture;
         glm::vec2 landmarks[5];
         Rectangle box;
-		std::optional<glm::vec3> cachedLeftEye;
-		std::optional<glm::vec3> cachedRightEye;
+        // Detector score, scaled by how well the landmarks still fit on frames the detector was skipped
+        float confidence;
+		// Lifted to screen space by the face stage thread before the face is published
+		glm::vec3 leftEye;
+		glm::vec3 rightEye;
+		bool leftEyeHasDepth = false;
+    };
+    void liftFace(FaceLandmarks &face);
+
+    // The pinch detector's fingertips in screen space, published while it's trusted
+    struct DepthPinch
+    {
+        std::shared_ptr<Capture> capture;
+        glm::vec3 fingertips[2];
+        std::chrono::steady_clock::time_point trackedTime;
+    };
+    // Runs on the tracker thread, the fingertips if any were found
+    std::optional<std::array<glm::vec3, 2>> detectPinch(std::shared_ptr<Capture> capture);
+
+    // The tracker is a pipeline of stages, each on its own thread with a bounded queue in front:
+    // capture -> preprocess (update) -> {face || hand graph}, each lifting and publishing what it finds.
+    // Preprocessing fills a half resolution RGB frame the detectors run on, the face stage gives it back when done.
+    struct FaceJob
+    {
+        std::shared_ptr<Capture> capture;
+        std::unique_ptr<FrameBuffer> frame;
+        std::chrono::steady_clock::duration preprocessTime;
     };
+    // Hands the frame, or the part of it the hand should be in, to the hand graph
+    void submitHand(FrameBuffer &frame, std::shared_ptr<Capture> capture, const std::optional<std::array<glm::vec3, 2>> &pinchTips);
+    // Returns the face if one was found
+    std::shared_ptr<const FaceLandmarks> trackFace(FrameBuffer &frame, std::shared_ptr<Capture> capture);
+    void runFaceStage();
+    void drawDebugImages(FrameBuffer &frame, std::shared_ptr<Capture> capture);
+    std::unique_ptr<FrameBuffer> takeFrame();
+    void giveBackFrame(std::unique_ptr<FrameBuffer> frame);
+    std::unique_ptr<StageQueue<FaceJob>> faceQueue;
+    std::thread faceWorker;
+    // Only touched by the face stage thread until it stops
+    ThreadStats faceThreadStats;
+    LatencyStats faceStageCost;
+    // Frames not in the face queue or being worked on
+    std::mutex spareFramesMutex;
+    std::vector<std::unique_ptr<FrameBuffer>> spareFrames;
+    uint64_t framesAllocated = 0;
 
+    // Everything the render thread reads, never changed once published. A new result means a new frame that shares
+    // the parts that didn't change, old ones go away with the last thread still holding them.
     struct TrackingFrame
     {
+        uint64_t sequence = 0;
         std::shared_ptr<Capture> lastCapture;
-        std::unique_ptr<FaceLandmarks> face;
-        std::unique_ptr<HandLandmarks> hand;
+        std::shared_ptr<const FaceLandmarks> face;
+        std::shared_ptr<const HandLandmarks> hand;
+        std::shared_ptr<const DepthPinch> pinch;
     };
-    std::unique_ptr<TrackingFrame> trackF;
+    // Hands a copy of latest to the render thread, call with publishMutex held after changing it
+    void publish();
+    // The tracker and hand graph threads both publish, each replacing their own part of the newest frame
+    std::mutex publishMutex;
+    TrackingFrame latest;
+    LatestMailbox<TrackingFrame> tracked;
+    // The frame the getters read, only touched by the thread calling getFrameSequence
+    TrackingFrame view;
+    // Whether the hand getters should read view.pinch, it's from a later capture than view.hand
+    bool pinchIsNewer() const;
 };
 
 #endif
\ No newline at end of file
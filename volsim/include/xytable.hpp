@@ -0,0 +1,27 @@
+#ifndef XY_TABLE_H
+#define XY_TABLE_H
+
+#include <k4a/k4a.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// The ray through each pixel of one camera at unit depth, so turning a pixel and its depth into a 3D point is a
+// multiply instead of an undistortion in the SDK. Only every STEP pixels are asked of the SDK and the rest
+// interpolated, the lens distortion is smooth enough that the difference is well under a millimetre.
+class XyTable
+{
+public:
+    // Covers a width x height image whose pixels are scale camera pixels across (2 for the half size tracking frame)
+    XyTable(const k4a_calibration_t &calibration, k4a_calibration_type_t camera, int width, int height, float scale);
+    // False outside the part of the image the camera calibration is valid for
+    bool ray(float x, float y, glm::vec2 &ray) const;
+
+private:
+    static const int STEP = 4;
+    int cols;
+    int rows;
+    std::vector<glm::vec2> rays;
+    std::vector<uint8_t> valid;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloccounter.hpp"
+
+// Set while an AllocationCounter is alive on this thread, everything else pays a single TLS load per allocation
+static thread_local uint64_t *activeCounter = nullptr;
+
+AllocationCounter::AllocationCounter()
+{
+	previous = activeCounter;
+	activeCounter = &count;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+	activeCounter = previous;
+}
+
+uint64_t AllocationCounter::getCount() const
+{
+	return count;
+}
+
+// Replacing the global allocator in the shared library would make every allocation in the host process (Python's
+// extensions, MediaPipe) go through it, so only the benchmark build does
+#ifdef VOLSIM_COUNT_ALLOCATIONS
+bool AllocationCounter::isCounting()
+{
+	return true;
+}
+
+static void *countedAllocate(std::size_t size)
+{
+	if (activeCounter != nullptr)
+	{
+		(*activeCounter)++;
+	}
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(std::size_t size)
+{
+	void *pointer = countedAllocate(size);
+	if (pointer == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	return countedAllocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return countedAllocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+#else
+bool AllocationCounter::isCounting()
+{
+	return false;
+}
+#endif
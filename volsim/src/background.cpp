@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+#include <opencv2/imgproc.hpp>
+
+#include "background.hpp"
+
+// Regions are found on a grid this coarse, same as HeadSearch
+static const int CELL = 8;
+// Fewer foreground cells than this together is noise (a flying pixel, an edge flickering in and out of range)
+static const int MIN_REGION_CELLS = 4;
+static const size_t MAX_REGIONS = 8;
+
+void learnBackground(const uint16_t *depth, uint16_t *background, int width, bool learned)
+{
+	int x = 0;
+#if defined(__AVX2__)
+	__m256i zero = _mm256_setzero_si256();
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)(depth + x));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(background + x));
+		__m256i farthest = _mm256_max_epu16(b, d);
+		if (learned)
+		{
+			farthest = _mm256_andnot_si256(_mm256_cmpeq_epi16(b, zero), farthest);
+		}
+		_mm256_storeu_si256((__m256i *)(background + x), farthest);
+	}
+#elif defined(__SSE4_1__)
+	__m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)(depth + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(background + x));
+		__m128i farthest = _mm_max_epu16(b, d);
+		if (learned)
+		{
+			farthest = _mm_andnot_si128(_mm_cmpeq_epi16(b, zero), farthest);
+		}
+		_mm_storeu_si128((__m128i *)(background + x), farthest);
+	}
+#endif
+	for (; x < width; x++)
+	{
+		if (!learned || background[x] != 0)
+		{
+			background[x] = std::max(background[x], depth[x]);
+		}
+	}
+}
+
+void segmentForeground(const uint16_t *depth, uint16_t *background, uint16_t *foreground, int width, uint16_t margin)
+{
+	int x = 0;
+#if defined(__AVX2__)
+	__m256i zero = _mm256_setzero_si256();
+	__m256i marginV = _mm256_set1_epi16((short)margin);
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)(depth + x));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(background + x));
+		__m256i unknown = _mm256_cmpeq_epi16(b, zero);
+		// depth + margin < background, as !(max(depth + margin, background) == depth + margin) since there's no unsigned compare
+		__m256i behind = _mm256_adds_epu16(d, marginV);
+		__m256i notInFront = _mm256_cmpeq_epi16(_mm256_max_epu16(behind, b), behind);
+		__m256i keep = _mm256_or_si256(unknown, _mm256_andnot_si256(notInFront, _mm256_set1_epi16(-1)));
+		_mm256_storeu_si256((__m256i *)(foreground + x), _mm256_and_si256(d, keep));
+		_mm256_storeu_si256((__m256i *)(background + x), _mm256_andnot_si256(unknown, _mm256_max_epu16(b, d)));
+	}
+#elif defined(__SSE4_1__)
+	__m128i zero = _mm_setzero_si128();
+	__m128i marginV = _mm_set1_epi16((short)margin);
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)(depth + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(background + x));
+		__m128i unknown = _mm_cmpeq_epi16(b, zero);
+		__m128i behind = _mm_adds_epu16(d, marginV);
+		__m128i notInFront = _mm_cmpeq_epi16(_mm_max_epu16(behind, b), behind);
+		__m128i keep = _mm_or_si128(unknown, _mm_andnot_si128(notInFront, _mm_set1_epi16(-1)));
+		_mm_storeu_si128((__m128i *)(foreground + x), _mm_and_si128(d, keep));
+		_mm_storeu_si128((__m128i *)(background + x), _mm_andnot_si128(unknown, _mm_max_epu16(b, d)));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		uint16_t d = depth[x];
+		uint16_t b = background[x];
+		bool inFront = b == 0 || (uint32_t)d + margin < b;
+		foreground[x] = inFront ? d : 0;
+		if (b != 0)
+		{
+			background[x] = std::max(b, d);
+		}
+	}
+}
+
+BackgroundModel::BackgroundModel(const nlohmann::json &options)
+{
+	learnTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(options.value("backgroundLearnSeconds", 2.0f)));
+	// How far in front of the background something has to be to count as moved, above the sensor's noise (mm)
+	margin = (uint16_t)std::clamp(options.value("backgroundMarginMm", 40), 0, 1000);
+}
+
+bool BackgroundModel::segment(const uint16_t *depth, int depthStride, int width, int height, std::chrono::steady_clock::time_point time, uint16_t *foreground, int foregroundStride)
+{
+	auto start = std::chrono::steady_clock::now();
+	// A profile switch changes the depth mode, so the old model doesn't line up anymore
+	if (width != this->width || height != this->height)
+	{
+		if (this->width != 0)
+		{
+			relearns++;
+		}
+		this->width = width;
+		this->height = height;
+		background.assign((size_t)width * height, 0);
+		learnStart = time;
+		learned = false;
+	}
+	if (!learned && time - learnStart >= learnTime)
+	{
+		learned = true;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		const uint16_t *depthRow = (const uint16_t *)((const uint8_t *)depth + (size_t)y * depthStride);
+		uint16_t *backgroundRow = background.data() + (size_t)y * width;
+		if (learned)
+		{
+			segmentForeground(depthRow, backgroundRow, (uint16_t *)((uint8_t *)foreground + (size_t)y * foregroundStride), width, margin);
+		}
+		else
+		{
+			learnBackground(depthRow, backgroundRow, width, false);
+		}
+	}
+	if (!learned)
+	{
+		learnFrames++;
+		regions.clear();
+		return false;
+	}
+
+	findRegions(foreground, foregroundStride, width, height);
+	segmentedFrames++;
+	segmentCost.add(std::chrono::steady_clock::now() - start);
+	return true;
+}
+
+void BackgroundModel::findRegions(const uint16_t *foreground, int foregroundStride, int width, int height)
+{
+	// One sample per cell
+	int cols = width / CELL;
+	int rows = height / CELL;
+	cells.create(rows, cols, CV_8U);
+	int foregroundCells = 0;
+	for (int y = 0; y < rows; y++)
+	{
+		const uint16_t *row = (const uint16_t *)((const uint8_t *)foreground + (size_t)(y * CELL + CELL / 2) * foregroundStride);
+		uint8_t *cellRow = cells.ptr<uint8_t>(y);
+		for (int x = 0; x < cols; x++)
+		{
+			cellRow[x] = row[x * CELL + CELL / 2] != 0 ? 255 : 0;
+			foregroundCells += cellRow[x] != 0;
+		}
+	}
+	foregroundCellSum += rows * cols > 0 ? (double)foregroundCells / (rows * cols) : 0.0;
+
+	// Largest first
+	std::vector<std::pair<int, cv::Rect>> found;
+	int count = cv::connectedComponentsWithStats(cells, labels, stats, centroids, 8, CV_32S);
+	for (int i = 1; i < count; i++)
+	{
+		int area = stats.at<int>(i, cv::CC_STAT_AREA);
+		if (area >= MIN_REGION_CELLS)
+		{
+			found.push_back({area, cv::Rect(stats.at<int>(i, cv::CC_STAT_LEFT) * CELL, stats.at<int>(i, cv::CC_STAT_TOP) * CELL,
+											stats.at<int>(i, cv::CC_STAT_WIDTH) * CELL, stats.at<int>(i, cv::CC_STAT_HEIGHT) * CELL)});
+		}
+	}
+	std::sort(found.begin(), found.end(), [](const std::pair<int, cv::Rect> &a, const std::pair<int, cv::Rect> &b)
+			  { return a.first > b.first; });
+	regions.clear();
+	for (size_t i = 0; i < found.size() && i < MAX_REGIONS; i++)
+	{
+		regions.push_back(found[i].second);
+	}
+}
+
+const std::vector<cv::Rect> &BackgroundModel::getRegions() const
+{
+	return regions;
+}
+
+nlohmann::json BackgroundModel::returnJson() const
+{
+	nlohmann::json backgroundLog;
+	backgroundLog["learned"] = learned;
+	backgroundLog["relearns"] = relearns;
+	backgroundLog["learnFrames"] = learnFrames;
+	backgroundLog["segmentedFrames"] = segmentedFrames;
+	backgroundLog["meanForegroundFraction"] = segmentedFrames > 0 ? foregroundCellSum / segmentedFrames : 0.0;
+	backgroundLog["segmentCost"] = segmentCost.returnJson();
+	return backgroundLog;
+}
@@ -0,0 +1,553 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <functional>
+#include <vector>
+
+#include <k4a/k4a.h>
+#include <turbojpeg.h>
+#include <dlib/matrix.h>
+#include <dlib/image_transforms.h>
+#include <dlib/opencv.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#ifndef VOLSIM_NO_CUDA
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudawarping.hpp>
+#endif
+
+#include "benchmark.hpp"
+#include "preprocess.hpp"
+#include "latency.hpp"
+#include "framebuffer.hpp"
+#include "jpegdecoder.hpp"
+#include "alloccounter.hpp"
+#include "facedetector.hpp"
+#include "capturesource.hpp"
+#include "headsearch.hpp"
+#include "background.hpp"
+#include "synthetic.hpp"
+#include "tracker.hpp"
+#include "json.hpp"
+
+// 1536P, what the study captures at
+static const int FRAME_WIDTH = 2048;
+static const int FRAME_HEIGHT = 1536;
+static const int WARMUP_ITERATIONS = 10;
+
+static nlohmann::json timeIt(int iterations, const std::function<void()> &run)
+{
+	for (int i = 0; i < WARMUP_ITERATIONS; i++)
+	{
+		run();
+	}
+	LatencyStats stats;
+	for (int i = 0; i < iterations; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		run();
+		stats.add(std::chrono::steady_clock::now() - start);
+	}
+	return stats.returnJson();
+}
+
+// The fused CPU kernel against what it replaced
+static nlohmann::json benchmarkPreprocess(int iterations)
+{
+	cv::Mat bgra(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC4);
+	cv::randu(bgra, cv::Scalar::all(0), cv::Scalar::all(255));
+	cv::Mat bgr, fused;
+
+	nlohmann::json results;
+	results["frame"] = {{"width", FRAME_WIDTH}, {"height", FRAME_HEIGHT}};
+	results["fusedCpu"] = timeIt(iterations, [&]()
+								 { halfScaleBgraToBgr(bgra, fused); });
+	results["opencvCpu"] = timeIt(iterations, [&]()
+								  {
+		cv::cvtColor(bgra, bgr, cv::COLOR_BGRA2BGR);
+		cv::pyrDown(bgr, bgr); });
+
+	// How far the box filter is from pyrDown's gaussian
+	cv::Mat difference;
+	cv::absdiff(fused, bgr, difference);
+	results["meanAbsDiffFromPyrDown"] = cv::mean(difference)[0];
+
+#ifndef VOLSIM_NO_CUDA
+	if (cv::cuda::getCudaEnabledDeviceCount() > 0)
+	{
+		cv::cuda::GpuMat bgraGpu, bgrGpu;
+		cv::Mat downloaded;
+		results["gpuRoundTrip"] = timeIt(iterations, [&]()
+										 {
+			bgraGpu.upload(bgra);
+			cv::cuda::cvtColor(bgraGpu, bgrGpu, cv::COLOR_BGRA2BGR);
+			cv::cuda::pyrDown(bgrGpu, bgrGpu);
+			bgrGpu.download(downloaded); });
+	}
+	else
+	{
+		results["gpuRoundTrip"] = "no CUDA device";
+	}
+#else
+	results["gpuRoundTrip"] = "built without CUDA";
+#endif
+	return results;
+}
+
+// Segmenting a WFOV 2x2 binned depth frame against a learnt background, the fused kernel against the same thing in OpenCV
+static nlohmann::json benchmarkBackground(int iterations)
+{
+	const int width = 512;
+	const int height = 512;
+	const uint16_t margin = 40;
+	cv::Mat depth(height, width, CV_16U);
+	cv::randu(depth, cv::Scalar::all(0), cv::Scalar::all(3000));
+	cv::Mat learnt(height, width, CV_16U);
+	cv::randu(learnt, cv::Scalar::all(0), cv::Scalar::all(3000));
+	cv::Mat background = learnt.clone();
+	cv::Mat foreground(height, width, CV_16U);
+
+	nlohmann::json results;
+	results["frame"] = {{"width", width}, {"height", height}};
+	results["fusedCpu"] = timeIt(iterations, [&]()
+								 {
+		learnt.copyTo(background);
+		for (int y = 0; y < height; y++)
+		{
+			segmentForeground(depth.ptr<uint16_t>(y), background.ptr<uint16_t>(y), foreground.ptr<uint16_t>(y), width, margin);
+		} });
+
+	cv::Mat unknown, inFront, keep, farthest, opencvForeground, opencvBackground;
+	results["opencvCpu"] = timeIt(iterations, [&]()
+								  {
+		learnt.copyTo(opencvBackground);
+		cv::compare(opencvBackground, 0, unknown, cv::CMP_EQ);
+		cv::compare(depth + margin, opencvBackground, inFront, cv::CMP_LT);
+		cv::bitwise_or(unknown, inFront, keep);
+		opencvForeground.create(height, width, CV_16U);
+		opencvForeground.setTo(0);
+		depth.copyTo(opencvForeground, keep);
+		cv::max(opencvBackground, depth, farthest);
+		farthest.setTo(0, unknown);
+		farthest.copyTo(opencvBackground); });
+
+	// Both should agree exactly
+	results["matchesOpencv"] = cv::countNonZero(foreground != opencvForeground) == 0 && cv::countNonZero(background != opencvBackground) == 0;
+	return results;
+}
+
+// operator new calls per run, only C++ allocations are visible (cv::Mat buffers are malloc'd by OpenCV).
+// Null unless this is the benchmark build, which counts them.
+static nlohmann::json allocationsPerRun(int iterations, const std::function<void()> &run)
+{
+	if (!AllocationCounter::isCounting())
+	{
+		return nullptr;
+	}
+	run();
+	AllocationCounter counter;
+	for (int i = 0; i < iterations; i++)
+	{
+		run();
+	}
+	return (double)counter.getCount() / std::max(iterations, 1);
+}
+
+// Getting a half size frame to the detectors: the old path (a BGR Mat, copied into a fresh dlib matrix inside a
+// batch vector) against writing straight into a reused FrameBuffer that every detector views
+static nlohmann::json benchmarkFrame(int iterations)
+{
+	cv::Mat bgra(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC4);
+	cv::randu(bgra, cv::Scalar::all(0), cv::Scalar::all(255));
+
+	auto copyPath = [&]()
+	{
+		cv::Mat bgr;
+		halfScaleBgraToBgr(bgra, bgr);
+		dlib::cv_image<dlib::bgr_pixel> view(bgr);
+		std::vector<dlib::matrix<dlib::rgb_pixel>> batch;
+		dlib::matrix<dlib::rgb_pixel> matrix;
+		dlib::assign_image(matrix, view);
+		batch.push_back(matrix);
+	};
+	FrameBuffer frame;
+	auto viewPath = [&]()
+	{
+		frame.resize(FRAME_WIDTH / 2, FRAME_HEIGHT / 2);
+		cv::Mat view = frame.cvView();
+		halfScaleBgraToRgb(bgra.data, (int)bgra.step, bgra.cols, bgra.rows, view.data, (int)view.step);
+		mp_image image = frame.mpView();
+		(void)image;
+	};
+
+	nlohmann::json results;
+	results["frame"] = {{"width", FRAME_WIDTH}, {"height", FRAME_HEIGHT}};
+	results["bgraCopyPath"] = timeIt(iterations, copyPath);
+	results["bgraCopyPathAllocationsPerFrame"] = allocationsPerRun(iterations, copyPath);
+	results["bgraViewPath"] = timeIt(iterations, viewPath);
+	results["bgraViewPathAllocationsPerFrame"] = allocationsPerRun(iterations, viewPath);
+
+	// The same for MJPG, on a smooth gradient so the jpeg is a realistic size
+	cv::Mat gradient(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC3);
+	for (int y = 0; y < FRAME_HEIGHT; y++)
+	{
+		for (int x = 0; x < FRAME_WIDTH; x++)
+		{
+			gradient.at<cv::Vec3b>(y, x) = cv::Vec3b((uint8_t)(x / 8), (uint8_t)(y / 6), (uint8_t)((x + y) / 14));
+		}
+	}
+	tjhandle compressor = tjInitCompress();
+	unsigned char *jpeg = NULL;
+	unsigned long jpegSize = 0;
+	if (compressor == NULL || tjCompress2(compressor, gradient.data, FRAME_WIDTH, (int)gradient.step, FRAME_HEIGHT, TJPF_BGR, &jpeg, &jpegSize, TJSAMP_422, 90, 0) != 0)
+	{
+		results["mjpg"] = "failed to encode a test frame";
+		tjDestroy(compressor);
+		return results;
+	}
+	k4a_image_t mjpg = NULL;
+	if (K4A_FAILED(k4a_image_create_from_buffer(K4A_IMAGE_FORMAT_COLOR_MJPG, FRAME_WIDTH, FRAME_HEIGHT, 0, jpeg, jpegSize, NULL, NULL, &mjpg)))
+	{
+		results["mjpg"] = "failed to wrap the test frame";
+		tjFree(jpeg);
+		tjDestroy(compressor);
+		return results;
+	}
+
+	JpegDecoder decoder;
+	auto mjpgCopyPath = [&]()
+	{
+		cv::Mat bgr;
+		decoder.decode(mjpg, 2, TJPF_BGR, bgr);
+		dlib::cv_image<dlib::bgr_pixel> view(bgr);
+		std::vector<dlib::matrix<dlib::rgb_pixel>> batch;
+		dlib::matrix<dlib::rgb_pixel> matrix;
+		dlib::assign_image(matrix, view);
+		batch.push_back(matrix);
+	};
+	auto mjpgViewPath = [&]()
+	{
+		frame.resize((FRAME_WIDTH + 1) / 2, (FRAME_HEIGHT + 1) / 2);
+		cv::Mat view = frame.cvView();
+		decoder.decode(mjpg, 2, TJPF_RGB, view);
+	};
+	results["mjpgBytes"] = jpegSize;
+	results["mjpgCopyPath"] = timeIt(iterations, mjpgCopyPath);
+	results["mjpgCopyPathAllocationsPerFrame"] = allocationsPerRun(iterations, mjpgCopyPath);
+	results["mjpgViewPath"] = timeIt(iterations, mjpgViewPath);
+	results["mjpgViewPathAllocationsPerFrame"] = allocationsPerRun(iterations, mjpgViewPath);
+	results["frameBufferReallocations"] = frame.getReallocations();
+
+	k4a_image_release(mjpg);
+	tjFree(jpeg);
+	tjDestroy(compressor);
+	return results;
+}
+
+// Mean and worst of one stage's per frame allocation counts, leaving out the first frames that fill the pools,
+// the spare frame buffers and the first blocks of the logs
+static nlohmann::json allocationStats(const nlohmann::json &counts)
+{
+	nlohmann::json stats;
+	uint64_t total = 0;
+	uint64_t most = 0;
+	size_t frames = 0;
+	for (size_t i = WARMUP_ITERATIONS; i < counts.size(); i++)
+	{
+		uint64_t count = counts[i].get<uint64_t>();
+		total += count;
+		most = std::max(most, count);
+		frames++;
+	}
+	stats["frames"] = frames;
+	stats["meanPerFrame"] = frames > 0 ? (double)total / frames : 0.0;
+	stats["maxPerFrame"] = most;
+	return stats;
+}
+
+// The whole tracker on synthetic frames, a capture, update() and the face stage per frame, with the face queue set to
+// block so every frame is tracked. Heap allocations per frame in each stage are only counted by the benchmark build.
+static nlohmann::json benchmarkTracker(int iterations)
+{
+	nlohmann::json options = {{"preprocess", "cpu"}, {"pipelineQueuePolicy", "block"}};
+	Tracker tracker(std::make_unique<SyntheticCaptureSource>(30.0f, false), glm::vec3(0.0f), glm::vec3(0.0f), false, options);
+
+	nlohmann::json results;
+	results["frame"] = {{"width", FRAME_WIDTH}, {"height", FRAME_HEIGHT}, {"source", "synthetic"}};
+	results["captureAndPreprocess"] = timeIt(iterations, [&]()
+											 {
+		tracker.getLatestCapture();
+		tracker.update(); });
+	tracker.close();
+
+	nlohmann::json log = tracker.returnJson();
+	results["face"] = log["pipeline"]["face"]["service"];
+	if (!log.contains("allocations"))
+	{
+		results["allocations"] = nullptr;
+		return results;
+	}
+	for (const char *stage : {"capture", "preprocess", "face"})
+	{
+		results["allocations"][stage] = allocationStats(log["allocations"][stage]);
+	}
+	return results;
+}
+
+static double intersectionOverUnion(const dlib::rectangle &a, const dlib::rectangle &b)
+{
+	double overlap = (double)a.intersect(b).area();
+	double combined = (double)a.area() + (double)b.area() - overlap;
+	return combined > 0.0 ? overlap / combined : 0.0;
+}
+
+// Every face detector backend on the same frames of a recording, timed, with the CNN's best face as the reference
+static nlohmann::json benchmarkFaceDetectors(int iterations, const std::string &recording)
+{
+	nlohmann::json results;
+	// The CNN goes first as the reference, any other backend that can't load (e.g. missing model files) is skipped
+	std::vector<std::unique_ptr<FaceDetector>> detectors;
+	detectors.push_back(FaceDetector::create("cnn"));
+	for (const std::string &name : FaceDetector::names())
+	{
+		if (name == "cnn")
+		{
+			continue;
+		}
+		try
+		{
+			detectors.push_back(FaceDetector::create(name));
+		}
+		catch (const std::exception &e)
+		{
+			results[name] = e.what();
+		}
+	}
+
+	struct Score
+	{
+		LatencyStats cost;
+		uint64_t faces = 0;
+		uint64_t agreed = 0;
+		uint64_t missed = 0;
+		uint64_t extra = 0;
+		uint64_t bothFound = 0;
+		double iouSum = 0.0;
+		double seconds = 0.0;
+
+		// Agreement on the best face only, that's all the tracker uses
+		void add(std::chrono::steady_clock::duration duration, const std::vector<FaceDetector::Detection> &reference, const std::vector<FaceDetector::Detection> &found)
+		{
+			cost.add(duration);
+			seconds += std::chrono::duration<double>(duration).count();
+			faces += found.empty() ? 0 : 1;
+			if (reference.empty() && found.empty())
+			{
+				agreed++;
+			}
+			else if (reference.empty())
+			{
+				extra++;
+			}
+			else if (found.empty())
+			{
+				missed++;
+			}
+			else
+			{
+				double iou = intersectionOverUnion(reference[0].rect, found[0].rect);
+				bothFound++;
+				iouSum += iou;
+				agreed += iou >= 0.5 ? 1 : 0;
+			}
+		}
+
+		nlohmann::json returnJson(int frames) const
+		{
+			nlohmann::json detector = cost.returnJson();
+			detector["framesPerSecond"] = seconds > 0.0 ? frames / seconds : 0.0;
+			detector["framesWithFace"] = faces;
+			// Frames where it found the same best face as the CNN (IoU >= 0.5), or agreed there was none
+			detector["agreement"] = frames > 0 ? (double)agreed / frames : 0.0;
+			detector["missed"] = missed;
+			detector["extra"] = extra;
+			detector["meanIoU"] = bothFound > 0 ? iouSum / bothFound : 0.0;
+			return detector;
+		}
+	};
+	// Whole frame, and only where the depth says a head could be
+	std::vector<Score> scores(detectors.size());
+	std::vector<Score> guidedScores(detectors.size());
+
+	// Frames are prepared the same way the tracker does on the CPU, looping the recording if it is short
+	PlaybackCaptureSource source(recording, false);
+	k4a_calibration_t calibration;
+	source.getCalibration(&calibration);
+	HeadSearch headSearch(400.0f, 900.0f);
+	LatencyStats searchCost;
+	uint64_t framesWithRegions = 0;
+
+	JpegDecoder decoder;
+	FrameBuffer frame;
+	int frames = 0;
+	for (; frames < iterations; frames++)
+	{
+		k4a_capture_t capture = NULL;
+		if (source.getCapture(&capture, K4A_WAIT_INFINITE) != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			break;
+		}
+		k4a_image_t color = k4a_capture_get_color_image(capture);
+		if (color == NULL)
+		{
+			// IR only recordings have nothing for the color detectors to compare on
+			k4a_capture_release(capture);
+			break;
+		}
+		int width = k4a_image_get_width_pixels(color);
+		int height = k4a_image_get_height_pixels(color);
+		bool prepared = true;
+		if (k4a_image_get_format(color) == K4A_IMAGE_FORMAT_COLOR_MJPG)
+		{
+			frame.resize((width + 1) / 2, (height + 1) / 2);
+			cv::Mat view = frame.cvView();
+			prepared = decoder.decode(color, 2, TJPF_RGB, view);
+		}
+		else
+		{
+			frame.resize(width / 2, height / 2);
+			cv::Mat view = frame.cvView();
+			halfScaleBgraToRgb(k4a_image_get_buffer(color), k4a_image_get_stride_bytes(color), width, height, view.data, (int)view.step);
+		}
+		k4a_image_release(color);
+
+		// Searched in native depth and moved into the half size color frame, as the tracker does
+		auto searchStart = std::chrono::steady_clock::now();
+		std::vector<HeadSearch::Region> regions;
+		k4a_image_t depth = k4a_capture_get_depth_image(capture);
+		for (HeadSearch::Region region : headSearch.find(depth, calibration.depth_camera_calibration.intrinsics.parameters.param.fx))
+		{
+			if (HeadSearch::toFrame(region, calibration, K4A_CALIBRATION_TYPE_COLOR, 2.0f, frame.getWidth(), frame.getHeight()))
+			{
+				regions.push_back(region);
+			}
+		}
+		searchCost.add(std::chrono::steady_clock::now() - searchStart);
+		framesWithRegions += regions.empty() ? 0 : 1;
+		k4a_image_release(depth);
+		k4a_capture_release(capture);
+		if (!prepared)
+		{
+			break;
+		}
+
+		std::vector<FaceDetector::Detection> reference;
+		for (size_t i = 0; i < detectors.size(); i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::vector<FaceDetector::Detection> found = detectors[i]->detect(frame);
+			auto duration = std::chrono::steady_clock::now() - start;
+			if (i == 0)
+			{
+				reference = found;
+			}
+			scores[i].add(duration, reference, found);
+
+			// The same way the tracker narrows it down, falling back to the whole frame when nothing in range is a face
+			start = std::chrono::steady_clock::now();
+			std::vector<FaceDetector::Detection> guided;
+			for (const HeadSearch::Region &region : regions)
+			{
+				std::vector<FaceDetector::Detection> inRegion = detectors[i]->detectIn(frame, region.rect, region.faceSize);
+				guided.insert(guided.end(), inRegion.begin(), inRegion.end());
+			}
+			if (guided.empty())
+			{
+				guided = detectors[i]->detect(frame);
+			}
+			std::sort(guided.begin(), guided.end(), [](const FaceDetector::Detection &a, const FaceDetector::Detection &b)
+					  { return a.confidence > b.confidence; });
+			guidedScores[i].add(std::chrono::steady_clock::now() - start, reference, guided);
+		}
+	}
+
+	results["recording"] = recording;
+	results["frames"] = frames;
+	results["headSearch"] = searchCost.returnJson();
+	results["framesWithHeadRegions"] = framesWithRegions;
+	for (size_t i = 0; i < detectors.size(); i++)
+	{
+		results[detectors[i]->getName()] = scores[i].returnJson(frames);
+		results[detectors[i]->getName() + "Guided"] = guidedScores[i].returnJson(frames);
+		double fullMs = scores[i].cost.returnJson()["meanMs"].get<double>();
+		double guidedMs = guidedScores[i].cost.returnJson()["meanMs"].get<double>() + searchCost.returnJson()["meanMs"].get<double>();
+		results[detectors[i]->getName() + "GuidedSpeedup"] = guidedMs > 0.0 ? fullMs / guidedMs : 0.0;
+	}
+	return results;
+}
+
+extern "C"
+{
+	static std::string benchmarkOutput;
+
+	const char *runBenchmark(const char *name, int iterations, const char *input)
+	{
+		std::string benchmark = name != NULL ? name : "";
+		nlohmann::json output;
+		output["benchmark"] = benchmark;
+		output["iterations"] = iterations;
+
+		if (benchmark == "preprocess")
+		{
+			output["results"] = benchmarkPreprocess(iterations);
+		}
+		else if (benchmark == "frame")
+		{
+			output["results"] = benchmarkFrame(iterations);
+		}
+		else if (benchmark == "background")
+		{
+			output["results"] = benchmarkBackground(iterations);
+		}
+		else if (benchmark == "tracker")
+		{
+			// Needs the detector and landmark models like a real session
+			try
+			{
+				output["results"] = benchmarkTracker(iterations);
+			}
+			catch (const std::exception &e)
+			{
+				output["error"] = e.what();
+			}
+		}
+		else if (benchmark == "faceDetectors")
+		{
+			if (input == NULL || input[0] == '\0')
+			{
+				output["error"] = "The faceDetectors benchmark needs a recording to run on";
+			}
+			else
+			{
+				try
+				{
+					output["results"] = benchmarkFaceDetectors(iterations, input);
+				}
+				catch (const std::exception &e)
+				{
+					output["error"] = e.what();
+				}
+			}
+		}
+		else
+		{
+			output["error"] = "Unknown benchmark " + benchmark;
+		}
+
+		benchmarkOutput = output.dump();
+		return benchmarkOutput.c_str();
+	}
+}
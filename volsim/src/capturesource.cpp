@@ -0,0 +1,412 @@
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+#include <iostream>
+#include <exception>
+#include <thread>
+
+#include "capturesource.hpp"
+#include "synthetic.hpp"
+
+class CaptureSourceException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit CaptureSourceException(const char *msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class NoTrackersDetectedException : public CaptureSourceException
+{
+public:
+	NoTrackersDetectedException() : CaptureSourceException("No Trackers were detected") {}
+};
+
+class FailedToOpenTrackerException : public CaptureSourceException
+{
+public:
+	FailedToOpenTrackerException() : CaptureSourceException("Cannot open Tracker") {}
+};
+
+class FailedToStartTrackerException : public CaptureSourceException
+{
+public:
+	FailedToStartTrackerException() : CaptureSourceException("Cannot start the Tracker cameras") {}
+};
+
+class UnknownCaptureProfileException : public CaptureSourceException
+{
+public:
+	UnknownCaptureProfileException() : CaptureSourceException("No capture profile with that name") {}
+};
+
+class FailedToRestartTrackerException : public CaptureSourceException
+{
+public:
+	FailedToRestartTrackerException() : CaptureSourceException("Cannot restart the Tracker cameras after a failed profile switch") {}
+};
+
+class FailedToOpenRecordingException : public CaptureSourceException
+{
+public:
+	FailedToOpenRecordingException() : CaptureSourceException("Cannot open the recording") {}
+};
+
+class UnsupportedRecordingException : public CaptureSourceException
+{
+public:
+	UnsupportedRecordingException() : CaptureSourceException("Recording needs both color and depth tracks") {}
+};
+
+std::unique_ptr<CaptureSource> CaptureSource::create(const nlohmann::json &options)
+{
+	std::string source = options.value("source", "device");
+	if (source == "playback")
+	{
+		return std::make_unique<PlaybackCaptureSource>(options.at("recording").get<std::string>(), options.value("realtime", true));
+	}
+	if (source == "synthetic")
+	{
+		return std::make_unique<SyntheticCaptureSource>(options.value("fps", 30.0f), options.value("realtime", true));
+	}
+	std::optional<CaptureProfile> profile = CaptureProfile::find(options.value("profile", "default"));
+	if (!profile.has_value())
+	{
+		throw UnknownCaptureProfileException();
+	}
+	// MJPG is what the camera produces natively, BGRA makes the SDK decode every frame at full resolution on the CPU
+	bool forceBgra = options.value("colorFormat", "mjpg") == "bgra";
+	return std::make_unique<DeviceCaptureSource>(options.value("device", (uint32_t)K4A_DEVICE_DEFAULT), profile.value(), forceBgra);
+}
+
+const std::vector<CaptureProfile> &CaptureProfile::all()
+{
+	static const std::vector<CaptureProfile> profiles = {
+		// What the study was run with
+		{"default", K4A_COLOR_RESOLUTION_1536P, K4A_DEPTH_MODE_WFOV_2X2BINNED, K4A_FRAMES_PER_SECOND_30, K4A_IMAGE_FORMAT_COLOR_MJPG},
+		// Weaker machines, under a third of the color pixels to decode and detect on
+		{"lowLatency", K4A_COLOR_RESOLUTION_720P, K4A_DEPTH_MODE_WFOV_2X2BINNED, K4A_FRAMES_PER_SECOND_30, K4A_IMAGE_FORMAT_COLOR_MJPG},
+		// Demos, sharper color and unbinned depth at the cost of a narrower depth field of view
+		{"demo", K4A_COLOR_RESOLUTION_2160P, K4A_DEPTH_MODE_NFOV_UNBINNED, K4A_FRAMES_PER_SECOND_30, K4A_IMAGE_FORMAT_COLOR_MJPG},
+		// No color at all, tracking runs on the IR image in depth space. Unbinned so faces stay above the detectors'
+		// 80 pixel minimum out to 90cm, which 2x2 binned WFOV (512x512) can't manage
+		{"ir", K4A_COLOR_RESOLUTION_OFF, K4A_DEPTH_MODE_NFOV_UNBINNED, K4A_FRAMES_PER_SECOND_30, K4A_IMAGE_FORMAT_COLOR_MJPG},
+	};
+	return profiles;
+}
+
+std::optional<CaptureProfile> CaptureProfile::find(const std::string &name)
+{
+	for (const CaptureProfile &profile : all())
+	{
+		if (profile.name == name)
+		{
+			return profile;
+		}
+	}
+	return {};
+}
+
+std::vector<uint8_t> CaptureSource::getRawCalibration()
+{
+	return {};
+}
+
+bool CaptureSource::setProfile(const CaptureProfile &profile)
+{
+	return false;
+}
+
+std::string CaptureSource::getProfileName()
+{
+	return "fixed";
+}
+
+nlohmann::json CaptureSource::returnJson()
+{
+	return nlohmann::json::object();
+}
+
+DeviceCaptureSource::DeviceCaptureSource(uint32_t index, const CaptureProfile &profile, bool forceBgra)
+{
+	this->forceBgra = forceBgra;
+
+	// Check for Trackers
+	uint32_t count = k4a_device_get_installed_count();
+	if (count == 0)
+	{
+		throw NoTrackersDetectedException();
+	}
+
+	// Open the requested Tracker device
+	if (K4A_FAILED(k4a_device_open(index, &device)))
+	{
+		throw FailedToOpenTrackerException();
+	}
+
+	config = toConfiguration(profile);
+	profileName = profile.name;
+
+	if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &config))
+	{
+		k4a_device_close(device);
+		throw FailedToStartTrackerException();
+	}
+}
+
+k4a_device_configuration_t DeviceCaptureSource::toConfiguration(const CaptureProfile &profile)
+{
+	k4a_device_configuration_t profileConfig = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+	profileConfig.camera_fps = profile.fps;
+	profileConfig.color_format = forceBgra ? K4A_IMAGE_FORMAT_COLOR_BGRA32 : profile.colorFormat;
+	profileConfig.color_resolution = profile.colorResolution;
+	profileConfig.depth_mode = profile.depthMode;
+	// The SDK refuses to synchronise with a stream that is off
+	profileConfig.synchronized_images_only = profile.colorResolution != K4A_COLOR_RESOLUTION_OFF;
+	return profileConfig;
+}
+
+bool DeviceCaptureSource::setProfile(const CaptureProfile &profile)
+{
+	// The device stays open, only the cameras are restarted
+	k4a_device_stop_cameras(device);
+	k4a_device_configuration_t newConfig = toConfiguration(profile);
+	if (K4A_RESULT_SUCCEEDED == k4a_device_start_cameras(device, &newConfig))
+	{
+		config = newConfig;
+		profileName = profile.name;
+		return true;
+	}
+
+	std::cerr << "Failed to start the cameras with profile " << profile.name << ", staying on " << profileName << std::endl;
+	if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &config))
+	{
+		throw FailedToRestartTrackerException();
+	}
+	return false;
+}
+
+std::string DeviceCaptureSource::getProfileName()
+{
+	return profileName;
+}
+
+k4a_wait_result_t DeviceCaptureSource::getCapture(k4a_capture_t *capture, int32_t timeout)
+{
+	return k4a_device_get_capture(device, capture, timeout);
+}
+
+k4a_result_t DeviceCaptureSource::getCalibration(k4a_calibration_t *calibration)
+{
+	return k4a_device_get_calibration(device, config.depth_mode, config.color_resolution, calibration);
+}
+
+k4a_device_configuration_t DeviceCaptureSource::getConfiguration()
+{
+	return config;
+}
+
+std::vector<uint8_t> DeviceCaptureSource::getRawCalibration()
+{
+	size_t size = 0;
+	k4a_device_get_raw_calibration(device, NULL, &size);
+	std::vector<uint8_t> rawCalibration(size);
+	if (K4A_BUFFER_RESULT_SUCCEEDED != k4a_device_get_raw_calibration(device, rawCalibration.data(), &size))
+	{
+		return {};
+	}
+	return rawCalibration;
+}
+
+DeviceCaptureSource::~DeviceCaptureSource()
+{
+	// Shut down the camera when finished with application logic
+	k4a_device_stop_cameras(device);
+	k4a_device_close(device);
+}
+
+PlaybackCaptureSource::PlaybackCaptureSource(const std::string &path, bool realtime)
+{
+	this->path = path;
+	this->realtime = realtime;
+
+	if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+	{
+		throw FailedToOpenRecordingException();
+	}
+
+	k4a_playback_get_record_configuration(playback, &recordConfig);
+	// Either color and depth, or depth and IR for IR tracking
+	if (!recordConfig.depth_track_enabled || (!recordConfig.color_track_enabled && !recordConfig.ir_track_enabled))
+	{
+		k4a_playback_close(playback);
+		throw UnsupportedRecordingException();
+	}
+
+	// The tracker decodes MJPG itself, anything else (NV12, YUY2) is converted by the SDK to BGRA
+	if (recordConfig.color_track_enabled && recordConfig.color_format != K4A_IMAGE_FORMAT_COLOR_BGRA32 && recordConfig.color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+	{
+		k4a_playback_set_color_conversion(playback, K4A_IMAGE_FORMAT_COLOR_BGRA32);
+	}
+}
+
+k4a_wait_result_t PlaybackCaptureSource::getCapture(k4a_capture_t *capture, int32_t timeout)
+{
+	// A recording that has already been read all the way through without a usable capture never will have one,
+	// wait like a device that's stopped sending so the caller doesn't spin
+	if (unusable)
+	{
+		if (timeout != K4A_WAIT_INFINITE)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		}
+		return K4A_WAIT_RESULT_FAILED;
+	}
+	// Held back by an earlier call that timed out before it was due
+	if (pending == NULL)
+	{
+		k4a_wait_result_t result = readNext(&pending);
+		if (result != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			return result;
+		}
+	}
+	if (realtime && !pace(pending, timeout))
+	{
+		return K4A_WAIT_RESULT_TIMEOUT;
+	}
+	*capture = pending;
+	pending = NULL;
+	framesRead++;
+	return K4A_WAIT_RESULT_SUCCEEDED;
+}
+
+k4a_wait_result_t PlaybackCaptureSource::readNext(k4a_capture_t *capture)
+{
+	// At most one full pass per call: reaching the end twice means there's nothing usable in the whole recording
+	// (empty, depth only, or colour and depth that never pair up)
+	bool wrapped = false;
+	while (true)
+	{
+		k4a_stream_result_t result = k4a_playback_get_next_capture(playback, capture);
+		if (result == K4A_STREAM_RESULT_EOF)
+		{
+			if (wrapped)
+			{
+				unusable = framesRead == 0;
+				return K4A_WAIT_RESULT_FAILED;
+			}
+			// Loop the recording so it can stand in for a device for a whole session
+			if (K4A_FAILED(k4a_playback_seek_timestamp(playback, 0, K4A_PLAYBACK_SEEK_BEGIN)))
+			{
+				return K4A_WAIT_RESULT_FAILED;
+			}
+			firstTimestamp.reset();
+			loops++;
+			wrapped = true;
+			continue;
+		}
+		if (result == K4A_STREAM_RESULT_FAILED)
+		{
+			return K4A_WAIT_RESULT_FAILED;
+		}
+
+		// The tracker needs synchronised images, same as the device config
+		k4a_image_t color = recordConfig.color_track_enabled ? k4a_capture_get_color_image(*capture) : k4a_capture_get_ir_image(*capture);
+		k4a_image_t depth = k4a_capture_get_depth_image(*capture);
+		bool complete = color != NULL && depth != NULL;
+		if (color != NULL)
+		{
+			k4a_image_release(color);
+		}
+		if (depth != NULL)
+		{
+			k4a_image_release(depth);
+		}
+		if (!complete)
+		{
+			k4a_capture_release(*capture);
+			*capture = NULL;
+			framesSkipped++;
+			continue;
+		}
+		return K4A_WAIT_RESULT_SUCCEEDED;
+	}
+}
+
+bool PlaybackCaptureSource::pace(k4a_capture_t capture, int32_t timeout)
+{
+	k4a_image_t depth = k4a_capture_get_depth_image(capture);
+	uint64_t timestamp = k4a_image_get_device_timestamp_usec(depth);
+	k4a_image_release(depth);
+
+	if (!firstTimestamp.has_value())
+	{
+		firstTimestamp = timestamp;
+		playbackStart = std::chrono::steady_clock::now();
+		return true;
+	}
+	auto due = playbackStart + std::chrono::microseconds(timestamp - firstTimestamp.value());
+	// Not due before the caller stops waiting, keep it for the next call
+	if (timeout != K4A_WAIT_INFINITE && due > std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		return false;
+	}
+	std::this_thread::sleep_until(due);
+	return true;
+}
+
+k4a_result_t PlaybackCaptureSource::getCalibration(k4a_calibration_t *calibration)
+{
+	return k4a_playback_get_calibration(playback, calibration);
+}
+
+k4a_device_configuration_t PlaybackCaptureSource::getConfiguration()
+{
+	k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+	config.camera_fps = recordConfig.camera_fps;
+	// Colour other than MJPG is converted on the way out
+	config.color_format = recordConfig.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG ? K4A_IMAGE_FORMAT_COLOR_MJPG : K4A_IMAGE_FORMAT_COLOR_BGRA32;
+	config.color_resolution = recordConfig.color_track_enabled ? recordConfig.color_resolution : K4A_COLOR_RESOLUTION_OFF;
+	config.depth_mode = recordConfig.depth_mode;
+	config.synchronized_images_only = recordConfig.color_track_enabled;
+	return config;
+}
+
+std::vector<uint8_t> PlaybackCaptureSource::getRawCalibration()
+{
+	size_t size = 0;
+	k4a_playback_get_raw_calibration(playback, NULL, &size);
+	std::vector<uint8_t> rawCalibration(size);
+	if (K4A_BUFFER_RESULT_SUCCEEDED != k4a_playback_get_raw_calibration(playback, rawCalibration.data(), &size))
+	{
+		return {};
+	}
+	return rawCalibration;
+}
+
+nlohmann::json PlaybackCaptureSource::returnJson()
+{
+	nlohmann::json playbackLog;
+	playbackLog["recording"] = path;
+	playbackLog["realtime"] = realtime;
+	playbackLog["framesRead"] = framesRead;
+	playbackLog["framesSkipped"] = framesSkipped;
+	playbackLog["loops"] = loops;
+	return playbackLog;
+}
+
+PlaybackCaptureSource::~PlaybackCaptureSource()
+{
+	if (pending != NULL)
+	{
+		k4a_capture_release(pending);
+	}
+	k4a_playback_close(playback);
+}
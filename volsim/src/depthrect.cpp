@@ -0,0 +1,41 @@
+#include <algorithm>
+
+#include "depthrect.hpp"
+
+cv::Rect2f depthRectTo(const k4a_calibration_t &calibration, const cv::Rect2f &rect, float z, k4a_calibration_type_t camera, float scale)
+{
+	if (camera == K4A_CALIBRATION_TYPE_DEPTH)
+	{
+		return cv::Rect2f(rect.x / scale, rect.y / scale, rect.width / scale, rect.height / scale);
+	}
+
+	// A rectangle at one depth stays close enough to one in the other camera to just take the corners' bounds
+	float left = 0.0f;
+	float top = 0.0f;
+	float right = 0.0f;
+	float bottom = 0.0f;
+	int mapped = 0;
+	cv::Point2f corners[4] = {rect.tl(), cv::Point2f(rect.x + rect.width, rect.y), rect.br(), cv::Point2f(rect.x, rect.y + rect.height)};
+	for (const cv::Point2f &corner : corners)
+	{
+		k4a_float2_t source = {corner.x, corner.y};
+		k4a_float2_t target;
+		int valid = 0;
+		if (K4A_RESULT_SUCCEEDED != k4a_calibration_2d_to_2d(&calibration, &source, z, K4A_CALIBRATION_TYPE_DEPTH, camera, &target, &valid) || !valid)
+		{
+			continue;
+		}
+		float x = target.xy.x / scale;
+		float y = target.xy.y / scale;
+		left = mapped == 0 ? x : std::min(left, x);
+		top = mapped == 0 ? y : std::min(top, y);
+		right = mapped == 0 ? x : std::max(right, x);
+		bottom = mapped == 0 ? y : std::max(bottom, y);
+		mapped++;
+	}
+	if (mapped == 0)
+	{
+		return cv::Rect2f();
+	}
+	return cv::Rect2f(left, top, right - left, bottom - top);
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cmath>
+#include <exception>
+
+#include <dlib/dnn.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "facedetector.hpp"
+#include "filesystem.hpp"
+
+class FaceDetectorException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit FaceDetectorException(const std::string &msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class UnknownFaceDetectorException : public FaceDetectorException
+{
+public:
+	explicit UnknownFaceDetectorException(const std::string &name) : FaceDetectorException("No face detector called " + name) {}
+};
+
+class FailedToLoadFaceDetectorException : public FaceDetectorException
+{
+public:
+	explicit FailedToLoadFaceDetectorException(const std::string &path) : FaceDetectorException("Cannot load face detector model " + path) {}
+};
+
+// Face width crops are scaled to, comfortably above the 80 pixel windows of the dlib detectors
+static const float SEARCH_FACE_SIZE = 100.0f;
+
+static void sortByConfidence(std::vector<FaceDetector::Detection> &detections)
+{
+	std::sort(detections.begin(), detections.end(), [](const FaceDetector::Detection &a, const FaceDetector::Detection &b)
+			  { return a.confidence > b.confidence; });
+}
+
+// dlib's MMOD CNN face detector
+template <long num_filters, typename SUBNET>
+using con5d = dlib::con<num_filters, 5, 5, 2, 2, SUBNET>;
+template <long num_filters, typename SUBNET>
+using con5 = dlib::con<num_filters, 5, 5, 1, 1, SUBNET>;
+
+template <typename SUBNET>
+using downsampler = dlib::relu<dlib::affine<con5d<32, dlib::relu<dlib::affine<con5d<32, dlib::relu<dlib::affine<con5d<16, SUBNET>>>>>>>>>;
+template <typename SUBNET>
+using rcon5 = dlib::relu<dlib::affine<con5<45, SUBNET>>>;
+
+using net_type = dlib::loss_mmod<dlib::con<1, 9, 9, 1, 1, rcon5<rcon5<rcon5<downsampler<dlib::input_rgb_image_pyramid<dlib::pyramid_down<6>>>>>>>>;
+
+class CnnFaceDetector : public FaceDetector
+{
+public:
+	CnnFaceDetector()
+	{
+		dlib::deserialize(FileSystem::getPath("data/mmod_human_face_detector.dat").c_str()) >> net;
+	}
+
+	std::vector<Detection> detect(FrameBuffer &frame) override
+	{
+		std::vector<Detection> detections;
+		for (const dlib::mmod_rect &found : net(frame.dlibImage()))
+		{
+			detections.push_back({found.rect, (float)found.detection_confidence});
+		}
+		sortByConfidence(detections);
+		return detections;
+	}
+
+	std::string getName() const override
+	{
+		return "cnn";
+	}
+
+private:
+	net_type net;
+};
+
+class HogFaceDetector : public FaceDetector
+{
+public:
+	HogFaceDetector()
+	{
+		detector = dlib::get_frontal_face_detector();
+	}
+
+	std::vector<Detection> detect(FrameBuffer &frame) override
+	{
+		std::vector<dlib::rect_detection> found;
+		detector(frame.dlibImage(), found);
+		std::vector<Detection> detections;
+		for (const dlib::rect_detection &face : found)
+		{
+			detections.push_back({face.rect, (float)face.detection_confidence});
+		}
+		sortByConfidence(detections);
+		return detections;
+	}
+
+	std::string getName() const override
+	{
+		return "hog";
+	}
+
+private:
+	dlib::frontal_face_detector detector;
+};
+
+class DnnFaceDetector : public FaceDetector
+{
+public:
+	DnnFaceDetector(const std::string &modelPath, const std::string &configPath, float minConfidence)
+	{
+		this->minConfidence = minConfidence;
+		try
+		{
+			net = cv::dnn::readNetFromCaffe(configPath, modelPath);
+		}
+		catch (const cv::Exception &)
+		{
+			throw FailedToLoadFaceDetectorException(modelPath);
+		}
+		if (net.empty())
+		{
+			throw FailedToLoadFaceDetectorException(modelPath);
+		}
+	}
+
+	std::vector<Detection> detect(FrameBuffer &frame) override
+	{
+		// The SSD was trained on 300x300 BGR with these channel means, the frame is RGB so swap on the way in
+		cv::Mat blob = cv::dnn::blobFromImage(frame.cvView(), 1.0, cv::Size(300, 300), cv::Scalar(104.0, 177.0, 123.0), true, false);
+		net.setInput(blob);
+		cv::Mat output = net.forward();
+
+		// 1 x 1 x N x 7: image, class, confidence, then the box as fractions of the frame
+		cv::Mat found(output.size[2], output.size[3], CV_32F, output.ptr<float>());
+		std::vector<Detection> detections;
+		for (int i = 0; i < found.rows; i++)
+		{
+			float confidence = found.at<float>(i, 2);
+			if (confidence < minConfidence)
+			{
+				continue;
+			}
+			long left = (long)(std::clamp(found.at<float>(i, 3), 0.0f, 1.0f) * frame.getWidth());
+			long top = (long)(std::clamp(found.at<float>(i, 4), 0.0f, 1.0f) * frame.getHeight());
+			long right = (long)(std::clamp(found.at<float>(i, 5), 0.0f, 1.0f) * frame.getWidth());
+			long bottom = (long)(std::clamp(found.at<float>(i, 6), 0.0f, 1.0f) * frame.getHeight());
+			if (right > left && bottom > top)
+			{
+				detections.push_back({dlib::rectangle(left, top, right, bottom), confidence});
+			}
+		}
+		sortByConfidence(detections);
+		return detections;
+	}
+
+	std::string getName() const override
+	{
+		return "dnn";
+	}
+
+private:
+	cv::dnn::Net net;
+	float minConfidence;
+};
+
+std::vector<FaceDetector::Detection> FaceDetector::detectIn(FrameBuffer &frame, const dlib::rectangle &region, float faceSize)
+{
+	dlib::rectangle clipped = region.intersect(dlib::rectangle(frame.getWidth(), frame.getHeight()));
+	if (clipped.is_empty())
+	{
+		return {};
+	}
+
+	// Only ever shrink, upsampling would cost more than the whole frame search it replaces
+	double scale = std::min(1.0, (double)SEARCH_FACE_SIZE / std::max(faceSize, 1.0f));
+	int width = std::max(1, (int)std::lround(clipped.width() * scale));
+	int height = std::max(1, (int)std::lround(clipped.height() * scale));
+	crop.resize(width, height);
+	cv::Mat source = frame.cvView()(cv::Rect((int)clipped.left(), (int)clipped.top(), (int)clipped.width(), (int)clipped.height()));
+	cv::Mat destination = crop.cvView();
+	if (scale < 1.0)
+	{
+		cv::resize(source, destination, destination.size(), 0, 0, cv::INTER_AREA);
+	}
+	else
+	{
+		source.copyTo(destination);
+	}
+
+	std::vector<Detection> detections = detect(crop);
+	double toFrameX = (double)clipped.width() / width;
+	double toFrameY = (double)clipped.height() / height;
+	for (Detection &detection : detections)
+	{
+		detection.rect = dlib::rectangle(clipped.left() + (long)std::lround(detection.rect.left() * toFrameX),
+										 clipped.top() + (long)std::lround(detection.rect.top() * toFrameY),
+										 clipped.left() + (long)std::lround(detection.rect.right() * toFrameX),
+										 clipped.top() + (long)std::lround(detection.rect.bottom() * toFrameY));
+	}
+	return detections;
+}
+
+const std::vector<std::string> &FaceDetector::names()
+{
+	static const std::vector<std::string> all = {"cnn", "hog", "dnn"};
+	return all;
+}
+
+std::unique_ptr<FaceDetector> FaceDetector::create(const nlohmann::json &options)
+{
+	return create(options.value("faceDetector", "cnn"), options);
+}
+
+std::unique_ptr<FaceDetector> FaceDetector::create(const std::string &name, const nlohmann::json &options)
+{
+	if (name == "cnn")
+	{
+		return std::make_unique<CnnFaceDetector>();
+	}
+	if (name == "hog")
+	{
+		return std::make_unique<HogFaceDetector>();
+	}
+	if (name == "dnn")
+	{
+		std::string model = options.value("faceDetectorModel", FileSystem::getPath("data/res10_300x300_ssd_iter_140000.caffemodel"));
+		std::string config = options.value("faceDetectorConfig", FileSystem::getPath("data/deploy.prototxt"));
+		return std::make_unique<DnnFaceDetector>(model, config, options.value("faceDetectorMinConfidence", 0.5f));
+	}
+	throw UnknownFaceDetectorException(name);
+}
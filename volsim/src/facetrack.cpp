@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cmath>
+
+#include "facetrack.hpp"
+
+// Scale can't plausibly change by more than this much between frames
+static const float MAX_SCALE_CHANGE = 0.2f;
+// Cap on how far the search box grows to cover motion, as a fraction of its size
+static const float MAX_MOTION_MARGIN = 0.25f;
+
+FaceTrack::FaceTrack(int redetectInterval)
+{
+	this->redetectInterval = redetectInterval;
+}
+
+const char *FaceTrack::reasonName(Reason reason)
+{
+	switch (reason)
+	{
+	case Reason::NONE:
+		return "none";
+	case Reason::NO_FACE:
+		return "noFace";
+	case Reason::LOST:
+		return "lost";
+	case Reason::EDGE:
+		return "edge";
+	case Reason::INTERVAL:
+		return "interval";
+	}
+	return "unknown";
+}
+
+FaceTrack::Reason FaceTrack::needsDetection(long frameWidth, long frameHeight) const
+{
+	if (!active)
+	{
+		return lossReason;
+	}
+	if (redetectInterval <= 0 || framesSinceDetection >= redetectInterval)
+	{
+		return Reason::INTERVAL;
+	}
+	dlib::rectangle predicted = predictedBox();
+	if (predicted.left() < 0 || predicted.top() < 0 || predicted.right() >= frameWidth || predicted.bottom() >= frameHeight)
+	{
+		return Reason::EDGE;
+	}
+	return Reason::NONE;
+}
+
+dlib::rectangle FaceTrack::predictedBox() const
+{
+	float marginX = std::min(std::abs(velocity.x), (float)box.width() * MAX_MOTION_MARGIN);
+	float marginY = std::min(std::abs(velocity.y), (float)box.height() * MAX_MOTION_MARGIN);
+	return dlib::rectangle((long)std::lround(box.left() + velocity.x - marginX),
+						   (long)std::lround(box.top() + velocity.y - marginY),
+						   (long)std::lround(box.right() + velocity.x + marginX),
+						   (long)std::lround(box.bottom() + velocity.y + marginY));
+}
+
+FaceTrack::Shape FaceTrack::measure(const dlib::full_object_detection &shape)
+{
+	// 5 point model: 0-1 and 2-3 are the corners of each eye, 4 is the bottom of the nose
+	auto point = [&shape](int i)
+	{ return glm::vec2((float)shape.part(i).x(), (float)shape.part(i).y()); };
+	glm::vec2 eyeA = (point(0) + point(1)) * 0.5f;
+	glm::vec2 eyeB = (point(2) + point(3)) * 0.5f;
+	glm::vec2 nose = point(4);
+
+	Shape measured;
+	measured.centroid = (point(0) + point(1) + point(2) + point(3) + nose) / 5.0f;
+	glm::vec2 eyeLine = eyeB - eyeA;
+	measured.span = std::max(glm::length(eyeLine), 1.0f);
+	// Perpendicular distance so head roll doesn't register as a bad shape
+	glm::vec2 fromEyes = nose - (eyeA + eyeB) * 0.5f;
+	measured.noseDrop = std::abs(eyeLine.x * fromEyes.y - eyeLine.y * fromEyes.x) / (measured.span * measured.span);
+	return measured;
+}
+
+void FaceTrack::place(const Shape &shape)
+{
+	glm::vec2 centre = shape.centroid + boxOffset * shape.span;
+	glm::vec2 halfSize = boxSize * shape.span * 0.5f;
+	box = dlib::drectangle(centre.x - halfSize.x, centre.y - halfSize.y, centre.x + halfSize.x, centre.y + halfSize.y);
+}
+
+void FaceTrack::detected(const dlib::rectangle &detectedBox, const dlib::full_object_detection &shape)
+{
+	reference = measure(shape);
+	last = reference;
+	glm::vec2 centre((float)dlib::dcenter(detectedBox).x(), (float)dlib::dcenter(detectedBox).y());
+	boxOffset = (centre - reference.centroid) / reference.span;
+	boxSize = glm::vec2((float)detectedBox.width(), (float)detectedBox.height()) / reference.span;
+	box = dlib::drectangle(detectedBox);
+	velocity = glm::vec2(0.0f);
+	framesSinceDetection = 0;
+	active = true;
+}
+
+void FaceTrack::notDetected()
+{
+	active = false;
+	lossReason = Reason::NO_FACE;
+}
+
+float FaceTrack::tracked(const dlib::full_object_detection &shape)
+{
+	Shape current = measure(shape);
+	float scaleChange = current.span / last.span;
+	float scaleConfidence = 1.0f - std::min(std::abs(scaleChange - 1.0f) / MAX_SCALE_CHANGE, 1.0f) * (1.0f - MIN_CONFIDENCE);
+	if (std::abs(scaleChange - 1.0f) > MAX_SCALE_CHANGE)
+	{
+		scaleConfidence = 0.0f;
+	}
+	float shapeConfidence = std::clamp(1.0f - std::abs(current.noseDrop - reference.noseDrop) / std::max(reference.noseDrop, 0.05f), 0.0f, 1.0f);
+	float confidence = std::min(scaleConfidence, shapeConfidence);
+
+	if (confidence < MIN_CONFIDENCE)
+	{
+		active = false;
+		lossReason = Reason::LOST;
+		losses++;
+		return confidence;
+	}
+
+	velocity = current.centroid - last.centroid;
+	last = current;
+	place(current);
+	framesSinceDetection++;
+	return confidence;
+}
+
+void FaceTrack::addDetectCost(Reason reason, std::chrono::steady_clock::duration duration)
+{
+	auto now = std::chrono::steady_clock::now();
+	if (detectorRuns + trackedFrames == 0)
+	{
+		firstFrame = now - duration;
+	}
+	lastFrame = now;
+	detectorRuns++;
+	detectionReasons[reasonName(reason)]++;
+	detectCost.add(duration);
+}
+
+void FaceTrack::addTrackCost(std::chrono::steady_clock::duration duration)
+{
+	auto now = std::chrono::steady_clock::now();
+	if (detectorRuns + trackedFrames == 0)
+	{
+		firstFrame = now - duration;
+	}
+	lastFrame = now;
+	trackedFrames++;
+	trackCost.add(duration);
+}
+
+nlohmann::json FaceTrack::returnJson() const
+{
+	double seconds = std::chrono::duration<double>(lastFrame - firstFrame).count();
+	nlohmann::json trackLog;
+	trackLog["redetectInterval"] = redetectInterval;
+	trackLog["frames"] = detectorRuns + trackedFrames;
+	trackLog["detectorRuns"] = detectorRuns;
+	trackLog["trackedFrames"] = trackedFrames;
+	trackLog["losses"] = losses;
+	trackLog["detectorRunsPerSecond"] = seconds > 0.0 ? detectorRuns / seconds : 0.0;
+	trackLog["detectionReasons"] = detectionReasons;
+	trackLog["detectCost"] = detectCost.returnJson();
+	trackLog["trackCost"] = trackCost.returnJson();
+	return trackLog;
+}
@@ -0,0 +1,49 @@
+#include "framebuffer.hpp"
+
+// The views assume dlib packs its pixels with no padding
+static_assert(sizeof(dlib::rgb_pixel) == 3, "dlib::rgb_pixel must be 3 packed bytes");
+
+void FrameBuffer::resize(int width, int height)
+{
+	if (pixels.nc() == width && pixels.nr() == height)
+	{
+		return;
+	}
+	pixels.set_size(height, width);
+	reallocations++;
+}
+
+int FrameBuffer::getWidth() const
+{
+	return (int)pixels.nc();
+}
+
+int FrameBuffer::getHeight() const
+{
+	return (int)pixels.nr();
+}
+
+const dlib::matrix<dlib::rgb_pixel> &FrameBuffer::dlibImage() const
+{
+	return pixels;
+}
+
+cv::Mat FrameBuffer::cvView()
+{
+	return cv::Mat(getHeight(), getWidth(), CV_8UC3, (void *)&pixels(0, 0), (size_t)getWidth() * 3);
+}
+
+mp_image FrameBuffer::mpView()
+{
+	mp_image image;
+	image.data = (uint8_t *)&pixels(0, 0);
+	image.width = getWidth();
+	image.height = getHeight();
+	image.format = mp_image_format_srgb;
+	return image;
+}
+
+uint64_t FrameBuffer::getReallocations() const
+{
+	return reallocations;
+}
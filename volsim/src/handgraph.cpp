@@ -0,0 +1,151 @@
+#include <iostream>
+#include <string>
+
+#include "handgraph.hpp"
+#include "filesystem.hpp"
+
+HandGraph::HandGraph(std::function<void(const Result &)> onResult, size_t queueDepth, QueuePolicy policy) : queue(queueDepth, policy)
+{
+	this->onResult = std::move(onResult);
+
+	// configure mediapipe
+	std::string srcPath = FileSystem::getPath("data/");
+	std::string landmarkPath = FileSystem::getPath("data/mediapipe/modules/hand_landmark/hand_landmark_tracking_cpu.binarypb");
+	mp_set_resource_dir(srcPath.c_str());
+
+	// Load the binary graph and specify the input stream name.
+	mp_instance_builder *builder = mp_create_instance_builder(landmarkPath.c_str(), "image");
+
+	// Configure the graph with node options and side packets.
+	mp_add_option_float(builder, "palmdetectioncpu__TensorsToDetectionsCalculator", "min_score_thresh", 0.5);
+	mp_add_option_double(builder, "handlandmarkcpu__ThresholdingCalculator", "threshold", 0.5);
+	mp_add_side_packet(builder, "num_hands", mp_create_packet_int(1));
+	mp_add_side_packet(builder, "model_complexity", mp_create_packet_int(1));
+	mp_add_side_packet(builder, "use_prev_landmarks", mp_create_packet_bool(true));
+
+	// Create an instance from the instance builder.
+	instance = mp_create_instance(builder);
+	CHECK_MP_RESULT(instance)
+
+	// Create poller for the hand landmarks.
+	landmarks_poller = mp_create_poller(instance, "multi_hand_landmarks");
+	CHECK_MP_RESULT(landmarks_poller)
+
+	// Create a poller for the hand rectangles.
+	rects_poller = mp_create_poller(instance, "hand_rects");
+	CHECK_MP_RESULT(rects_poller)
+
+	// Start the graph.
+	CHECK_MP_RESULT(mp_start(instance))
+
+	worker = std::thread(&HandGraph::run, this);
+}
+
+HandGraph::~HandGraph()
+{
+	stop();
+}
+
+void HandGraph::submit(const mp_image &image, uint64_t frameId)
+{
+	// The packet owns a copy, so the caller can reuse its frame straight away
+	Job job{mp_create_packet_image(image), frameId, image.width, image.height, std::chrono::steady_clock::now()};
+	std::optional<Job> dropped;
+	if (!queue.push(std::move(job), dropped))
+	{
+		mp_destroy_packet(job.packet);
+	}
+	if (dropped.has_value())
+	{
+		mp_destroy_packet(dropped->packet);
+	}
+}
+
+void HandGraph::stop()
+{
+	queue.close();
+	if (worker.joinable())
+	{
+		worker.join();
+	}
+	for (Job &job : queue.drain())
+	{
+		mp_destroy_packet(job.packet);
+	}
+}
+
+void HandGraph::run()
+{
+	Result result;
+	while (true)
+	{
+		Job job;
+		auto idleStart = std::chrono::steady_clock::now();
+		if (!queue.pop(job))
+		{
+			return;
+		}
+		auto busyStart = std::chrono::steady_clock::now();
+		threadStats.addIdle(busyStart - idleStart);
+
+		// Idle straight after means the pollers hold exactly this frame's results
+		CHECK_MP_RESULT(mp_process(instance, job.packet))
+		CHECK_MP_RESULT(mp_wait_until_idle(instance))
+		collect(job, result);
+
+		result.finishedTime = std::chrono::steady_clock::now();
+		graphCost.add(result.finishedTime - busyStart);
+		submitToResult.add(result.finishedTime - job.submittedTime);
+		onResult(result);
+		threadStats.addBusy(std::chrono::steady_clock::now() - busyStart);
+	}
+}
+
+void HandGraph::collect(const Job &job, Result &result)
+{
+	result.frameId = job.frameId;
+	result.found = false;
+	result.submittedTime = job.submittedTime;
+
+	// Making the assumption if there is a landmark packet there is a rect packet
+	if (mp_get_queue_size(landmarks_poller) == 0)
+	{
+		return;
+	}
+	mp_packet *landmark_packet = mp_poll_packet(landmarks_poller);
+	mp_multi_face_landmark_list *hand_landmarks_list = mp_get_norm_multi_face_landmarks(landmark_packet);
+
+	mp_packet *rects_packet = mp_poll_packet(rects_poller);
+	mp_rect_list *rects = mp_get_norm_rects(rects_packet);
+
+	if (hand_landmarks_list->length > 0)
+	{
+		mp_landmark_list &landmarks = hand_landmarks_list->elements[0];
+		for (int j = 0; j < landmarks.length && j < 21; j++)
+		{
+			const mp_landmark &p = landmarks.elements[j];
+			result.landmarks[j] = {(float)job.width * p.x, (float)job.height * p.y, (float)job.width * p.z};
+		}
+
+		const mp_rect &rect = rects->elements[0];
+		result.centre = {job.width * rect.x_center, job.height * rect.y_center};
+		result.size = {job.width * rect.width, job.height * rect.height};
+		result.rotation = rect.rotation;
+		result.found = true;
+	}
+
+	mp_destroy_multi_face_landmarks(hand_landmarks_list);
+	mp_destroy_packet(landmark_packet);
+	mp_destroy_rects(rects);
+	mp_destroy_packet(rects_packet);
+}
+
+nlohmann::json HandGraph::returnJson()
+{
+	nlohmann::json graphLog;
+	graphLog["queue"] = queue.returnJson();
+	graphLog["graphCost"] = graphCost.returnJson();
+	graphLog["submitToResult"] = submitToResult.returnJson();
+	graphLog["thread"] = threadStats.returnJson();
+	return graphLog;
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "handroi.hpp"
+#include "depthrect.hpp"
+
+// The depth image is sampled on a grid this coarse, same as HeadSearch
+static const int CELL = 8;
+// Rough length of an open hand, wrist to fingertips, in mm
+static const float HAND_SIZE = 200.0f;
+// Smallest crop worth giving palm detection, in tracking frame pixels
+static const int MIN_CROP = 128;
+// How close (as a fraction of the crop) the hand can get to a side of a held crop before it's moved
+static const float EDGE_MARGIN = 0.1f;
+
+HandRoi::HandRoi(const nlohmann::json &options)
+{
+	// How much bigger than the last hand rect (already about twice the hand) the crop is, to allow for movement
+	scale = options.value("handRoiScale", 1.5f);
+	// Misses in a row before giving up on a source
+	maxMisses = std::max(1, options.value("handRoiMaxMisses", 5));
+	// Hands are looked for in front of the user, at most this far from the camera (mm)
+	minDepth = options.value("handMinDepth", 200.0f);
+	maxDepth = options.value("handMaxDepth", 800.0f);
+	// Anything within this of the nearest point counts as the same hand
+	depthBand = options.value("handDepthBand", 150.0f);
+}
+
+HandRoi::Source HandRoi::nextSource() const
+{
+	return tracking ? Source::TRACKED : coldSource;
+}
+
+// Square around the centre, at least MIN_CROP, kept inside the frame where it can be
+static cv::Rect squareCrop(cv::Point2f centre, float side, int frameWidth, int frameHeight)
+{
+	int size = std::min({std::max(MIN_CROP, (int)std::ceil(side)), frameWidth, frameHeight});
+	int x = std::clamp((int)std::lround(centre.x - size * 0.5f), 0, frameWidth - size);
+	int y = std::clamp((int)std::lround(centre.y - size * 0.5f), 0, frameHeight - size);
+	return cv::Rect(x, y, size, size);
+}
+
+HandRoi::Crop HandRoi::trackedCrop(int frameWidth, int frameHeight)
+{
+	cv::Rect bounds = lastBox.boundingRect();
+	float side = scale * (float)std::max(bounds.width, bounds.height);
+
+	// The graph carries the last landmarks over to the next frame in the previous crop's normalised coordinates, so
+	// the crop is held still while the hand is comfortably inside it. It only moves once the hand gets near a side
+	// (one that isn't the edge of the frame), outgrows it or shrinks to under half of it.
+	if (!held.empty() && (held & cv::Rect(0, 0, frameWidth, frameHeight)) == held)
+	{
+		int margin = (int)(EDGE_MARGIN * held.width);
+		bool inside = (held.x == 0 || bounds.x >= held.x + margin) &&
+					  (held.y == 0 || bounds.y >= held.y + margin) &&
+					  (held.br().x == frameWidth || bounds.br().x <= held.br().x - margin) &&
+					  (held.br().y == frameHeight || bounds.br().y <= held.br().y - margin);
+		float wanted = std::max(side, (float)MIN_CROP);
+		if (inside && wanted <= held.width && wanted >= 0.5f * held.width)
+		{
+			return {held, Source::TRACKED};
+		}
+		moves++;
+	}
+	held = squareCrop(lastBox.center, side, frameWidth, frameHeight);
+	return {held, Source::TRACKED};
+}
+
+HandRoi::Crop HandRoi::depthCrop(k4a_image_t depthImage, const k4a_calibration_t &calibration, k4a_calibration_type_t camera, float scale, int frameWidth, int frameHeight)
+{
+	Crop crop{cv::Rect(), Source::DEPTH};
+	if (depthImage == NULL)
+	{
+		return crop;
+	}
+
+	int width = k4a_image_get_width_pixels(depthImage);
+	int height = k4a_image_get_height_pixels(depthImage);
+	int stride = k4a_image_get_stride_bytes(depthImage);
+	const uint8_t *buffer = k4a_image_get_buffer(depthImage);
+	int cols = width / CELL;
+	int rows = height / CELL;
+
+	// Nearest thing in range, one sample per cell
+	float nearest = maxDepth + 1.0f;
+	for (int y = 0; y < rows; y++)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)(y * CELL + CELL / 2) * stride);
+		for (int x = 0; x < cols; x++)
+		{
+			float z = (float)row[x * CELL + CELL / 2];
+			if (z >= minDepth && z < nearest)
+			{
+				nearest = z;
+			}
+		}
+	}
+	if (nearest > maxDepth)
+	{
+		return crop;
+	}
+
+	// Everything just behind it, the biggest piece is the hand (and arm)
+	mask.create(rows, cols, CV_8U);
+	float farthest = nearest + depthBand;
+	for (int y = 0; y < rows; y++)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)(y * CELL + CELL / 2) * stride);
+		uint8_t *maskRow = mask.ptr<uint8_t>(y);
+		for (int x = 0; x < cols; x++)
+		{
+			float z = (float)row[x * CELL + CELL / 2];
+			maskRow[x] = (z >= nearest && z <= farthest) ? 255 : 0;
+		}
+	}
+	int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+	int largest = 0;
+	for (int i = 1; i < count; i++)
+	{
+		if (largest == 0 || stats.at<int>(i, cv::CC_STAT_AREA) > stats.at<int>(largest, cv::CC_STAT_AREA))
+		{
+			largest = i;
+		}
+	}
+	// A lone cell is more likely a flying pixel than a hand
+	if (largest == 0 || stats.at<int>(largest, cv::CC_STAT_AREA) < 2)
+	{
+		return crop;
+	}
+
+	// Centre on the nearest point of it, the fingertips when reaching for the screen, so an arm running off the
+	// edge of the frame doesn't drag the crop away from the hand
+	cv::Point tip(-1, -1);
+	float tipDepth = farthest + 1.0f;
+	for (int y = 0; y < rows; y++)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)(y * CELL + CELL / 2) * stride);
+		const int *labelRow = labels.ptr<int>(y);
+		for (int x = 0; x < cols; x++)
+		{
+			if (labelRow[x] == largest && (float)row[x * CELL + CELL / 2] < tipDepth)
+			{
+				tipDepth = (float)row[x * CELL + CELL / 2];
+				tip = cv::Point(x, y);
+			}
+		}
+	}
+
+	// Palm detection wants the hand to fill about half of what it's given. Worked out in depth pixels, then only
+	// its corners are moved into the tracking frame.
+	cv::Point2f centre((tip.x + 0.5f) * CELL, (tip.y + 0.5f) * CELL);
+	float hand = calibration.depth_camera_calibration.intrinsics.parameters.param.fx * HAND_SIZE / tipDepth;
+	cv::Rect2f framed = depthRectTo(calibration, cv::Rect2f(centre.x - hand, centre.y - hand, 2.0f * hand, 2.0f * hand), tipDepth, camera, scale);
+	if (framed.empty())
+	{
+		return crop;
+	}
+	crop.rect = squareCrop((framed.tl() + framed.br()) * 0.5f, std::max(framed.width, framed.height), frameWidth, frameHeight);
+	return crop;
+}
+
+HandRoi::Crop HandRoi::fullFrame(int frameWidth, int frameHeight)
+{
+	return {cv::Rect(0, 0, frameWidth, frameHeight), Source::FULL};
+}
+
+void HandRoi::found(const Crop &crop, const cv::RotatedRect &box, std::chrono::steady_clock::duration handTime)
+{
+	count(crop.source, true, handTime);
+	if (!tracking && lost > recovered)
+	{
+		recovered++;
+	}
+	// Found from a cold start, whatever crop was held before has nothing to do with this hand
+	if (crop.source != Source::TRACKED)
+	{
+		held = cv::Rect();
+	}
+	tracking = true;
+	lastBox = box;
+	misses = 0;
+	coldSource = Source::DEPTH;
+}
+
+void HandRoi::missed(const Crop &crop, std::chrono::steady_clock::duration handTime)
+{
+	count(crop.source, false, handTime);
+	if (lost > recovered)
+	{
+		framesLost++;
+	}
+	if (++misses < maxMisses)
+	{
+		return;
+	}
+	misses = 0;
+	if (tracking)
+	{
+		tracking = false;
+		lost++;
+		coldSource = Source::DEPTH;
+	}
+	else
+	{
+		// Go back and forth between the depth hint and the whole frame until something turns up
+		coldSource = coldSource == Source::DEPTH ? Source::FULL : Source::DEPTH;
+	}
+}
+
+void HandRoi::count(Source source, bool hit, std::chrono::steady_clock::duration handTime)
+{
+	Score &score = scores[(int)source];
+	score.frames++;
+	if (hit)
+	{
+		score.found++;
+	}
+	score.handTime.add(handTime);
+}
+
+nlohmann::json HandRoi::returnJson() const
+{
+	nlohmann::json roiLog;
+	for (Source source : {Source::TRACKED, Source::DEPTH, Source::FULL})
+	{
+		const Score &score = scores[(int)source];
+		nlohmann::json &sourceLog = roiLog["sources"][sourceName(source)];
+		sourceLog["frames"] = score.frames;
+		sourceLog["found"] = score.found;
+		sourceLog["foundRate"] = score.frames > 0 ? (double)score.found / score.frames : 0.0;
+		sourceLog["handTime"] = score.handTime.returnJson();
+	}
+	// A loss is maxMisses misses in a row while tracking, recovered once any source finds the hand again
+	roiLog["lost"] = lost;
+	roiLog["recovered"] = recovered;
+	roiLog["recoveryRate"] = lost > 0 ? (double)recovered / lost : 1.0;
+	roiLog["meanFramesToRecover"] = recovered > 0 ? (double)framesLost / recovered : 0.0;
+	// Times a held tracked crop had to be moved after the hand
+	roiLog["trackedCropMoves"] = moves;
+	return roiLog;
+}
+
+std::string HandRoi::sourceName(Source source)
+{
+	switch (source)
+	{
+	case Source::TRACKED:
+		return "tracked";
+	case Source::DEPTH:
+		return "depth";
+	case Source::FULL:
+		return "full";
+	}
+	return "unknown";
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "headsearch.hpp"
+#include "depthrect.hpp"
+
+// The depth image is sampled on a grid this coarse, a head is still tens of cells across
+static const int CELL = 8;
+// Width the detectors' boxes come out at for an average adult face, in mm
+static const float FACE_WIDTH = 160.0f;
+// Most candidates to hand back, the nearest largest blobs are the likeliest heads
+static const size_t MAX_REGIONS = 3;
+
+HeadSearch::HeadSearch(float minDepth, float maxDepth)
+{
+	this->minDepth = minDepth;
+	this->maxDepth = maxDepth;
+}
+
+std::vector<HeadSearch::Region> HeadSearch::find(k4a_image_t depthImage, float fx)
+{
+	std::vector<Region> regions;
+	if (depthImage == NULL)
+	{
+		return regions;
+	}
+
+	int width = k4a_image_get_width_pixels(depthImage);
+	int height = k4a_image_get_height_pixels(depthImage);
+	int stride = k4a_image_get_stride_bytes(depthImage);
+	const uint8_t *buffer = k4a_image_get_buffer(depthImage);
+
+	// Foreground mask of everything at seating distance, one sample per cell
+	int cols = width / CELL;
+	int rows = height / CELL;
+	mask.create(rows, cols, CV_8U);
+	depth.create(rows, cols, CV_32F);
+	for (int y = 0; y < rows; y++)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)(y * CELL + CELL / 2) * stride);
+		uint8_t *maskRow = mask.ptr<uint8_t>(y);
+		float *depthRow = depth.ptr<float>(y);
+		for (int x = 0; x < cols; x++)
+		{
+			float z = (float)row[x * CELL + CELL / 2];
+			bool inRange = z >= minDepth && z <= maxDepth;
+			maskRow[x] = inRange ? 255 : 0;
+			depthRow[x] = z;
+		}
+	}
+
+	int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+
+	// Smallest a head could plausibly be, in cells, at the far end of the range
+	float smallestHead = fx * FACE_WIDTH / maxDepth / CELL;
+	float largestHead = fx * FACE_WIDTH / minDepth / CELL;
+
+	std::vector<int> candidates;
+	for (int i = 1; i < count; i++)
+	{
+		if (stats.at<int>(i, cv::CC_STAT_AREA) >= 0.5f * smallestHead * smallestHead)
+		{
+			candidates.push_back(i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](int a, int b)
+			  { return stats.at<int>(a, cv::CC_STAT_AREA) > stats.at<int>(b, cv::CC_STAT_AREA); });
+	if (candidates.size() > MAX_REGIONS)
+	{
+		candidates.resize(MAX_REGIONS);
+	}
+
+	std::vector<float> bandDepths;
+	for (int label : candidates)
+	{
+		int top = stats.at<int>(label, cv::CC_STAT_TOP);
+		int bottom = top + stats.at<int>(label, cv::CC_STAT_HEIGHT);
+
+		// Distance of the top of the blob, where the head is, over a band tall enough for the nearest head
+		int bandEnd = std::min(bottom, top + (int)std::ceil(largestHead));
+		bandDepths.clear();
+		for (int y = top; y < bandEnd; y++)
+		{
+			const int *labelRow = labels.ptr<int>(y);
+			const float *depthRow = depth.ptr<float>(y);
+			for (int x = 0; x < cols; x++)
+			{
+				if (labelRow[x] == label)
+				{
+					bandDepths.push_back(depthRow[x]);
+				}
+			}
+		}
+		if (bandDepths.empty())
+		{
+			continue;
+		}
+		std::nth_element(bandDepths.begin(), bandDepths.begin() + bandDepths.size() / 2, bandDepths.end());
+		float z = bandDepths[bandDepths.size() / 2];
+		float head = fx * FACE_WIDTH / z / CELL;
+
+		// The head's columns are the blob's columns within one and a half head heights of its top
+		int headEnd = std::min(bottom, top + (int)std::ceil(1.5f * head));
+		int left = cols;
+		int right = -1;
+		for (int y = top; y < headEnd; y++)
+		{
+			const int *labelRow = labels.ptr<int>(y);
+			for (int x = 0; x < cols; x++)
+			{
+				if (labelRow[x] == label)
+				{
+					left = std::min(left, x);
+					right = std::max(right, x);
+				}
+			}
+		}
+		if (right < left)
+		{
+			continue;
+		}
+
+		// Pad so a face at the edge of the blob (or hair that fell out of range) still fits whole
+		float pad = 0.5f * head;
+		float x0 = (left - pad) * CELL;
+		float y0 = (top - pad) * CELL;
+		float x1 = (right + 1 + pad) * CELL;
+		float y1 = (headEnd + pad) * CELL;
+		dlib::rectangle rect((long)std::max(0.0f, x0), (long)std::max(0.0f, y0),
+							 (long)std::min((float)width - 1, x1), (long)std::min((float)height - 1, y1));
+		if (rect.is_empty())
+		{
+			continue;
+		}
+		regions.push_back({rect, head * CELL, z});
+	}
+	return regions;
+}
+
+bool HeadSearch::toFrame(Region &region, const k4a_calibration_t &calibration, k4a_calibration_type_t camera, float scale, int frameWidth, int frameHeight)
+{
+	cv::Rect2f rect = depthRectTo(calibration, cv::Rect2f((float)region.rect.left(), (float)region.rect.top(), (float)region.rect.width(), (float)region.rect.height()), region.depth, camera, scale);
+	dlib::rectangle framed((long)std::max(0.0f, rect.x), (long)std::max(0.0f, rect.y),
+						   (long)std::min((float)frameWidth - 1, rect.x + rect.width), (long)std::min((float)frameHeight - 1, rect.y + rect.height));
+	if (rect.empty() || framed.is_empty())
+	{
+		return false;
+	}
+	// Same face, seen by a camera with a different focal length
+	float depthFx = calibration.depth_camera_calibration.intrinsics.parameters.param.fx;
+	float frameFx = camera == K4A_CALIBRATION_TYPE_DEPTH ? depthFx : calibration.color_camera_calibration.intrinsics.parameters.param.fx;
+	region.faceSize *= frameFx / depthFx / scale;
+	region.rect = framed;
+	return true;
+}
@@ -0,0 +1,83 @@
+#include <k4a/k4a.h>
+#include <algorithm>
+
+#include "imagepool.hpp"
+
+ImagePool::ImagePool(k4a_image_format_t format, int width, int height, int strideBytes, size_t count)
+{
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	this->strideBytes = strideBytes;
+	bufferSize = (size_t)strideBytes * height;
+
+	storage.resize(count);
+	for (auto &buffer : storage)
+	{
+		buffer.resize(bufferSize);
+		freeBuffers.push_back(buffer.data());
+	}
+}
+
+k4a_image_t ImagePool::acquire()
+{
+	uint8_t *buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		acquired++;
+		if (freeBuffers.empty())
+		{
+			exhausted++;
+		}
+		else
+		{
+			buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+			inUse++;
+			highWaterMark = std::max(highWaterMark, inUse);
+		}
+	}
+
+	k4a_image_t image = NULL;
+	if (buffer == nullptr)
+	{
+		// Rather than stall the caller, fall back to the SDK allocator
+		if (K4A_FAILED(k4a_image_create(format, width, height, strideBytes, &image)))
+		{
+			return NULL;
+		}
+		return image;
+	}
+
+	if (K4A_FAILED(k4a_image_create_from_buffer(format, width, height, strideBytes, buffer, bufferSize, &ImagePool::release, this, &image)))
+	{
+		giveBack(buffer);
+		return NULL;
+	}
+	return image;
+}
+
+void ImagePool::release(void *buffer, void *context)
+{
+	static_cast<ImagePool *>(context)->giveBack(static_cast<uint8_t *>(buffer));
+}
+
+void ImagePool::giveBack(uint8_t *buffer)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	freeBuffers.push_back(buffer);
+	inUse--;
+}
+
+nlohmann::json ImagePool::returnJson()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	nlohmann::json poolLog;
+	poolLog["capacity"] = storage.size();
+	poolLog["bufferBytes"] = bufferSize;
+	poolLog["acquired"] = acquired;
+	poolLog["inUse"] = inUse;
+	poolLog["highWaterMark"] = highWaterMark;
+	poolLog["exhausted"] = exhausted;
+	return poolLog;
+}
@@ -0,0 +1,66 @@
+#include <k4a/k4a.h>
+#include <turbojpeg.h>
+#include <iostream>
+#include <exception>
+
+#include "jpegdecoder.hpp"
+
+class JpegDecoderException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit JpegDecoderException(const char *msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class FailedToInitialiseJpegDecoderException : public JpegDecoderException
+{
+public:
+	FailedToInitialiseJpegDecoderException() : JpegDecoderException("Cannot initialise the jpeg decoder") {}
+};
+
+JpegDecoder::JpegDecoder()
+{
+	handle = tjInitDecompress();
+	if (handle == NULL)
+	{
+		throw FailedToInitialiseJpegDecoderException();
+	}
+}
+
+bool JpegDecoder::decode(k4a_image_t image, int scaleDenom, int pixelFormat, cv::Mat &out)
+{
+	uint8_t *data = k4a_image_get_buffer(image);
+	unsigned long size = (unsigned long)k4a_image_get_size(image);
+
+	int width, height, subsampling, colorspace;
+	if (tjDecompressHeader3(handle, data, size, &width, &height, &subsampling, &colorspace) != 0)
+	{
+		std::cerr << "Failed to read jpeg header: " << tjGetErrorStr2(handle) << std::endl;
+		return false;
+	}
+
+	// Same rounding libjpeg-turbo uses for scaled output
+	int scaledWidth = TJSCALED(width, (tjscalingfactor{1, scaleDenom}));
+	int scaledHeight = TJSCALED(height, (tjscalingfactor{1, scaleDenom}));
+	out.create(scaledHeight, scaledWidth, tjPixelSize[pixelFormat] == 4 ? CV_8UC4 : CV_8UC3);
+
+	// Fast DCT: the tracker immediately downsamples/detects on this, exactness isn't worth the time
+	if (tjDecompress2(handle, data, size, out.data, scaledWidth, (int)out.step, scaledHeight, pixelFormat, TJFLAG_FASTDCT) != 0)
+	{
+		std::cerr << "Failed to decode jpeg: " << tjGetErrorStr2(handle) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+JpegDecoder::~JpegDecoder()
+{
+	tjDestroy(handle);
+}
@@ -14,11 +14,14 @@
 #include <thread>
 #include <chrono>
 #include <optional>
+#include <vector>
 #include <opencv2/core.hpp>
 
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
+#ifndef VOLSIM_NO_CUDA
 #include <opencv2/core/cuda.hpp>
+#endif
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "main.hpp"
@@ -29,12 +32,17 @@
 #include "pointcloud.hpp"
 #include "challenge.hpp"
 #include "renderer.hpp"
+#include "capturesource.hpp"
+#include "threadstats.hpp"
+#include "latency.hpp"
+#include "rig.hpp"
+#include "posefilter.hpp"
 
 extern "C"
 {
 	static std::string outputString;
 
-	const char *runSimulation(Mode trackerMode, int challengeNum, float  camera_x, float  camera_y, float  camera_z, float  camera_rot, int mainMonitor, int offsetMonitor, int timeout, bool debug)
+	const char *runSimulation(Mode trackerMode, int challengeNum, float  camera_x, float  camera_y, float  camera_z, float  camera_rot, int mainMonitor, int offsetMonitor, int timeout, bool debug, const char *options)
 	{
 		// debugInitPrint();
 
@@ -58,10 +66,21 @@ extern "C"
 			hand_x_offset = 48.0f;
 		}
 
-		std::unique_ptr<Tracker> trackerPtr = std::make_unique<Tracker>(glm::vec3(camera_x - extra_x_offset, camera_y, camera_z), camera_rot, debug);
+		// Extra tracker settings, e.g. {"source": "playback", "recording": "session.mkv", "realtime": false, "record": "out.mkv"}
+		// or {"profile": "lowLatency"} to pick the camera setup (see CaptureProfile::all)
+		nlohmann::json trackerOptions = nlohmann::json::parse((options != NULL && options[0] != '\0') ? options : "{}");
+
+		// Extra cameras go in trackerOptions["cameras"], each with what differs from the primary: source settings, "position" and "rotation"
+		std::unique_ptr<TrackerRig> trackerPtr = TrackerRig::create(trackerOptions, glm::vec3(camera_x - extra_x_offset, camera_y, camera_z), glm::vec3(camera_rot, 0.0f, 0.0f), debug);
+		Tracker &primaryTracker = trackerPtr->getPrimary();
 
-		std::thread trackerThread(pollTracker, trackerPtr.get(), window);
-		std::thread captureThread(pollCapture, trackerPtr.get(), window);
+		// Every camera gets its own capture and detection workers
+		std::vector<std::thread> trackerThreads;
+		for (size_t i = 0; i < trackerPtr->size(); i++)
+		{
+			trackerThreads.emplace_back(pollTracker, &trackerPtr->getTracker(i), window);
+			trackerThreads.emplace_back(pollCapture, &trackerPtr->getTracker(i), window);
+		}
 
 		// render loop
 		// -----------
@@ -105,11 +124,30 @@ extern "C"
 		}
 
 		Challenge challenge = Challenge(renderer, hand, challengeNum, centre);
+
+		// Capture profiles to switch to part way through, e.g. [{"at": 10, "profile": "lowLatency"}] (seconds from start)
+		nlohmann::json profileSchedule = trackerOptions.value("profileSchedule", nlohmann::json::array());
+		size_t nextScheduledProfile = 0;
+		uint64_t lastFrameSequence = 0;
+		ThreadStats renderThreadStats;
+		// Capture -> track -> handed to the renderer -> on screen, per result stream
+		FrameLatency eyeLatency;
+		FrameLatency handLatency;
+		// Tracked points are smoothed and predicted forward to when the frame being drawn will be on screen,
+		// {"poseFilter": "kalman"} etc. picks the filter (see PoseFilter::create)
+		std::unique_ptr<PoseFilter> eyeFilter = PoseFilter::create(trackerOptions);
+		std::unique_ptr<PoseFilter> indexFilter = PoseFilter::create(trackerOptions);
+		std::unique_ptr<PoseFilter> middleFilter = PoseFilter::create(trackerOptions);
+		// Photon time is the start of the frame plus how long frames take to get through the swap (measured) plus
+		// however long the display takes to show a swapped frame (not measurable from here)
+		auto displayLatency = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(trackerOptions.value("displayLatencyMs", 8.0f)));
+		std::chrono::steady_clock::duration frameToSwap{0};
 		while (!trackerPtr->isReady())
 		{
 			std::cout << "Waiting for tracker" << std::endl;
 			std::this_thread::sleep_for(std::chrono::milliseconds(100));
 		}
+		auto renderBusyStartTime = std::chrono::steady_clock::now();
 		while (!glfwWindowShouldClose(window))
 		{
 			// Measure speed
@@ -121,6 +159,8 @@ extern "C"
 
 			// Start timing the render loop
 			auto renderStartTime = std::chrono::high_resolution_clock::now();
+			auto frameStart = std::chrono::steady_clock::now();
+			auto photonTime = frameStart + frameToSwap + displayLatency;
 
 			if ((currentTimeInMilliseconds - startTimeInMilliseconds) > timeout*1000)
 			{
@@ -128,18 +168,35 @@ extern "C"
 				glfwSetWindowShouldClose(window, true);
 			}
 
+			if (nextScheduledProfile < profileSchedule.size() && (currentTimeInMilliseconds - startTimeInMilliseconds) >= profileSchedule[nextScheduledProfile]["at"].get<double>() * 1000)
+			{
+				trackerPtr->requestProfile(profileSchedule[nextScheduledProfile]["profile"].get<std::string>());
+				nextScheduledProfile++;
+			}
+
+			// Only pull from the tracker when it has actually produced a new frame
+			uint64_t frameSequence = trackerPtr->getFrameSequence();
+			bool newTrackingFrame = frameSequence != lastFrameSequence;
+			lastFrameSequence = frameSequence;
+
 			// Check if the eye position has changed
 			if (trackerMode == TRACKER || trackerMode == TRACKER_OFFSET)
 			{
-				std::optional<glm::vec3> leftEyePos = trackerPtr->getLeftEyePos();
-				if (leftEyePos.has_value())
+				if (newTrackingFrame)
 				{
-					nbFrames++;
-					currentEyePos = leftEyePos.value();
+					std::optional<glm::vec3> leftEyePos = trackerPtr->getLeftEyePos();
+					std::optional<Tracker::FrameTimes> faceTimes = trackerPtr->getFaceFrameTimes();
+					if (leftEyePos.has_value() && faceTimes.has_value())
+					{
+						nbFrames++;
+						eyeFilter->update(leftEyePos.value(), faceTimes->arrivalTime);
+					}
 				}
-				else
+				// Every frame, not just new tracking frames, the prediction moves on with the display
+				std::optional<glm::vec3> predictedEyePos = eyeFilter->predict(photonTime);
+				if (predictedEyePos.has_value())
 				{
-					currentEyePos = currentEyePos;
+					currentEyePos = predictedEyePos.value();
 				}
 			}
 			else if (trackerMode == STATIC || trackerMode == STATIC_OFFSET)
@@ -158,21 +215,48 @@ extern "C"
 			}
 
 			renderer->updateEyePos(currentEyePos);
+			if ((trackerMode == TRACKER || trackerMode == TRACKER_OFFSET) && newTrackingFrame)
+			{
+				std::optional<Tracker::FrameTimes> faceTimes = trackerPtr->getFaceFrameTimes();
+				if (faceTimes.has_value())
+				{
+					eyeLatency.submitted(faceTimes->deviceTimestamp, faceTimes->arrivalTime, faceTimes->trackedTime);
+				}
+			}
 
 			if (debug)
 			{
 				// Need to convert this to render with opengl rather than opencv
-				if (!trackerPtr->getColorImage().empty())
+				if (!primaryTracker.getColorImage().empty())
 				{
-					colourCameraSkeleton.updateImage(trackerPtr->getColorImageSkeletons());
+					colourCameraSkeleton.updateImage(primaryTracker.getColorImageSkeletons());
 				}
-				if (!trackerPtr->getDepthImage().empty())
+				if (!primaryTracker.getDepthImage().empty())
 				{
-					depthCameraImportant.updateImage(trackerPtr->getDepthImageImportant());
+					depthCameraImportant.updateImage(primaryTracker.getDepthImageImportant());
 				}
 			}
 
-			hand->updateLandmarks(trackerPtr->getHandLandmarks());
+			if (newTrackingFrame)
+			{
+				std::optional<std::vector<glm::vec3>> fingertips = trackerPtr->getHandLandmarks();
+				std::optional<Tracker::FrameTimes> handTimes = trackerPtr->getHandFrameTimes();
+				if (fingertips.has_value() && handTimes.has_value())
+				{
+					indexFilter->update(fingertips.value()[0], handTimes->arrivalTime);
+					middleFilter->update(fingertips.value()[1], handTimes->arrivalTime);
+				}
+				if (handTimes.has_value())
+				{
+					handLatency.submitted(handTimes->deviceTimestamp, handTimes->arrivalTime, handTimes->trackedTime);
+				}
+			}
+			std::optional<glm::vec3> predictedIndex = indexFilter->predict(photonTime);
+			std::optional<glm::vec3> predictedMiddle = middleFilter->predict(photonTime);
+			if (predictedIndex.has_value() && predictedMiddle.has_value())
+			{
+				hand->updateLandmarks(std::vector<glm::vec3>{predictedIndex.value(), predictedMiddle.value()});
+			}
 			challenge.update();
 
 			processInput(window);
@@ -203,38 +287,65 @@ extern "C"
 				glfwSetWindowShouldClose(window, true);
 			}
 
+			// Waiting on the swap (vsync) is the render thread's idle time
+			auto swapStartTime = std::chrono::steady_clock::now();
+			renderThreadStats.addBusy(swapStartTime - renderBusyStartTime);
 			glfwSwapBuffers(window);
+			renderBusyStartTime = std::chrono::steady_clock::now();
+			// Smoothed over a few frames so one slow frame doesn't throw the next prediction
+			frameToSwap = (frameToSwap * 7 + (renderBusyStartTime - frameStart)) / 8;
+			renderThreadStats.addIdle(renderBusyStartTime - swapStartTime);
+			std::optional<nlohmann::json> eyeFrameLatency = eyeLatency.swapped();
+			std::optional<nlohmann::json> handFrameLatency = handLatency.swapped();
 			glfwPollEvents();
 
 			// Calculate the time spent in the render loop
 			nlohmann::json render;
+			if (eyeFrameLatency.has_value())
+			{
+				render["eyeLatency"] = eyeFrameLatency.value();
+			}
+			if (handFrameLatency.has_value())
+			{
+				render["handLatency"] = handFrameLatency.value();
+			}
 			auto renderEndTime = std::chrono::high_resolution_clock::now();
 			auto renderDuration = std::chrono::duration_cast<std::chrono::milliseconds>(renderEndTime - renderStartTime).count();
 			render["renderTime"] = renderDuration;
+			render["predictionTargetMs"] = std::chrono::duration<double, std::milli>(photonTime - frameStart).count();
 			render["time"] = currentTimeInMilliseconds;
 
 			// Save the render loop time in the JSON object
 			jsonOutput["renderLogs"].push_back(render);
 		}
-		trackerThread.join();
-		captureThread.join();
+		for (std::thread &thread : trackerThreads)
+		{
+			thread.join();
+		}
+		trackerPtr->close();
 
 		if (debug)
 		{
-			colourCamera.updateImage(trackerPtr->getColorImage());
-			colourCameraSkeleton.updateImage(trackerPtr->getColorImageSkeletons());
-			colourCameraSkeletonFace.updateImage(trackerPtr->getColorImageSkeletonFace());
-			colourCameraSkeletonHand.updateImage(trackerPtr->getColorImageSkeletonHand());
+			colourCamera.updateImage(primaryTracker.getColorImage());
+			colourCameraSkeleton.updateImage(primaryTracker.getColorImageSkeletons());
+			colourCameraSkeletonFace.updateImage(primaryTracker.getColorImageSkeletonFace());
+			colourCameraSkeletonHand.updateImage(primaryTracker.getColorImageSkeletonHand());
 
-			colourCameraImportant.updateImage(trackerPtr->getColorImageImportant());
-			depthCamera.updateImage(trackerPtr->getDepthImage());
-			depthCameraImportant.updateImage(trackerPtr->getDepthImageImportant());
+			colourCameraImportant.updateImage(primaryTracker.getColorImageImportant());
+			depthCamera.updateImage(primaryTracker.getDepthImage());
+			depthCameraImportant.updateImage(primaryTracker.getDepthImageImportant());
 
-			saveDebugInfo(*trackerPtr, colourCamera, colourCameraSkeleton, colourCameraSkeletonFace, colourCameraSkeletonHand, colourCameraImportant, depthCamera, depthCameraImportant, *hand);
+			saveDebugInfo(primaryTracker, colourCamera, colourCameraSkeleton, colourCameraSkeletonFace, colourCameraSkeletonHand, colourCameraImportant, depthCamera, depthCameraImportant, *hand);
 		}
 
 		jsonOutput["results"] = challenge.returnJson();
 		jsonOutput["trackerLogs"] = trackerPtr->returnJson();
+		jsonOutput["trackerLogs"]["threads"]["render"] = renderThreadStats.returnJson();
+		jsonOutput["latency"]["eye"] = eyeLatency.returnJson();
+		jsonOutput["latency"]["hand"] = handLatency.returnJson();
+		jsonOutput["poseFilter"]["eye"] = eyeFilter->returnJson();
+		jsonOutput["poseFilter"]["index"] = indexFilter->returnJson();
+		jsonOutput["poseFilter"]["middle"] = middleFilter->returnJson();
 		jsonOutput["finished"] = challenge.isFinished();
 
 		outputString = jsonOutput.dump();
@@ -484,8 +595,12 @@ void debugInitPrint()
 	std::cout << "DLIB_HAVE_AVX on" << std::endl;
 #endif
 
+#ifndef VOLSIM_NO_CUDA
 	int num_devices = cv::cuda::getCudaEnabledDeviceCount();
 	std::cout << "Number of OpenCV CUDA devices detected: " << num_devices << std::endl;
+#else
+	std::cout << "Built without CUDA" << std::endl;
+#endif
 
 	if (geteuid() != 0)
 	{
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "pinch.hpp"
+
+// The nearest point is found on a grid this coarse, same as HandRoi
+static const int CELL = 8;
+// Rough length of an open hand and width of a finger, in mm
+static const float HAND_SIZE = 200.0f;
+static const float FINGER_WIDTH = 18.0f;
+// How far along the outline either side of a corner is looked at, past the round end of two fingers held together
+static const float TIP_REACH = 45.0f;
+// Corners sharper than this are fingertips, knuckles and the heel of the hand are blunter
+static const float MAX_TIP_ANGLE = 60.0f;
+// How wide the outline is TIP_REACH back from a lone tip, in finger widths, for it to be two fingers held together
+// (one finger is about 1)
+static const float MIN_TOGETHER_WIDTH = 1.5f;
+static const float MAX_TOGETHER_WIDTH = 2.6f;
+
+PinchDetector::PinchDetector(const nlohmann::json &options)
+{
+	// The same range as HandRoi's depth crops (mm)
+	minDepth = options.value("handMinDepth", 200.0f);
+	maxDepth = options.value("handMaxDepth", 800.0f);
+	depthBand = options.value("handDepthBand", 150.0f);
+	// Frames between checks by the hand graph once trusted
+	validateEvery = std::max(1, options.value("pinchValidateEvery", 10));
+	// Furthest the graph's fingertips can be from these and still agree (cm)
+	maxError = options.value("pinchMaxErrorCm", 3.0f);
+}
+
+bool PinchDetector::detect(k4a_image_t depth, float fx, Tips &tips)
+{
+	auto start = std::chrono::steady_clock::now();
+	frames++;
+	if (depth == NULL)
+	{
+		return false;
+	}
+	int width = k4a_image_get_width_pixels(depth);
+	int height = k4a_image_get_height_pixels(depth);
+	int stride = k4a_image_get_stride_bytes(depth);
+	const uint8_t *buffer = k4a_image_get_buffer(depth);
+
+	// Nearest thing in range, one sample per cell
+	float nearest = maxDepth + 1.0f;
+	cv::Point seed;
+	for (int y = CELL / 2; y < height; y += CELL)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)y * stride);
+		for (int x = CELL / 2; x < width; x += CELL)
+		{
+			float z = (float)row[x];
+			if (z >= minDepth && z < nearest)
+			{
+				nearest = z;
+				seed = cv::Point(x, y);
+			}
+		}
+	}
+	if (nearest > maxDepth)
+	{
+		detectCost.add(std::chrono::steady_clock::now() - start);
+		return false;
+	}
+
+	// Only the part of the image the hand can be in is outlined, at full resolution
+	float hand = fx * HAND_SIZE / nearest;
+	float finger = fx * FINGER_WIDTH / nearest;
+	cv::Rect roi = cv::Rect((int)(seed.x - hand), (int)(seed.y - hand), (int)(2.0f * hand), (int)(2.0f * hand)) & cv::Rect(0, 0, width, height);
+	mask.create(roi.height, roi.width, CV_8U);
+	float farthest = nearest + depthBand;
+	for (int y = 0; y < roi.height; y++)
+	{
+		const uint16_t *row = (const uint16_t *)(buffer + (size_t)(roi.y + y) * stride) + roi.x;
+		uint8_t *maskRow = mask.ptr<uint8_t>(y);
+		for (int x = 0; x < roi.width; x++)
+		{
+			float z = (float)row[x];
+			maskRow[x] = (z >= minDepth && z <= farthest) ? 255 : 0;
+		}
+	}
+	// Flying pixels along the edges of the fingers would make sharp corners of their own
+	cv::morphologyEx(mask, mask, cv::MORPH_OPEN, cv::Mat());
+	cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+
+	// The biggest piece is the hand (and arm)
+	int largest = -1;
+	double largestArea = finger * finger * 4.0f;
+	for (size_t i = 0; i < contours.size(); i++)
+	{
+		double area = cv::contourArea(contours[i]);
+		if (area >= largestArea)
+		{
+			largest = (int)i;
+			largestArea = area;
+		}
+	}
+	int reach = std::max(3, (int)(fx * TIP_REACH / nearest));
+	if (largest < 0 || (int)contours[largest].size() <= 2 * reach)
+	{
+		detectCost.add(std::chrono::steady_clock::now() - start);
+		return false;
+	}
+	const std::vector<cv::Point> &contour = contours[largest];
+	int n = (int)contour.size();
+
+	// Fingertips are corners of the convex hull that come to a point
+	cv::convexHull(contour, hull, false, false);
+	float minCos = std::cos(MAX_TIP_ANGLE * (float)CV_PI / 180.0f);
+	candidates.clear();
+	for (int index : hull)
+	{
+		cv::Point p = contour[index];
+		// At the edge of the crop or the image it's the arm running off, not a finger
+		if (p.x <= 1 || p.y <= 1 || p.x >= roi.width - 2 || p.y >= roi.height - 2)
+		{
+			continue;
+		}
+		cv::Point before = contour[(index - reach + n) % n];
+		cv::Point after = contour[(index + reach) % n];
+		cv::Point2f a = before - p;
+		cv::Point2f b = after - p;
+		float lengths = std::sqrt(a.dot(a) * b.dot(b));
+		if (lengths <= 0.0f || a.dot(b) / lengths < minCos)
+		{
+			continue;
+		}
+
+		// Nearest valid depth in a 3x3 grid around it, the outline itself is on the edge of the finger
+		cv::Point pixel = p + roi.tl();
+		uint16_t z = 0;
+		for (int y = std::max(pixel.y - 1, 0); y <= std::min(pixel.y + 1, height - 1); y++)
+		{
+			const uint16_t *row = (const uint16_t *)(buffer + (size_t)y * stride);
+			for (int x = std::max(pixel.x - 1, 0); x <= std::min(pixel.x + 1, width - 1); x++)
+			{
+				if (row[x] >= minDepth && row[x] <= farthest && (z == 0 || row[x] < z))
+				{
+					z = row[x];
+				}
+			}
+		}
+		if (z == 0)
+		{
+			continue;
+		}
+
+		// How wide the finger (or fingers) is a reach back from the tip
+		cv::Point across = after - before;
+		float width = std::sqrt((float)across.dot(across)) / finger;
+
+		// Hull corners crowd around a round tip, keep the nearest one per finger
+		bool merged = false;
+		for (auto &candidate : candidates)
+		{
+			cv::Point d = candidate.pixel - pixel;
+			if (d.dot(d) < finger * finger)
+			{
+				if (z < candidate.depth)
+				{
+					candidate = {z, pixel, width};
+				}
+				merged = true;
+				break;
+			}
+		}
+		if (!merged)
+		{
+			candidates.push_back({z, pixel, width});
+		}
+	}
+	if (candidates.empty())
+	{
+		detectCost.add(std::chrono::steady_clock::now() - start);
+		return false;
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+			  { return a.depth < b.depth; });
+	// A lone tip is two fingers held together (a closed pinch) if it's about two fingers wide, and both tips are it.
+	// One finger wide is a single pointing finger, which isn't a pinch at all, so that's left to the hand graph.
+	int second = 1;
+	if (candidates.size() < 2)
+	{
+		if (candidates[0].width < MIN_TOGETHER_WIDTH || candidates[0].width > MAX_TOGETHER_WIDTH)
+		{
+			detectCost.add(std::chrono::steady_clock::now() - start);
+			return false;
+		}
+		second = 0;
+		together++;
+	}
+	tips.points[0] = candidates[0].pixel;
+	tips.depths[0] = candidates[0].depth;
+	tips.points[1] = candidates[second].pixel;
+	tips.depths[1] = candidates[second].depth;
+	found++;
+	detectCost.add(std::chrono::steady_clock::now() - start);
+	return true;
+}
+
+bool PinchDetector::shouldValidate(bool detected)
+{
+	if (!detected || !trusted || ++unvalidated >= validateEvery)
+	{
+		unvalidated = 0;
+		return true;
+	}
+	fastFrames++;
+	return false;
+}
+
+void PinchDetector::validate(const std::optional<std::array<glm::vec3, 2>> &depthTips, const std::optional<std::array<glm::vec3, 2>> &graphTips)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!depthTips.has_value() && !graphTips.has_value())
+	{
+		return;
+	}
+	validations++;
+	if (!depthTips.has_value())
+	{
+		// Nothing to trust or distrust, the graph was running on this frame anyway
+		depthMissed++;
+		return;
+	}
+	if (!graphTips.has_value())
+	{
+		// Something in range that isn't a hand
+		graphMissed++;
+		disagreed++;
+		trusted = false;
+		return;
+	}
+
+	// Depth can't tell index from middle, pair them up whichever way fits best
+	const std::array<glm::vec3, 2> &d = depthTips.value();
+	const std::array<glm::vec3, 2> &g = graphTips.value();
+	float error = std::min(std::max(glm::distance(d[0], g[0]), glm::distance(d[1], g[1])),
+						   std::max(glm::distance(d[0], g[1]), glm::distance(d[1], g[0])));
+	errorSum += error;
+	worstError = std::max(worstError, error);
+	if (error <= maxError)
+	{
+		agreed++;
+		trusted = true;
+	}
+	else
+	{
+		disagreed++;
+		trusted = false;
+	}
+}
+
+bool PinchDetector::isTrusted() const
+{
+	return trusted;
+}
+
+nlohmann::json PinchDetector::returnJson()
+{
+	nlohmann::json pinchLog;
+	pinchLog["frames"] = frames;
+	pinchLog["found"] = found;
+	// Found as two fingers held together
+	pinchLog["together"] = together;
+	// Frames the hand graph was skipped for
+	pinchLog["fastFrames"] = fastFrames;
+	pinchLog["detectCost"] = detectCost.returnJson();
+	std::lock_guard<std::mutex> lock(mutex);
+	pinchLog["trusted"] = trusted.load();
+	pinchLog["validations"] = validations;
+	pinchLog["agreed"] = agreed;
+	pinchLog["disagreed"] = disagreed;
+	pinchLog["depthMissed"] = depthMissed;
+	pinchLog["graphMissed"] = graphMissed;
+	uint64_t compared = agreed + disagreed - graphMissed;
+	pinchLog["meanErrorCm"] = compared > 0 ? errorSum / compared : 0.0;
+	pinchLog["maxErrorCm"] = worstError;
+	return pinchLog;
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <exception>
+
+#include "posefilter.hpp"
+
+class PoseFilterException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit PoseFilterException(const std::string &msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class UnknownPoseFilterException : public PoseFilterException
+{
+public:
+	explicit UnknownPoseFilterException(const std::string &name) : PoseFilterException("No pose filter called " + name) {}
+};
+
+PoseFilter::PoseFilter(const nlohmann::json &options)
+{
+	maxPrediction = std::chrono::duration<float, std::milli>(options.value("maxPredictionMs", 100.0f));
+	maxGap = std::chrono::duration<float, std::milli>(options.value("maxGapMs", 500.0f));
+	// Until the time between measurements has been seen, assume the camera's 30fps
+	interval = std::chrono::duration<float, std::milli>(options.value("expectedIntervalMs", 1000.0f / 30.0f));
+}
+
+std::unique_ptr<PoseFilter> PoseFilter::create(const nlohmann::json &options)
+{
+	std::string name = options.value("poseFilter", "oneEuro");
+	if (name == "oneEuro")
+	{
+		return std::make_unique<OneEuroFilter>(options);
+	}
+	if (name == "kalman")
+	{
+		return std::make_unique<KalmanFilter>(options);
+	}
+	if (name == "none")
+	{
+		return std::make_unique<PassthroughFilter>(options);
+	}
+	throw UnknownPoseFilterException(name);
+}
+
+void PoseFilter::update(glm::vec3 measurement, std::chrono::steady_clock::time_point time)
+{
+	if (lastTime.has_value() && time <= lastTime.value())
+	{
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (!lastTime.has_value() || time - lastTime.value() > maxGap)
+	{
+		reset(measurement);
+		resets++;
+	}
+	else
+	{
+		correct(measurement, std::chrono::duration<float>(time - lastTime.value()).count());
+		// How often measurements turn up here, smoothed over about ten of them
+		interval += 0.1f * (std::chrono::duration<float>(now - lastReceived) - interval);
+	}
+	lastTime = time;
+	lastReceived = now;
+	updates++;
+}
+
+std::optional<glm::vec3> PoseFilter::predict(std::chrono::steady_clock::time_point time)
+{
+	if (!lastTime.has_value())
+	{
+		return {};
+	}
+	// The next measurement is overdue (with half a frame for jitter), tracking has most likely lost the point.
+	// Hold where it was last seen instead of carrying it off along its last velocity.
+	if (std::chrono::steady_clock::now() - lastReceived > 1.5f * interval)
+	{
+		stalePredictions++;
+		return extrapolate(0.0f);
+	}
+	float horizon = std::clamp(std::chrono::duration<float>(time - lastTime.value()).count(), 0.0f, maxPrediction.count());
+	predictions++;
+	horizonSumMs += horizon * 1000.0;
+	return extrapolate(horizon);
+}
+
+nlohmann::json PoseFilter::returnJson() const
+{
+	nlohmann::json filterLog;
+	filterLog["filter"] = getName();
+	filterLog["updates"] = updates;
+	filterLog["resets"] = resets;
+	filterLog["predictions"] = predictions;
+	filterLog["meanHorizonMs"] = predictions > 0 ? horizonSumMs / predictions : 0.0;
+	filterLog["maxPredictionMs"] = maxPrediction.count() * 1000.0f;
+	filterLog["stalePredictions"] = stalePredictions;
+	filterLog["meanIntervalMs"] = interval.count() * 1000.0f;
+	return filterLog;
+}
+
+OneEuroFilter::OneEuroFilter(const nlohmann::json &options) : PoseFilter(options)
+{
+	// Hz, and Hz per cm/s of speed
+	minCutoff = options.value("oneEuroMinCutoff", 1.0f);
+	beta = options.value("oneEuroBeta", 0.05f);
+	derivativeCutoff = options.value("oneEuroDerivativeCutoff", 1.0f);
+}
+
+std::string OneEuroFilter::getName() const
+{
+	return "oneEuro";
+}
+
+float OneEuroFilter::alpha(float cutoff, float dt)
+{
+	float tau = 1.0f / (2.0f * (float)M_PI * cutoff);
+	return 1.0f / (1.0f + tau / dt);
+}
+
+void OneEuroFilter::reset(glm::vec3 measurement)
+{
+	position = measurement;
+	velocity = glm::vec3(0.0f);
+}
+
+void OneEuroFilter::correct(glm::vec3 measurement, float dt)
+{
+	glm::vec3 rawVelocity = (measurement - position) / dt;
+	velocity = glm::mix(velocity, rawVelocity, alpha(derivativeCutoff, dt));
+	float cutoff = minCutoff + beta * glm::length(velocity);
+	position = glm::mix(position, measurement, alpha(cutoff, dt));
+}
+
+glm::vec3 OneEuroFilter::extrapolate(float horizon) const
+{
+	return position + velocity * horizon;
+}
+
+KalmanFilter::KalmanFilter(const nlohmann::json &options) : PoseFilter(options)
+{
+	processNoise = options.value("kalmanProcessNoise", 200.0f);
+	measurementNoise = options.value("kalmanMeasurementNoise", 0.25f);
+}
+
+std::string KalmanFilter::getName() const
+{
+	return "kalman";
+}
+
+void KalmanFilter::reset(glm::vec3 measurement)
+{
+	position = measurement;
+	velocity = glm::vec3(0.0f);
+	// Position as good as one measurement, velocity unknown
+	p00 = measurementNoise;
+	p01 = 0.0f;
+	p11 = 1.0e4f;
+}
+
+void KalmanFilter::correct(glm::vec3 measurement, float dt)
+{
+	// Predict: x = F x, P = F P F^T + Q for F = [1 dt; 0 1] and white noise acceleration
+	position += velocity * dt;
+	float dt2 = dt * dt;
+	float n00 = p00 + 2.0f * dt * p01 + dt2 * p11 + processNoise * dt2 * dt / 3.0f;
+	float n01 = p01 + dt * p11 + processNoise * dt2 / 2.0f;
+	float n11 = p11 + processNoise * dt;
+
+	// Update with a position measurement, H = [1 0]
+	float s = n00 + measurementNoise;
+	float k0 = n00 / s;
+	float k1 = n01 / s;
+	glm::vec3 innovation = measurement - position;
+	position += k0 * innovation;
+	velocity += k1 * innovation;
+	p00 = (1.0f - k0) * n00;
+	p01 = (1.0f - k0) * n01;
+	p11 = n11 - k1 * n01;
+}
+
+glm::vec3 KalmanFilter::extrapolate(float horizon) const
+{
+	return position + velocity * horizon;
+}
+
+PassthroughFilter::PassthroughFilter(const nlohmann::json &options) : PoseFilter(options)
+{
+}
+
+std::string PassthroughFilter::getName() const
+{
+	return "none";
+}
+
+void PassthroughFilter::reset(glm::vec3 measurement)
+{
+	position = measurement;
+}
+
+void PassthroughFilter::correct(glm::vec3 measurement, float dt)
+{
+	position = measurement;
+}
+
+glm::vec3 PassthroughFilter::extrapolate(float horizon) const
+{
+	return position;
+}
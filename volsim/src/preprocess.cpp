@@ -0,0 +1,195 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "preprocess.hpp"
+
+// Plain version for whatever the vector loops leave at the end of a row
+template <bool RGB>
+static inline void averageScalar(const uint8_t *row0, const uint8_t *row1, uint8_t *dst)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		int in = RGB ? 2 - c : c;
+		dst[c] = (uint8_t)((row0[in] + row0[in + 4] + row1[in] + row1[in + 4] + 2) >> 2);
+	}
+}
+
+#if defined(__AVX2__)
+// 8 source pixels from each of two rows to 4 averaged BGRA pixels held as 16 bit lanes, in order
+static inline __m256i average2x2(const uint8_t *row0, const uint8_t *row1)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i a = _mm256_loadu_si256((const __m256i *)row0);
+	__m256i b = _mm256_loadu_si256((const __m256i *)row1);
+	// Widen and add the rows, each 128 bit lane holds pixels (0,1) in lo and (2,3) in hi
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+	// Add each even pixel to its odd neighbour
+	lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+	hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+	__m256i sum = _mm256_unpacklo_epi64(lo, hi);
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}
+#elif defined(__SSSE3__)
+// 4 source pixels from each of two rows to 2 averaged BGRA pixels held as 16 bit lanes
+static inline __m128i average2x2(const uint8_t *row0, const uint8_t *row1)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_loadu_si128((const __m128i *)row0);
+	__m128i b = _mm_loadu_si128((const __m128i *)row1);
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+	__m128i sum = _mm_unpacklo_epi64(lo, hi);
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+#endif
+
+template <bool RGB>
+static void halfScaleBgra(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride)
+{
+	int outWidth = width / 2;
+	int outHeight = height / 2;
+
+	for (int y = 0; y < outHeight; y++)
+	{
+		const uint8_t *row0 = src + (size_t)(2 * y) * srcStride;
+		const uint8_t *row1 = row0 + srcStride;
+		uint8_t *out = dst + (size_t)y * dstStride;
+		int x = 0;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+		// Drops alpha (and swaps red and blue for RGB), packing 4 pixels into the low 12 bytes
+		const __m128i dropAlpha = RGB ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+									  : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		// 8 output pixels a step, each step writes 4 bytes past its 24 so leave room for that
+		for (; x + 10 <= outWidth; x += 8)
+		{
+			const uint8_t *in0 = row0 + x * 8;
+			const uint8_t *in1 = row1 + x * 8;
+#if defined(__AVX2__)
+			__m256i packed = _mm256_packus_epi16(average2x2(in0, in1), average2x2(in0 + 32, in1 + 32));
+			// packus interleaves the 128 bit lanes, put the pixels back in order
+			packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i first = _mm256_castsi256_si128(packed);
+			__m128i second = _mm256_extracti128_si256(packed, 1);
+#else
+			__m128i first = _mm_packus_epi16(average2x2(in0, in1), average2x2(in0 + 16, in1 + 16));
+			__m128i second = _mm_packus_epi16(average2x2(in0 + 32, in1 + 32), average2x2(in0 + 48, in1 + 48));
+#endif
+			_mm_storeu_si128((__m128i *)(out + x * 3), _mm_shuffle_epi8(first, dropAlpha));
+			_mm_storeu_si128((__m128i *)(out + x * 3 + 12), _mm_shuffle_epi8(second, dropAlpha));
+		}
+#endif
+
+		for (; x < outWidth; x++)
+		{
+			averageScalar<RGB>(row0 + x * 8, row1 + x * 8, out + x * 3);
+		}
+	}
+}
+
+void halfScaleBgraToBgr(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride)
+{
+	halfScaleBgra<false>(src, srcStride, width, height, dst, dstStride);
+}
+
+void halfScaleBgraToRgb(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride)
+{
+	halfScaleBgra<true>(src, srcStride, width, height, dst, dstStride);
+}
+
+void halfScaleBgraToBgr(const cv::Mat &bgra, cv::Mat &bgr)
+{
+	CV_Assert(bgra.type() == CV_8UC4);
+	bgr.create(bgra.rows / 2, bgra.cols / 2, CV_8UC3);
+	halfScaleBgraToBgr(bgra.data, (int)bgra.step, bgra.cols, bgra.rows, bgr.data, (int)bgr.step);
+}
+
+void halfScaleBgraToRgb(const cv::Mat &bgra, cv::Mat &rgb)
+{
+	CV_Assert(bgra.type() == CV_8UC4);
+	rgb.create(bgra.rows / 2, bgra.cols / 2, CV_8UC3);
+	halfScaleBgraToRgb(bgra.data, (int)bgra.step, bgra.cols, bgra.rows, rgb.data, (int)rgb.step);
+}
+
+uint16_t irWhitePoint(const uint16_t *src, int srcStride, int width, int height)
+{
+	// A sparse sample is plenty to find the bright end
+	static const int STEP = 8;
+	// Counted into 1024 coarse bins, then the one bin the percentile falls in is counted again value by value, so
+	// the result is exact without anything allocated per frame
+	static const int SHIFT = 6;
+	static const int FINE_BINS = 1 << SHIFT;
+	uint32_t coarse[1 << (16 - SHIFT)] = {};
+	size_t count = 0;
+	for (int y = 0; y < height; y += STEP)
+	{
+		const uint16_t *row = (const uint16_t *)((const uint8_t *)src + (size_t)y * srcStride);
+		for (int x = 0; x < width; x += STEP)
+		{
+			coarse[row[x] >> SHIFT]++;
+			count++;
+		}
+	}
+	if (count == 0)
+	{
+		return 1;
+	}
+
+	// 99th percentile, so a few specular highlights or the emitter's reflection don't darken everything else
+	size_t rank = (count * 99) / 100;
+	int bin = 0;
+	size_t below = 0;
+	while (below + coarse[bin] <= rank)
+	{
+		below += coarse[bin++];
+	}
+	uint32_t fine[FINE_BINS] = {};
+	for (int y = 0; y < height; y += STEP)
+	{
+		const uint16_t *row = (const uint16_t *)((const uint8_t *)src + (size_t)y * srcStride);
+		for (int x = 0; x < width; x += STEP)
+		{
+			if ((row[x] >> SHIFT) == bin)
+			{
+				fine[row[x] & (FINE_BINS - 1)]++;
+			}
+		}
+	}
+	int offset = 0;
+	while (below + fine[offset] <= rank)
+	{
+		below += fine[offset++];
+	}
+	return std::max<uint16_t>((uint16_t)((bin << SHIFT) | offset), 1);
+}
+
+void irToRgb(const uint16_t *src, int srcStride, int width, int height, uint16_t white, uint8_t *dst, int dstStride)
+{
+	// 16.16 fixed point gain taking white to 255
+	white = std::max<uint16_t>(white, 1);
+	uint32_t gain = ((255u << 16) + white - 1) / white;
+	for (int y = 0; y < height; y++)
+	{
+		const uint16_t *row = (const uint16_t *)((const uint8_t *)src + (size_t)y * srcStride);
+		uint8_t *out = dst + (size_t)y * dstStride;
+		for (int x = 0; x < width; x++)
+		{
+			// Clamping first keeps the product inside 32 bits
+			uint32_t value = (std::min(row[x], white) * gain) >> 16;
+			out[3 * x] = (uint8_t)value;
+			out[3 * x + 1] = (uint8_t)value;
+			out[3 * x + 2] = (uint8_t)value;
+		}
+	}
+}
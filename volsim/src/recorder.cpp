@@ -0,0 +1,165 @@
+#include <k4a/k4a.h>
+#include <k4arecord/record.h>
+#include <iostream>
+#include <exception>
+#include <chrono>
+#include <mutex>
+
+#include "recorder.hpp"
+
+class RecorderException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit RecorderException(const char *msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class FailedToCreateRecordingException : public RecorderException
+{
+public:
+	FailedToCreateRecordingException() : RecorderException("Cannot create the session recording") {}
+};
+
+SessionRecorder::SessionRecorder(const std::string &path, k4a_device_configuration_t config, const std::vector<uint8_t> &rawCalibration, size_t queueSize) : queue(queueSize)
+{
+	this->path = path;
+
+	if (K4A_FAILED(k4a_record_create(path.c_str(), NULL, config, &recording)))
+	{
+		throw FailedToCreateRecordingException();
+	}
+
+	// Stored the same way k4a_record_create does for a device so playback can find it
+	if (rawCalibration.empty())
+	{
+		std::cerr << "[Recorder] No calibration available, " << path << " will not be replayable" << std::endl;
+	}
+	else
+	{
+		k4a_record_add_attachment(recording, "calibration.json", rawCalibration.data(), rawCalibration.size());
+	}
+
+	if (K4A_FAILED(k4a_record_write_header(recording)))
+	{
+		k4a_record_close(recording);
+		throw FailedToCreateRecordingException();
+	}
+
+	running = true;
+	writer = std::thread(&SessionRecorder::writeLoop, this);
+}
+
+void SessionRecorder::push(k4a_capture_t capture)
+{
+	// The queue holds its own reference so the tracker can release the capture whenever it likes
+	k4a_capture_reference(capture);
+	if (!queue.tryPush(capture))
+	{
+		k4a_capture_release(capture);
+		framesDropped++;
+		return;
+	}
+	framesQueued++;
+
+	size_t depth = queue.size();
+	if (depth > maxQueueDepth)
+	{
+		maxQueueDepth = depth;
+	}
+
+	// Only pay for the wakeup when the writer is actually asleep, same as LatestMailbox. The fence keeps the push
+	// from being reordered after the check, so either the writer sees the capture or we see it waiting.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting.load(std::memory_order_seq_cst))
+	{
+		{
+			std::lock_guard<std::mutex> lock(waitMutex);
+		}
+		waitCondition.notify_one();
+	}
+}
+
+void SessionRecorder::writeLoop()
+{
+	k4a_capture_t capture;
+	while (true)
+	{
+		if (!queue.tryPop(capture))
+		{
+			if (!running)
+			{
+				break;
+			}
+			// Sleep until the capture thread pushes or close is called
+			std::unique_lock<std::mutex> lock(waitMutex);
+			waiting.store(true, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			waitCondition.wait(lock, [this]
+							   { return queue.size() > 0 || !running; });
+			waiting.store(false, std::memory_order_relaxed);
+			continue;
+		}
+
+		if (K4A_FAILED(k4a_record_write_capture(recording, capture)))
+		{
+			writeErrors++;
+		}
+		else
+		{
+			uint64_t bytes = 0;
+			for (k4a_image_t image : {k4a_capture_get_color_image(capture), k4a_capture_get_depth_image(capture), k4a_capture_get_ir_image(capture)})
+			{
+				if (image != NULL)
+				{
+					bytes += k4a_image_get_size(image);
+					k4a_image_release(image);
+				}
+			}
+			bytesWritten += bytes;
+			framesWritten++;
+		}
+		k4a_capture_release(capture);
+	}
+}
+
+void SessionRecorder::close()
+{
+	if (!running)
+	{
+		return;
+	}
+	// The writer drains whatever is still queued before it exits
+	{
+		std::lock_guard<std::mutex> lock(waitMutex);
+		running = false;
+	}
+	waitCondition.notify_one();
+	writer.join();
+	k4a_record_flush(recording);
+	k4a_record_close(recording);
+}
+
+nlohmann::json SessionRecorder::returnJson()
+{
+	nlohmann::json recorderLog;
+	recorderLog["path"] = path;
+	recorderLog["framesQueued"] = framesQueued.load();
+	recorderLog["framesWritten"] = framesWritten.load();
+	recorderLog["framesDropped"] = framesDropped.load();
+	recorderLog["writeErrors"] = writeErrors.load();
+	recorderLog["bytesWritten"] = bytesWritten.load();
+	recorderLog["maxQueueDepth"] = maxQueueDepth.load();
+	return recorderLog;
+}
+
+SessionRecorder::~SessionRecorder()
+{
+	close();
+}
@@ -0,0 +1,238 @@
+#include <iostream>
+#include <array>
+#include <chrono>
+
+#include "rig.hpp"
+#include "capturesource.hpp"
+
+// Cameras aren't necessarily hardware synced, results further apart than this aren't of the same moment
+static const std::chrono::milliseconds MAX_FUSION_SKEW(50);
+
+TrackerRig::TrackerRig(std::vector<std::unique_ptr<Tracker>> trackers)
+{
+	this->trackers = std::move(trackers);
+}
+
+std::unique_ptr<TrackerRig> TrackerRig::create(const nlohmann::json &options, glm::vec3 primaryOffset, glm::vec3 primaryRotation, bool debug)
+{
+	std::vector<std::unique_ptr<Tracker>> trackers;
+	trackers.push_back(std::make_unique<Tracker>(CaptureSource::create(options), primaryOffset, primaryRotation, debug, options));
+
+	// Extra cameras track the same way as the primary, so they start from its options and override what differs.
+	// Each records to its own file if it records at all, two recorders can't share one
+	nlohmann::json sharedOptions = options;
+	sharedOptions.erase("cameras");
+	sharedOptions.erase("record");
+
+	for (const nlohmann::json &cameraPatch : options.value("cameras", nlohmann::json::array()))
+	{
+		nlohmann::json cameraOptions = sharedOptions;
+		cameraOptions.merge_patch(cameraPatch);
+		std::array<float, 3> position = cameraOptions.value("position", std::array<float, 3>{0.0f, 0.0f, 0.0f});
+		std::array<float, 3> rotation = cameraOptions.value("rotation", std::array<float, 3>{0.0f, 0.0f, 0.0f});
+		// Debug images only come from the primary camera, no point drawing them for the rest
+		trackers.push_back(std::make_unique<Tracker>(CaptureSource::create(cameraOptions),
+													 glm::vec3(position[0], position[1], position[2]),
+													 glm::vec3(rotation[0], rotation[1], rotation[2]),
+													 false, cameraOptions));
+	}
+	return std::make_unique<TrackerRig>(std::move(trackers));
+}
+
+size_t TrackerRig::size()
+{
+	return trackers.size();
+}
+
+Tracker &TrackerRig::getTracker(size_t index)
+{
+	return *trackers[index];
+}
+
+Tracker &TrackerRig::getPrimary()
+{
+	return *trackers[0];
+}
+
+uint64_t TrackerRig::getFrameSequence()
+{
+	uint64_t sequence = 0;
+	for (auto &tracker : trackers)
+	{
+		sequence += tracker->getFrameSequence();
+	}
+	return sequence;
+}
+
+std::optional<glm::vec3> TrackerRig::getLeftEyePos()
+{
+	if (trackers.size() == 1)
+	{
+		return trackers[0]->getLeftEyePos();
+	}
+
+	std::vector<std::optional<Tracker::Estimate>> estimates;
+	for (auto &tracker : trackers)
+	{
+		estimates.push_back(tracker->getEyeEstimate());
+	}
+	eye = fuse(estimates, "eye");
+	if (!eye.has_value())
+	{
+		return {};
+	}
+	return eye->points[0];
+}
+
+std::optional<std::vector<glm::vec3>> TrackerRig::getHandLandmarks()
+{
+	if (trackers.size() == 1)
+	{
+		return trackers[0]->getHandLandmarks();
+	}
+
+	std::vector<std::optional<Tracker::Estimate>> estimates;
+	for (auto &tracker : trackers)
+	{
+		estimates.push_back(tracker->getHandEstimate());
+	}
+	hand = fuse(estimates, "hand");
+	if (!hand.has_value())
+	{
+		return {};
+	}
+	return hand->points;
+}
+
+std::optional<Tracker::FrameTimes> TrackerRig::getFaceFrameTimes()
+{
+	if (trackers.size() == 1)
+	{
+		return trackers[0]->getFaceFrameTimes();
+	}
+	if (!eye.has_value())
+	{
+		return {};
+	}
+	return eye->times;
+}
+
+std::optional<Tracker::FrameTimes> TrackerRig::getHandFrameTimes()
+{
+	if (trackers.size() == 1)
+	{
+		return trackers[0]->getHandFrameTimes();
+	}
+	if (!hand.has_value())
+	{
+		return {};
+	}
+	return hand->times;
+}
+
+std::optional<Tracker::Estimate> TrackerRig::fuse(const std::vector<std::optional<Tracker::Estimate>> &estimates, const char *logKey)
+{
+	// Only results from around the same moment as the newest one are worth averaging
+	std::optional<Tracker::FrameTimes> newest;
+	for (const auto &estimate : estimates)
+	{
+		if (estimate.has_value() && (!newest.has_value() || estimate->times.arrivalTime > newest->arrivalTime))
+		{
+			newest = estimate->times;
+		}
+	}
+	if (!newest.has_value())
+	{
+		return {};
+	}
+
+	float totalConfidence = 0.0f;
+	size_t used = 0;
+	std::vector<bool> current(estimates.size(), false);
+	for (size_t i = 0; i < estimates.size(); i++)
+	{
+		if (estimates[i].has_value() && newest->arrivalTime - estimates[i]->times.arrivalTime <= MAX_FUSION_SKEW)
+		{
+			current[i] = true;
+			totalConfidence += estimates[i]->confidence;
+			used++;
+		}
+	}
+
+	Tracker::Estimate fused;
+	fused.times = newest.value();
+	fused.confidence = totalConfidence;
+	nlohmann::json weights = nlohmann::json::array();
+	for (size_t i = 0; i < estimates.size(); i++)
+	{
+		// With nothing to go on (no depth anywhere) fall back to a plain average
+		float weight = 0.0f;
+		if (current[i])
+		{
+			weight = totalConfidence > 0.0f ? estimates[i]->confidence / totalConfidence : 1.0f / used;
+			fused.points.resize(estimates[i]->points.size(), glm::vec3(0.0f));
+			for (size_t j = 0; j < estimates[i]->points.size(); j++)
+			{
+				fused.points[j] += weight * estimates[i]->points[j];
+			}
+		}
+		weights.push_back(weight);
+	}
+
+	auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+								std::chrono::system_clock::now().time_since_epoch())
+								.count();
+	fusionLog[logKey].push_back({{"time", currentTimeInMilliseconds},
+								 {"deviceTime", fused.times.deviceTimestamp},
+								 {"weights", weights},
+								 {"x", fused.points[0].x},
+								 {"y", fused.points[0].y},
+								 {"z", fused.points[0].z}});
+	return fused;
+}
+
+bool TrackerRig::isReady()
+{
+	for (auto &tracker : trackers)
+	{
+		if (!tracker->isReady())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TrackerRig::requestProfile(const std::string &name)
+{
+	bool requested = true;
+	for (auto &tracker : trackers)
+	{
+		requested = tracker->requestProfile(name) && requested;
+	}
+	return requested;
+}
+
+void TrackerRig::close()
+{
+	for (auto &tracker : trackers)
+	{
+		tracker->close();
+	}
+}
+
+nlohmann::json TrackerRig::returnJson()
+{
+	// Keep the single camera log exactly as it was so existing analysis keeps working
+	nlohmann::json rigLog = trackers[0]->returnJson();
+	if (trackers.size() == 1)
+	{
+		return rigLog;
+	}
+	for (size_t i = 1; i < trackers.size(); i++)
+	{
+		rigLog["cameras"].push_back(trackers[i]->returnJson());
+	}
+	rigLog["fusion"] = fusionLog;
+	return rigLog;
+}
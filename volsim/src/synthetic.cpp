@@ -0,0 +1,361 @@
+#include <k4a/k4a.h>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <string>
+#include <thread>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "synthetic.hpp"
+
+// Geometry of K4A_COLOR_RESOLUTION_1536P and K4A_DEPTH_MODE_WFOV_2X2BINNED
+static const int COLOR_WIDTH = 2048;
+static const int COLOR_HEIGHT = 1536;
+static const int DEPTH_WIDTH = 512;
+static const int DEPTH_HEIGHT = 512;
+
+// Anything the rays miss lands on a wall behind the participant
+static const float WALL_DEPTH = 2500.0f;
+
+class SyntheticCaptureSourceException : public std::exception
+{
+private:
+	std::string message;
+
+public:
+	explicit SyntheticCaptureSourceException(const std::string &msg) : message(msg) {}
+
+	virtual const char *what() const throw()
+	{
+		return message.c_str();
+	}
+};
+
+class InvalidFrameRateException : public SyntheticCaptureSourceException
+{
+public:
+	explicit InvalidFrameRateException(float fps) : SyntheticCaptureSourceException("Synthetic frame rate must be above 0, not " + std::to_string(fps)) {}
+};
+
+struct PinholeView
+{
+	float cx;
+	float cy;
+	float fx;
+	float fy;
+	int width;
+	int height;
+};
+
+static PinholeView toView(const k4a_calibration_camera_t &camera)
+{
+	const auto &param = camera.intrinsics.parameters.param;
+	return {param.cx, param.cy, param.fx, param.fy, camera.resolution_width, camera.resolution_height};
+}
+
+// A distortion free camera so the synthetic render and the SDK's projection agree exactly
+static k4a_calibration_camera_t pinholeCamera(int width, int height, float fx, float fy, float metricRadius)
+{
+	k4a_calibration_camera_t camera = {};
+	camera.resolution_width = width;
+	camera.resolution_height = height;
+	camera.metric_radius = metricRadius;
+	camera.intrinsics.type = K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+	camera.intrinsics.parameter_count = 14;
+	camera.intrinsics.parameters.param.cx = width / 2.0f;
+	camera.intrinsics.parameters.param.cy = height / 2.0f;
+	camera.intrinsics.parameters.param.fx = fx;
+	camera.intrinsics.parameters.param.fy = fy;
+	camera.intrinsics.parameters.param.metric_radius = metricRadius;
+	camera.extrinsics.rotation[0] = camera.extrinsics.rotation[4] = camera.extrinsics.rotation[8] = 1.0f;
+	return camera;
+}
+
+static void setExtrinsics(k4a_calibration_extrinsics_t &extrinsics, const glm::mat3 &rotation, const glm::vec3 &translation)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			// k4a is row major, glm is column major
+			extrinsics.rotation[row * 3 + col] = rotation[col][row];
+		}
+		extrinsics.translation[row] = translation[row];
+	}
+}
+
+static glm::vec3 applyExtrinsics(const k4a_calibration_extrinsics_t &extrinsics, const glm::vec3 &point)
+{
+	const float *r = extrinsics.rotation;
+	return glm::vec3(r[0] * point.x + r[1] * point.y + r[2] * point.z + extrinsics.translation[0],
+					 r[3] * point.x + r[4] * point.y + r[5] * point.z + extrinsics.translation[1],
+					 r[6] * point.x + r[7] * point.y + r[8] * point.z + extrinsics.translation[2]);
+}
+
+// Ray casts each ellipsoid over its screen space bounds, keeping the nearest hit per pixel in zBuffer
+template <typename Scene, typename Shade>
+static void raster(const PinholeView &view, const Scene &scene, float *zBuffer, Shade shade)
+{
+	for (const auto &e : scene)
+	{
+		float bound = std::max(e.radii.x, std::max(e.radii.y, e.radii.z));
+		float nearZ = e.centre.z - bound;
+		float farZ = e.centre.z + bound;
+		if (nearZ < 100.0f)
+		{
+			continue;
+		}
+
+		int uMin = std::max(0, (int)std::floor(view.cx + view.fx * std::min((e.centre.x - bound) / nearZ, (e.centre.x - bound) / farZ)));
+		int uMax = std::min(view.width - 1, (int)std::ceil(view.cx + view.fx * std::max((e.centre.x + bound) / nearZ, (e.centre.x + bound) / farZ)));
+		int vMin = std::max(0, (int)std::floor(view.cy + view.fy * std::min((e.centre.y - bound) / nearZ, (e.centre.y - bound) / farZ)));
+		int vMax = std::min(view.height - 1, (int)std::ceil(view.cy + view.fy * std::max((e.centre.y + bound) / nearZ, (e.centre.y + bound) / farZ)));
+
+		// Intersect in the space where the ellipsoid is a unit sphere
+		glm::vec3 origin = -e.centre / e.radii;
+		float c = glm::dot(origin, origin) - 1.0f;
+		for (int v = vMin; v <= vMax; v++)
+		{
+			for (int u = uMin; u <= uMax; u++)
+			{
+				// z of the ray is 1 so t is the depth
+				glm::vec3 ray((u - view.cx) / view.fx, (v - view.cy) / view.fy, 1.0f);
+				glm::vec3 dir = ray / e.radii;
+				float a = glm::dot(dir, dir);
+				float b = 2.0f * glm::dot(origin, dir);
+				float disc = b * b - 4.0f * a * c;
+				if (disc < 0.0f)
+				{
+					continue;
+				}
+				float t = (-b - std::sqrt(disc)) / (2.0f * a);
+				int index = v * view.width + u;
+				if (t <= 0.0f || t >= zBuffer[index])
+				{
+					continue;
+				}
+				zBuffer[index] = t;
+				shade(index, ray, glm::normalize((ray * t - e.centre) / (e.radii * e.radii)), e);
+			}
+		}
+	}
+}
+
+SyntheticCaptureSource::SyntheticCaptureSource(float fps, bool realtime)
+{
+	// Frame times are frameIndex / fps, nothing to pace by otherwise (and NaN fails every comparison)
+	if (!(fps > 0.0f))
+	{
+		throw InvalidFrameRateException(fps);
+	}
+	this->fps = fps;
+	this->realtime = realtime;
+
+	// Roughly the field of view of the real cameras
+	calibration = {};
+	calibration.depth_mode = K4A_DEPTH_MODE_WFOV_2X2BINNED;
+	calibration.color_resolution = K4A_COLOR_RESOLUTION_1536P;
+	calibration.depth_camera_calibration = pinholeCamera(DEPTH_WIDTH, DEPTH_HEIGHT, 148.0f, 148.0f, 2.5f);
+	calibration.color_camera_calibration = pinholeCamera(COLOR_WIDTH, COLOR_HEIGHT, 975.0f, 975.0f, 1.7f);
+
+	for (int from = 0; from < K4A_CALIBRATION_TYPE_NUM; from++)
+	{
+		for (int to = 0; to < K4A_CALIBRATION_TYPE_NUM; to++)
+		{
+			setExtrinsics(calibration.extrinsics[from][to], glm::mat3(1.0f), glm::vec3(0.0f));
+		}
+	}
+
+	// The color camera sits 32mm to the side of the depth camera and is tilted down by 6 degrees
+	float tilt = glm::radians(6.0f);
+	glm::mat3 depthToColorRotation = glm::mat3(1.0f, 0.0f, 0.0f,
+											   0.0f, std::cos(tilt), std::sin(tilt),
+											   0.0f, -std::sin(tilt), std::cos(tilt));
+	glm::vec3 depthToColorTranslation(-32.0f, -2.0f, 4.0f);
+	setExtrinsics(calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR], depthToColorRotation, depthToColorTranslation);
+	setExtrinsics(calibration.extrinsics[K4A_CALIBRATION_TYPE_COLOR][K4A_CALIBRATION_TYPE_DEPTH], glm::transpose(depthToColorRotation), -(glm::transpose(depthToColorRotation) * depthToColorTranslation));
+	calibration.color_camera_calibration.extrinsics = calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+
+	zBuffer.resize(COLOR_WIDTH * COLOR_HEIGHT);
+	start = std::chrono::steady_clock::now();
+}
+
+SyntheticCaptureSource::Pose SyntheticCaptureSource::buildScene(double t, std::vector<Ellipsoid> &scene)
+{
+	const float PI2 = 2.0f * glm::pi<float>();
+	const glm::vec3 skin(140.0f, 170.0f, 220.0f);
+	Pose pose;
+
+	// The head drifts slowly in front of the screen, facing the camera (+x is the participant's left)
+	glm::vec3 head(120.0f * std::sin(PI2 * t / 8.0), -80.0f + 40.0f * std::sin(PI2 * t / 5.0), 700.0f + 100.0f * std::sin(PI2 * t / 11.0));
+	scene.push_back({head, glm::vec3(75.0f, 100.0f, 85.0f), skin});
+	for (float side : {1.0f, -1.0f})
+	{
+		glm::vec3 eye = head + glm::vec3(side * 32.0f, -15.0f, -72.0f);
+		scene.push_back({eye, glm::vec3(13.0f, 9.0f, 12.0f), glm::vec3(235.0f, 235.0f, 235.0f)});
+		scene.push_back({eye + glm::vec3(0.0f, 0.0f, -8.0f), glm::vec3(5.0f, 5.0f, 5.0f), glm::vec3(40.0f, 30.0f, 20.0f)});
+		scene.push_back({eye + glm::vec3(0.0f, -18.0f, -4.0f), glm::vec3(18.0f, 3.0f, 5.0f), glm::vec3(30.0f, 40.0f, 60.0f)});
+		// Depth sees the front of the eye, not its centre
+		(side > 0.0f ? pose.leftEye : pose.rightEye) = eye - glm::vec3(0.0f, 0.0f, 12.0f);
+	}
+	scene.push_back({head + glm::vec3(0.0f, 15.0f, -85.0f), glm::vec3(12.0f, 22.0f, 15.0f), skin * 0.9f});
+	scene.push_back({head + glm::vec3(0.0f, 50.0f, -75.0f), glm::vec3(28.0f, 6.0f, 8.0f), glm::vec3(60.0f, 60.0f, 150.0f)});
+
+	// The hand circles in front of the display, palm to the camera, pinching every few seconds
+	glm::vec3 palm(-150.0f + 60.0f * std::sin(PI2 * t / 6.0), 100.0f + 40.0f * std::cos(PI2 * t / 6.0), 450.0f);
+	scene.push_back({palm, glm::vec3(45.0f, 50.0f, 18.0f), skin});
+
+	float gap = 40.0f + 20.0f * std::sin(PI2 * t / 3.0);
+	float pinchCentre = palm.x + 15.0f;
+	glm::vec3 tips[5] = {
+		glm::vec3(pinchCentre + gap / 2.0f, palm.y - 115.0f, palm.z - 10.0f), // index
+		glm::vec3(pinchCentre - gap / 2.0f, palm.y - 120.0f, palm.z - 10.0f), // middle
+		glm::vec3(palm.x - 15.0f, palm.y - 110.0f, palm.z),					  // ring
+		glm::vec3(palm.x - 33.0f, palm.y - 95.0f, palm.z),					  // pinky
+		glm::vec3(palm.x + 90.0f, palm.y - 30.0f, palm.z - 10.0f)};			  // thumb
+	glm::vec3 bases[5] = {
+		palm + glm::vec3(25.0f, -45.0f, 0.0f),
+		palm + glm::vec3(5.0f, -48.0f, 0.0f),
+		palm + glm::vec3(-15.0f, -45.0f, 0.0f),
+		palm + glm::vec3(-33.0f, -40.0f, 0.0f),
+		palm + glm::vec3(40.0f, 5.0f, 0.0f)};
+	for (int finger = 0; finger < 5; finger++)
+	{
+		for (int joint = 1; joint <= 3; joint++)
+		{
+			glm::vec3 centre = glm::mix(bases[finger], tips[finger], joint / 3.0f);
+			scene.push_back({centre, glm::vec3(10.0f, 10.0f, 10.0f), skin});
+		}
+	}
+	pose.indexTip = tips[0];
+	pose.middleTip = tips[1];
+
+	return pose;
+}
+
+void SyntheticCaptureSource::renderDepth(const std::vector<Ellipsoid> &scene, uint16_t *buffer)
+{
+	PinholeView view = toView(calibration.depth_camera_calibration);
+	std::fill(zBuffer.begin(), zBuffer.begin() + view.width * view.height, WALL_DEPTH);
+	raster(view, scene, zBuffer.data(), [](int, const glm::vec3 &, const glm::vec3 &, const Ellipsoid &) {});
+
+	for (int i = 0; i < view.width * view.height; i++)
+	{
+		buffer[i] = (uint16_t)std::lround(zBuffer[i]);
+	}
+}
+
+void SyntheticCaptureSource::renderColor(const std::vector<Ellipsoid> &scene, uint8_t *buffer, int stride)
+{
+	PinholeView view = toView(calibration.color_camera_calibration);
+	std::fill(zBuffer.begin(), zBuffer.begin() + view.width * view.height, WALL_DEPTH);
+	for (int v = 0; v < view.height; v++)
+	{
+		uint8_t *row = buffer + v * stride;
+		for (int u = 0; u < view.width; u++)
+		{
+			row[u * 4 + 0] = row[u * 4 + 1] = row[u * 4 + 2] = 90;
+			row[u * 4 + 3] = 255;
+		}
+	}
+
+	// Move the scene into the color camera
+	std::vector<Ellipsoid> colorScene = scene;
+	for (auto &e : colorScene)
+	{
+		e.centre = applyExtrinsics(calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR], e.centre);
+	}
+
+	raster(view, colorScene, zBuffer.data(), [&](int index, const glm::vec3 &ray, const glm::vec3 &normal, const Ellipsoid &e)
+		   {
+			   // Lit from the camera
+			   float light = 0.35f + 0.65f * std::max(0.0f, -glm::dot(normal, glm::normalize(ray)));
+			   int v = index / view.width;
+			   int u = index % view.width;
+			   uint8_t *pixel = buffer + v * stride + u * 4;
+			   pixel[0] = (uint8_t)std::min(255.0f, e.color.x * light);
+			   pixel[1] = (uint8_t)std::min(255.0f, e.color.y * light);
+			   pixel[2] = (uint8_t)std::min(255.0f, e.color.z * light); });
+}
+
+k4a_wait_result_t SyntheticCaptureSource::getCapture(k4a_capture_t *capture, int32_t timeout)
+{
+	uint64_t timestamp = (uint64_t)(frameIndex * 1000000.0 / fps);
+	if (realtime)
+	{
+		auto due = start + std::chrono::microseconds(timestamp);
+		// Not due before the caller stops waiting, the same frame is rendered on the next call
+		if (timeout != K4A_WAIT_INFINITE && due > std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+			return K4A_WAIT_RESULT_TIMEOUT;
+		}
+		std::this_thread::sleep_until(due);
+	}
+
+	std::vector<Ellipsoid> scene;
+	Pose pose = buildScene(timestamp / 1000000.0, scene);
+
+	k4a_image_t colorImage = NULL;
+	k4a_image_t depthImage = NULL;
+	if (K4A_FAILED(k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32, COLOR_WIDTH, COLOR_HEIGHT, COLOR_WIDTH * 4, &colorImage)))
+	{
+		return K4A_WAIT_RESULT_FAILED;
+	}
+	if (K4A_FAILED(k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, DEPTH_WIDTH, DEPTH_HEIGHT, DEPTH_WIDTH * (int)sizeof(uint16_t), &depthImage)))
+	{
+		k4a_image_release(colorImage);
+		return K4A_WAIT_RESULT_FAILED;
+	}
+
+	renderColor(scene, k4a_image_get_buffer(colorImage), k4a_image_get_stride_bytes(colorImage));
+	renderDepth(scene, reinterpret_cast<uint16_t *>(k4a_image_get_buffer(depthImage)));
+	k4a_image_set_device_timestamp_usec(colorImage, timestamp);
+	k4a_image_set_device_timestamp_usec(depthImage, timestamp);
+
+	// The capture takes its own references to the images
+	k4a_capture_create(capture);
+	k4a_capture_set_color_image(*capture, colorImage);
+	k4a_capture_set_depth_image(*capture, depthImage);
+	k4a_image_release(colorImage);
+	k4a_image_release(depthImage);
+
+	auto toJson = [](const glm::vec3 &p)
+	{ return nlohmann::json{{"x", p.x}, {"y", p.y}, {"z", p.z}}; };
+	groundTruth.push_back({{"deviceTime", timestamp},
+						   {"points", {{"leftEye", toJson(pose.leftEye)}, {"rightEye", toJson(pose.rightEye)}, {"index", toJson(pose.indexTip)}, {"middle", toJson(pose.middleTip)}}}});
+
+	frameIndex++;
+	return K4A_WAIT_RESULT_SUCCEEDED;
+}
+
+k4a_result_t SyntheticCaptureSource::getCalibration(k4a_calibration_t *calibration)
+{
+	*calibration = this->calibration;
+	return K4A_RESULT_SUCCEEDED;
+}
+
+k4a_device_configuration_t SyntheticCaptureSource::getConfiguration()
+{
+	k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+	// The nearest rate the SDK has a name for, recordings of the synthetic source are tagged with it
+	config.camera_fps = fps < 10.0f ? K4A_FRAMES_PER_SECOND_5 : (fps < 22.5f ? K4A_FRAMES_PER_SECOND_15 : K4A_FRAMES_PER_SECOND_30);
+	config.color_format = K4A_IMAGE_FORMAT_COLOR_BGRA32;
+	config.color_resolution = calibration.color_resolution;
+	config.depth_mode = calibration.depth_mode;
+	config.synchronized_images_only = true;
+	return config;
+}
+
+nlohmann::json SyntheticCaptureSource::returnJson()
+{
+	nlohmann::json syntheticLog;
+	syntheticLog["fps"] = fps;
+	syntheticLog["realtime"] = realtime;
+	syntheticLog["frames"] = frameIndex;
+	syntheticLog["groundTruth"] = groundTruth;
+	return syntheticLog;
+}
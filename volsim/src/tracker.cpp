@@ -2,18 +2,23 @@
 #include <iostream>
 #include <algorithm>
 #include <exception>
+#include <cmath>
+#include <iterator>
 
 #include <chrono>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/opencv.hpp>
+#ifndef VOLSIM_NO_CUDA
 #include <opencv2/cudawarping.hpp>
 #include <opencv2/core/cuda.hpp>
 #include <opencv2/cudaimgproc.hpp>
+#endif
 
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing/render_face_detections.h>
@@ -25,6 +30,8 @@
 
 #include "tracker.hpp"
 #include "filesystem.hpp"
+#include "preprocess.hpp"
+#include "alloccounter.hpp"
 #include "mediapipe.h"
 
 class TrackerException : public std::exception
@@ -41,116 +48,97 @@ public:
 	}
 };
 
-class NoTrackersDetectedException : public TrackerException
+class FailedToDetectFaceException : public TrackerException
 {
 public:
-	NoTrackersDetectedException() : TrackerException("No Trackers were detected") {}
+	FailedToDetectFaceException() : TrackerException("Could not detect face from capture") {}
 };
 
-class FailedToOpenTrackerException : public TrackerException
-{
-public:
-	FailedToOpenTrackerException() : TrackerException("Cannot open Tracker") {}
-};
+// How long the capture and tracker threads wait for work before checking whether they should stop
+static const int32_t CAPTURE_TIMEOUT_MS = 100;
+static const int32_t TRACKER_WAIT_MS = 100;
 
-class FailedToStartTrackerException : public TrackerException
-{
-public:
-	FailedToStartTrackerException() : TrackerException("Cannot start the Tracker cameras") {}
-};
+// Only the debug images register depth, one capture at a time, anything past this falls back to the SDK allocator
+static const size_t REGISTERED_DEPTH_POOL_SIZE = 3;
+// Enough foreground images for every capture that can be alive at once (mailbox, in flight, and the published
+// tracking frames still held by the render thread or waiting for it)
+static const size_t FOREGROUND_POOL_SIZE = 12;
 
-class FailedToDetectFaceException : public TrackerException
-{
-public:
-	FailedToDetectFaceException() : TrackerException("Could not detect face from capture") {}
-};
+// Hands the hand graph finds before the face stage draws their capture, at most (each holds its capture)
+static const size_t MAX_DEBUG_HANDS = 4;
+
+// The distance from the surface of a finger to the middle of it (cm)
+static const glm::vec3 INTO_FINGER_OFFSET(0.0f, 1.0f, 1.0f);
 
-Tracker::Tracker(glm::vec3 initCameraOffset, float yRot, bool debug)
+Tracker::Tracker(std::unique_ptr<CaptureSource> source, glm::vec3 initCameraOffset, glm::vec3 rotation, bool debug, const nlohmann::json &options)
 {
 	this->debug = debug;
+	this->source = std::move(source);
 	cameraOffset = initCameraOffset;
 
-	// Check for Trackers
-	uint32_t count = k4a_device_get_installed_count();
-	if (count == 0)
+	// Live devices and recordings both carry the calibration the frames were taken with
+	k4a_calibration_t calibration;
+	this->source->getCalibration(&calibration);
+	camera = std::make_shared<CameraModel>(calibration, this->source->getProfileName(), debug, options.value("background", false));
+
+	// One for preprocessing on the tracker thread, one for the debug images on the face stage thread
+	jpegDecoder = std::make_unique<JpegDecoder>();
+	debugJpegDecoder = std::make_unique<JpegDecoder>();
+#ifndef VOLSIM_NO_CUDA
+	// BGRA frames go through the GPU unless asked not to, builds without CUDA always use the CPU kernel
+	gpuPreprocess = options.value("preprocess", "gpu") == "gpu";
+#endif
+	// Frames the face is followed by landmarks alone before the detector is run again anyway, 0 detects on every frame
+	faceTrack = FaceTrack(options.value("faceRedetectInterval", 30));
+
+	// Archive the session so it can be replayed later
+	if (options.contains("record"))
 	{
-		throw NoTrackersDetectedException();
+		recorder = std::make_unique<SessionRecorder>(options["record"].get<std::string>(), this->source->getConfiguration(), this->source->getRawCalibration());
 	}
 
-	// std::cout << "k4a device attached!" << std::endl;
-
-	// Open the first plugged in Tracker device
-	device = NULL;
-	if (K4A_FAILED(k4a_device_open(K4A_DEVICE_DEFAULT, &device)))
+	dlib::deserialize(FileSystem::getPath("data/shape_predictor_5_face_landmarks.dat").c_str()) >> predictor;
+	faceDetector = FaceDetector::create(options);
+	// Only look for faces on the top of whatever is at seating distance, in mm
+	if (options.value("headSearch", true))
 	{
-		throw FailedToOpenTrackerException();
+		headSearch = std::make_unique<HeadSearch>(options.value("headMinDepth", 400.0f), options.value("headMaxDepth", 900.0f));
 	}
 
-	// Get the size of the serial number
-	size_t serial_size = 0;
-	k4a_device_get_serialnum(device, NULL, &serial_size);
-
-	// Allocate memory for the serial, then acquire it
-	char *serial = (char *)(malloc(serial_size));
-	k4a_device_get_serialnum(device, serial, &serial_size);
-	// printf("Opened device: %s\n", serial);
-	free(serial);
-
-	config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
-	config.camera_fps = K4A_FRAMES_PER_SECOND_30;
-	config.color_format = K4A_IMAGE_FORMAT_COLOR_BGRA32;
-	config.color_resolution = K4A_COLOR_RESOLUTION_1536P;
-	config.depth_mode = K4A_DEPTH_MODE_WFOV_2X2BINNED;
-	config.synchronized_images_only = true;
+	// Rotation into the same basis as screenSpace
+	toScreenSpaceMat = glm::rotate(glm::mat4(1.0f), glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f)) *
+					   glm::rotate(glm::mat4(1.0f), glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f)) *
+					   glm::rotate(glm::mat4(1.0f), glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
 
-	if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &config))
+	// Learn what the empty room looks like so the depth consumers can skip it
+	if (options.value("background", false))
 	{
-		k4a_device_close(device);
-		throw FailedToStartTrackerException();
+		background = std::make_unique<BackgroundModel>(options);
 	}
+	foregroundPointCloud = options.value("pointCloud", "full") == "foreground";
 
-	// Display the color image
-	k4a_device_get_calibration(device, config.depth_mode, config.color_resolution, &calibration);
-	transformation = k4a_transformation_create(&calibration);
-
-	dlib::deserialize(FileSystem::getPath("data/shape_predictor_5_face_landmarks.dat").c_str()) >> predictor;
-	dlib::deserialize(FileSystem::getPath("data/mmod_human_face_detector.dat").c_str()) >> cnn_face_detector;
-
-	// configure mediapipe
-	std::string srcPath = FileSystem::getPath("data/");
-	std::string landmarkPath = FileSystem::getPath("data/mediapipe/modules/hand_landmark/hand_landmark_tracking_cpu.binarypb");
-	mp_set_resource_dir(srcPath.c_str());
-
-	// Load the binary graph and specify the input stream name.
-	mp_instance_builder *builder = mp_create_instance_builder(landmarkPath.c_str(), "image");
-
-	// Configure the graph with node options and side packets.
-	mp_add_option_float(builder, "palmdetectioncpu__TensorsToDetectionsCalculator", "min_score_thresh", 0.5);
-	mp_add_option_double(builder, "handlandmarkcpu__ThresholdingCalculator", "threshold", 0.5);
-	mp_add_side_packet(builder, "num_hands", mp_create_packet_int(1));
-	mp_add_side_packet(builder, "model_complexity", mp_create_packet_int(1));
-	mp_add_side_packet(builder, "use_prev_landmarks", mp_create_packet_bool(true));
-
-	// Create an instance from the instance builder.
-	instance = mp_create_instance(builder);
-	CHECK_MP_RESULT(instance)
-
-	// Create poller for the hand landmarks.
-	landmarks_poller = mp_create_poller(instance, "multi_hand_landmarks");
-	CHECK_MP_RESULT(landmarks_poller)
-
-	// Create a poller for the hand rectangles.
-	rects_poller = mp_create_poller(instance, "hand_rects");
-	CHECK_MP_RESULT(rects_poller)
-
-	// Start the graph.
-	CHECK_MP_RESULT(mp_start(instance))
+	// Crop what the hand graph sees to around the hand once it's been found
+	if (options.value("handRoi", true))
+	{
+		handRoi = std::make_unique<HandRoi>(options);
+	}
+	// Find the fingertips in depth and only run the hand graph now and then to check them
+	if (options.value("pinchFastPath", false))
+	{
+		pinch = std::make_unique<PinchDetector>(options);
+	}
 
-	// Rotation into the same basis as screenSpace
-	toScreenSpaceMat = glm::rotate(glm::mat4(1.0f), glm::radians(yRot), glm::vec3(1.0f, 0.0f, 0.0f));
+	// How many frames can wait for the face and hand stages, and whether a full queue drops its oldest frame
+	// ("dropOldest") or holds preprocessing up until there's room ("block")
+	size_t queueDepth = (size_t)std::max(1, options.value("pipelineQueueDepth", 1));
+	QueuePolicy queuePolicy = parseQueuePolicy(options.value("pipelineQueuePolicy", "dropOldest"));
+	faceQueue = std::make_unique<StageQueue<FaceJob>>(queueDepth, queuePolicy);
 
-	// Create a new tracking frame
-	trackF = std::make_unique<TrackingFrame>();
+	// Last, results can start arriving as soon as they exist
+	faceWorker = std::thread(&Tracker::runFaceStage, this);
+	handGraph = std::make_unique<HandGraph>([this](const HandGraph::Result &result)
+											{ handTracked(result); },
+											queueDepth, queuePolicy);
 
 	// Make sure the capture is initialized
 	getLatestCapture();
@@ -160,37 +148,32 @@ Tracker::Tracker(glm::vec3 initCameraOffset, float yRot, bool debug)
 
 glm::vec3 Tracker::calculate3DPos(int x, int y, k4a_calibration_type_t source_type, std::shared_ptr<Capture> capture)
 {
-	uint16_t depth;
+	k4a_float2_t depthPoint = {static_cast<float>(x), static_cast<float>(y)};
+	int valid;
 	if (source_type == K4A_CALIBRATION_TYPE_COLOR)
 	{
-		uint16_t *depthBuffer = reinterpret_cast<uint16_t *>(k4a_image_get_buffer(capture->colorSpace.depthImage));
-		int index = y * capture->colorSpace.width + x;
-		depth = depthBuffer[index];
-	}
-	else if (source_type == K4A_CALIBRATION_TYPE_DEPTH)
-	{
-		uint16_t *depthBuffer = reinterpret_cast<uint16_t *>(k4a_image_get_buffer(capture->depthSpace.depthImage));
-		int index = y * capture->depthSpace.width + x;
-		depth = depthBuffer[index];
+		// Rather than registering the whole depth image, find just this color pixel in depth space
+		k4a_float2_t colorPoint = {static_cast<float>(x), static_cast<float>(y)};
+		if (K4A_RESULT_SUCCEEDED != k4a_calibration_color_2d_to_depth_2d(&capture->camera->calibration, &colorPoint, capture->depthSpace.depthImage, &depthPoint, &valid) || !valid)
+		{
+			// No depth behind this pixel, same as reading a hole in a registered depth image
+			return glm::vec3(0.0f);
+		}
 	}
-	else
+	else if (source_type != K4A_CALIBRATION_TYPE_DEPTH)
 	{
 		throw std::runtime_error("Invalid source type");
 	}
 
-	k4a_float2_t pointK4APoint = {static_cast<float>(x), static_cast<float>(y)};
-	k4a_float3_t cameraPoint;
-	int valid;
-	if (K4A_RESULT_SUCCEEDED != k4a_calibration_2d_to_3d(&calibration, &pointK4APoint, depth, source_type, K4A_CALIBRATION_TYPE_DEPTH, &cameraPoint, &valid))
-	{
-		// std::cout << "Failed to convert from 2d to 3d" << std::endl;
-		// exit(EXIT_FAILURE);
-	}
+	int depthX = std::clamp((int)std::lround(depthPoint.xy.x), 0, capture->depthSpace.width - 1);
+	int depthY = std::clamp((int)std::lround(depthPoint.xy.y), 0, capture->depthSpace.height - 1);
+	uint16_t *depthBuffer = reinterpret_cast<uint16_t *>(k4a_image_get_buffer(capture->depthSpace.depthImage));
+	uint16_t depth = depthBuffer[depthY * capture->depthSpace.width + depthX];
 
-	if (!valid)
+	k4a_float3_t cameraPoint;
+	if (K4A_RESULT_SUCCEEDED != k4a_calibration_2d_to_3d(&capture->camera->calibration, &depthPoint, depth, K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_DEPTH, &cameraPoint, &valid) || !valid)
 	{
-		// std::cout << "Failed to convert to valid 3d coords" << std::endl;
-		// exit(EXIT_FAILURE);
+		return glm::vec3(0.0f);
 	}
 	return glm::vec3((-(float)cameraPoint.xyz.x) / 10.0, -((float)cameraPoint.xyz.y) / 10.0, ((float)cameraPoint.xyz.z) / 10.0);
 }
@@ -198,34 +181,69 @@ glm::vec3 Tracker::calculate3DPos(int x, int y, k4a_calibration_type_t source_ty
 std::vector<glm::vec3> Tracker::getPointCloud()
 {
 	std::vector<glm::vec3> pointCloud;
-	if ((trackF->lastCapture == nullptr) || (trackF->lastCapture->depthSpace.depthImage == NULL))
+	if ((view.lastCapture == nullptr) || (view.lastCapture->depthSpace.depthImage == NULL))
+	{
+		return pointCloud;
+	}
+	// Take an image to hold the point cloud data from the pool
+	std::shared_ptr<Capture> lastCapture = view.lastCapture;
+	std::shared_ptr<CameraModel> lastCamera = lastCapture->camera;
+	k4a_image_t pointCloudImage = lastCamera->pointCloudPool->acquire();
+	if (pointCloudImage == NULL)
 	{
 		return pointCloud;
 	}
-	k4a_image_t pointCloudImage;
 
-	// Create an image to hold the point cloud data
-	k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM,
-					 trackF->lastCapture->depthSpace.width,
-					 trackF->lastCapture->depthSpace.height,
-					 trackF->lastCapture->depthSpace.width * 3 * (int)sizeof(int16_t),
-					 &pointCloudImage);
+	// Only what moved, if asked for and the background has been learnt
+	bool foregroundOnly = foregroundPointCloud && lastCapture->foregroundDepth != NULL;
+	k4a_image_t depth = foregroundOnly ? lastCapture->foregroundDepth : lastCapture->depthSpace.depthImage;
 
 	// Transform the depth image to a point cloud
-	k4a_transformation_depth_image_to_point_cloud(transformation, trackF->lastCapture->depthSpace.depthImage, K4A_CALIBRATION_TYPE_DEPTH, pointCloudImage);
+	k4a_transformation_depth_image_to_point_cloud(lastCamera->transformation, depth, K4A_CALIBRATION_TYPE_DEPTH, pointCloudImage);
 
 	// Convert pointCloudImage to std::vector<glm::vec3>
 	int16_t *pointCloudData = reinterpret_cast<int16_t *>(k4a_image_get_buffer(pointCloudImage));
-	for (int i = 0; i < trackF->lastCapture->depthSpace.width * trackF->lastCapture->depthSpace.height; ++i)
+	int width = lastCapture->depthSpace.width;
+	auto addPoint = [&](int i)
 	{
 		int index = i * 3;
 		float x = -static_cast<float>(pointCloudData[index]) / 10.0f;
 		float y = -static_cast<float>(pointCloudData[index + 1]) / 10.0f;
 		float z = static_cast<float>(pointCloudData[index + 2]) / 10.0f;
 		pointCloud.push_back(toScreenSpace(glm::vec3(x, y, z)));
+	};
+	if (foregroundOnly)
+	{
+		// Static pixels come out of the transform at zero, only visit the regions that moved and skip those
+		const std::vector<cv::Rect> &regions = lastCapture->foregroundRegions;
+		cv::Rect frameRect(0, 0, width, lastCapture->depthSpace.height);
+		for (size_t r = 0; r < regions.size(); r++)
+		{
+			cv::Rect clipped = regions[r] & frameRect;
+			for (int y = clipped.y; y < clipped.y + clipped.height; y++)
+			{
+				for (int x = clipped.x; x < clipped.x + clipped.width; x++)
+				{
+					// Boxes can overlap, points in an earlier one have already been added
+					bool seen = std::any_of(regions.begin(), regions.begin() + r, [x, y](const cv::Rect &earlier)
+											{ return earlier.contains(cv::Point(x, y)); });
+					if (!seen && pointCloudData[(y * width + x) * 3 + 2] != 0)
+					{
+						addPoint(y * width + x);
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		for (int i = 0; i < width * lastCapture->depthSpace.height; ++i)
+		{
+			addPoint(i);
+		}
 	}
 
-	// Remember to release the point cloud image after use
+	// Remember to release the point cloud image after use, this hands it back to the pool
 	k4a_image_release(pointCloudImage);
 
 	return pointCloud;
@@ -239,227 +257,772 @@ void Tracker::getLatestCapture()
 								.count();
 
 	auto start = std::chrono::high_resolution_clock::now();
-	while (true)
+
+	// Profile switches happen here so nothing else is pulling from the source while the cameras restart
+	int profileIndex = pendingProfile.exchange(-1);
+	if (profileIndex >= 0)
 	{
-		try
+		switchProfile(CaptureProfile::all()[profileIndex]);
+	}
+
+	// A bounded wait so the capture thread can notice the window closing
+	k4a_capture_t handle = NULL;
+	auto idleStart = std::chrono::steady_clock::now();
+	k4a_wait_result_t waitResult = source->getCapture(&handle, CAPTURE_TIMEOUT_MS);
+	auto busyStart = std::chrono::steady_clock::now();
+	captureThreadStats.addIdle(busyStart - idleStart);
+	switch (waitResult)
+	{
+	case K4A_WAIT_RESULT_SUCCEEDED:
+		break;
+	case K4A_WAIT_RESULT_TIMEOUT:
+		return;
+	case K4A_WAIT_RESULT_FAILED:
+		std::cerr << "Failed to read a capture" << std::endl;
+		return;
+	}
+	AllocationCounter allocations;
+
+	std::shared_ptr<Capture> newCapture = std::make_shared<Capture>(handle, camera);
+	// The SDK stamps when the USB transfer landed using the same monotonic clock as steady_clock,
+	// sources without one (playback, synthetic) arrive when we pick them up
+	newCapture->arrivalTime = busyStart;
+	uint64_t systemTimestamp = k4a_image_get_system_timestamp_nsec(newCapture->depthSpace.depthImage);
+	if (systemTimestamp != 0)
+	{
+		std::chrono::steady_clock::time_point sdkArrival{std::chrono::nanoseconds(systemTimestamp)};
+		if (sdkArrival <= busyStart && busyStart - sdkArrival < std::chrono::seconds(1))
 		{
-			latestCapture = std::make_shared<Capture>(device, transformation);
-			auto end = std::chrono::high_resolution_clock::now();
-			auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-			capture["time"] = currentTimeInMilliseconds;
-			capture["captureTime"] = duration.count();
-			jsonLog["capture"].push_back(capture);
-			return;
+			newCapture->arrivalTime = sdkArrival;
 		}
-		catch (const std::exception &e)
+	}
+	if (recorder)
+	{
+		recorder->push(handle);
+	}
+	captures.publish(std::move(newCapture));
+
+	auto end = std::chrono::high_resolution_clock::now();
+	auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	capture["time"] = currentTimeInMilliseconds;
+	capture["captureTime"] = duration.count();
+	// Only the capture thread writes this log
+	captureLog.push_back(capture);
+	if (AllocationCounter::isCounting())
+	{
+		captureAllocations.push_back(allocations.getCount());
+	}
+
+	auto busyTime = std::chrono::steady_clock::now() - busyStart;
+	captureThreadStats.addBusy(busyTime);
+	captureCostByProfile[camera->profile].add(busyTime);
+}
+
+bool Tracker::requestProfile(const std::string &name)
+{
+	if (recorder)
+	{
+		std::cerr << "Can't switch capture profile while recording" << std::endl;
+		return false;
+	}
+	const std::vector<CaptureProfile> &profiles = CaptureProfile::all();
+	for (size_t i = 0; i < profiles.size(); i++)
+	{
+		if (profiles[i].name == name)
 		{
-			// wait 1 millisecond
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			pendingProfile.store((int)i);
+			return true;
 		}
 	}
+	std::cerr << "Unknown capture profile " << name << std::endl;
+	return false;
+}
+
+void Tracker::switchProfile(const CaptureProfile &profile)
+{
+	auto start = std::chrono::steady_clock::now();
+	nlohmann::json profileSwitch;
+	profileSwitch["time"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+								std::chrono::system_clock::now().time_since_epoch())
+								.count();
+	profileSwitch["from"] = camera->profile;
+	profileSwitch["to"] = profile.name;
+
+	// The dlib and MediaPipe state doesn't care about resolution, only the camera geometry needs rebuilding
+	bool switched = source->setProfile(profile);
+	if (switched)
+	{
+		k4a_calibration_t calibration;
+		source->getCalibration(&calibration);
+		camera = std::make_shared<CameraModel>(calibration, profile.name, debug, background != nullptr);
+	}
+	profileSwitch["success"] = switched;
+	profileSwitch["switchTime"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	profileLog.push_back(profileSwitch);
 }
 
 void Tracker::update()
 {
-	if (trackF->lastCapture == latestCapture)
+	// Sleep until the capture thread publishes instead of spinning on the mailbox
+	auto idleStart = std::chrono::steady_clock::now();
+	bool fresh = captures.waitForFresh(std::chrono::milliseconds(TRACKER_WAIT_MS));
+	auto busyStart = std::chrono::steady_clock::now();
+	trackerThreadStats.addIdle(busyStart - idleStart);
+
+	std::shared_ptr<Capture> latestCapture;
+	if (!fresh || !captures.consume(latestCapture))
 	{
 		return;
 	}
+	AllocationCounter allocations;
+	std::unique_ptr<FrameBuffer> frame = takeFrame();
 	try
 	{
-		// Define time points and durations
-		std::chrono::high_resolution_clock::time_point startOverall, stopOverall;
-		std::chrono::high_resolution_clock::time_point start, stop;
-		std::chrono::milliseconds durationCapture, durationGPUOperations, durationTracking, durationDebug;
+		// Steps 1 to 4: Get an RGB image to track on (half resolution color, or IR at depth resolution), written straight into the buffer the detectors read
+		int halfWidth = latestCapture->colorSpace.width / 2;
+		int halfHeight = latestCapture->colorSpace.height / 2;
+		if (!latestCapture->hasColor())
+		{
+			// IR only: track on the IR image itself, pixel aligned with depth so nothing needs registering or scaling
+			k4a_image_t ir = latestCapture->depthSpace.irImage;
+			if (ir == NULL)
+			{
+				giveBackFrame(std::move(frame));
+				return;
+			}
+			frame->resize(latestCapture->depthSpace.width, latestCapture->depthSpace.height);
+			cv::Mat frameView = frame->cvView();
+			const uint16_t *irBuffer = (const uint16_t *)k4a_image_get_buffer(ir);
+			int irStride = k4a_image_get_stride_bytes(ir);
+			uint16_t white = irWhitePoint(irBuffer, irStride, frame->getWidth(), frame->getHeight());
+			irToRgb(irBuffer, irStride, frame->getWidth(), frame->getHeight(), white, frameView.data, (int)frameView.step);
+			latestCapture->trackingSpace = K4A_CALIBRATION_TYPE_DEPTH;
+			latestCapture->trackingScale = 1.0f;
+		}
+		else if (k4a_image_get_format(latestCapture->colorSpace.colorImage) == K4A_IMAGE_FORMAT_COLOR_MJPG)
+		{
+			// Decode straight to half size, the full resolution image is never produced
+			// (libjpeg-turbo rounds scaled sizes up)
+			frame->resize((latestCapture->colorSpace.width + 1) / 2, (latestCapture->colorSpace.height + 1) / 2);
+			cv::Mat frameView = frame->cvView();
+			if (!jpegDecoder->decode(latestCapture->colorSpace.colorImage, 2, TJPF_RGB, frameView))
+			{
+				giveBackFrame(std::move(frame));
+				return;
+			}
+		}
+		else
+		{
+			cv::Mat bgraImage(latestCapture->colorSpace.height, latestCapture->colorSpace.width, CV_8UC4, k4a_image_get_buffer(latestCapture->colorSpace.colorImage), (size_t)k4a_image_get_stride_bytes(latestCapture->colorSpace.colorImage));
+			frame->resize(halfWidth, halfHeight);
+			cv::Mat frameView = frame->cvView();
+#ifndef VOLSIM_NO_CUDA
+			if (gpuPreprocess)
+			{
+				// Upload to GPU
+				cv::cuda::GpuMat bgraImageGpu, rgbImageGpu;
+				bgraImageGpu.upload(bgraImage);
 
-		// Step 1: Capture Instance
-		start = std::chrono::high_resolution_clock::now();
-		stop = std::chrono::high_resolution_clock::now();
-		durationCapture = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+				// GPU Processing
+				cv::cuda::cvtColor(bgraImageGpu, rgbImageGpu, cv::COLOR_BGRA2RGB);
+				cv::cuda::pyrDown(rgbImageGpu, rgbImageGpu);
 
-		// Steps 2, 3, and 4: GPU Operations (Upload to GPU, GPU Processing, Download from GPU)
-		start = std::chrono::high_resolution_clock::now();
+				// Download from GPU into the frame buffer
+				rgbImageGpu(cv::Rect(0, 0, halfWidth, halfHeight)).download(frameView);
+			}
+			else
+#endif
+			{
+				// Convert and downsample in one pass on the CPU
+				halfScaleBgraToRgb(bgraImage.data, (int)bgraImage.step, bgraImage.cols, bgraImage.rows, frameView.data, (int)frameView.step);
+			}
+		}
+		if (background)
+		{
+			segmentBackground(latestCapture);
+		}
 
-		// Upload to GPU
-		cv::Mat bgraImage(latestCapture->colorSpace.height, latestCapture->colorSpace.width, CV_8UC4, k4a_image_get_buffer(latestCapture->colorSpace.colorImage), (size_t)k4a_image_get_stride_bytes(latestCapture->colorSpace.colorImage));
-		cv::cuda::GpuMat bgraImageGpu, bgrImageGpu;
-		bgraImageGpu.upload(bgraImage);
+		// Step 5: Hand the frame to the hand graph and queue it for the face stage. Both run on their own threads and
+		// publish whatever they find, so this one can start on the next capture straight away. Once the pinch
+		// detector is trusted it publishes fingertips itself and the graph only gets the frames that check it.
+		std::optional<std::array<glm::vec3, 2>> pinchTips;
+		bool runHandGraph = true;
+		if (pinch)
+		{
+			pinchTips = detectPinch(latestCapture);
+			runHandGraph = pinch->shouldValidate(pinchTips.has_value());
+		}
+		if (runHandGraph)
+		{
+			submitHand(*frame, latestCapture, pinchTips);
+		}
+		auto preprocessTime = std::chrono::steady_clock::now() - busyStart;
+		FaceJob job{latestCapture, std::move(frame), preprocessTime};
+		std::optional<FaceJob> dropped;
+		if (!faceQueue->push(std::move(job), dropped))
+		{
+			giveBackFrame(std::move(job.frame));
+		}
+		if (dropped.has_value())
+		{
+			giveBackFrame(std::move(dropped->frame));
+		}
 
-		// GPU Processing
-		cv::cuda::cvtColor(bgraImageGpu, bgrImageGpu, cv::COLOR_BGRA2BGR);
-		cv::cuda::pyrDown(bgrImageGpu, bgrImageGpu);
-		
-		// Download from GPU
-		cv::Mat processedBgrImage;
-		bgrImageGpu.download(processedBgrImage);
-		stop = std::chrono::high_resolution_clock::now();
-		durationGPUOperations = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+		preprocessCost.add(preprocessTime);
+		trackerThreadStats.addBusy(preprocessTime);
+		// Only ever waits here when the face queue is set to block
+		trackerThreadStats.addIdle(std::chrono::steady_clock::now() - busyStart - preprocessTime);
+		if (AllocationCounter::isCounting())
+		{
+			preprocessAllocations.push_back(allocations.getCount());
+		}
+	}
+	catch (const std::exception &e)
+	{
+		if (frame)
+		{
+			giveBackFrame(std::move(frame));
+		}
+		throw;
+	}
+}
 
-		// Step 5: Run the tracking
+void Tracker::runFaceStage()
+{
+	while (true)
+	{
+		FaceJob job;
+		auto idleStart = std::chrono::steady_clock::now();
+		if (!faceQueue->pop(job))
+		{
+			return;
+		}
+		auto busyStart = std::chrono::steady_clock::now();
+		faceThreadStats.addIdle(busyStart - idleStart);
+		AllocationCounter allocations;
 
+		std::shared_ptr<const FaceLandmarks> face;
 		try
 		{
-			start = std::chrono::high_resolution_clock::now();
-			createNewTrackingFrame(processedBgrImage, latestCapture);
-			stop = std::chrono::high_resolution_clock::now();
-			durationTracking = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
-			startOverall = std::chrono::high_resolution_clock::now();
-
-			if (debug)
-			{
-				// Normalize and map depth image (example of further processing)
-				cv::Mat dImage(latestCapture->colorSpace.height, latestCapture->colorSpace.width, CV_16U, k4a_image_get_buffer(latestCapture->colorSpace.depthImage), (size_t)k4a_image_get_stride_bytes(latestCapture->colorSpace.depthImage));
-				cv::Mat normalisedDImage, colorDepthImage;
-
-				cv::normalize(dImage, normalisedDImage, 0, 255, cv::NORM_MINMAX, CV_8U);
-				cv::applyColorMap(normalisedDImage, colorDepthImage, cv::COLORMAP_JET);
-
-				colorDepthImage.copyTo(depthImage);
-				bgraImage.copyTo(colorImage);
-				debugDraw();
-			}
-			stopOverall = std::chrono::high_resolution_clock::now();
-			durationDebug = std::chrono::duration_cast<std::chrono::milliseconds>(stopOverall - startOverall);
+			face = trackFace(*job.frame, job.capture);
 		}
 		catch (const std::exception &e)
 		{
 			std::cerr << "Failed to create new tracking frame" << std::endl;
 		}
+		auto faceTime = std::chrono::steady_clock::now() - busyStart;
 
-		trackF->lastCapture = latestCapture;
+		// The results are final, the render thread can have them before the debug images are drawn.
+		// Nothing writes to the capture after this.
+		job.capture->trackedTime = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(publishMutex);
+			latest.lastCapture = job.capture;
+			if (face)
+			{
+				latest.face = std::move(face);
+			}
+			publish();
+		}
 
+		if (debug)
+		{
+			try
+			{
+				drawDebugImages(*job.frame, job.capture);
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << "Failed to draw the debug images" << std::endl;
+			}
+		}
+		giveBackFrame(std::move(job.frame));
 
 		nlohmann::json tracking;
 		auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
 									std::chrono::system_clock::now().time_since_epoch())
 									.count();
 		tracking["time"] = currentTimeInMilliseconds;
-		tracking["GPUTime"] = durationGPUOperations.count();
-		tracking["trackTime"] = durationTracking.count();
+		tracking["GPUTime"] = std::chrono::duration_cast<std::chrono::milliseconds>(job.preprocessTime).count();
+		tracking["trackTime"] = std::chrono::duration_cast<std::chrono::milliseconds>(faceTime).count();
 		jsonLog["tracking"].push_back(tracking);
 
+		faceStageCost.add(faceTime);
+		// The work that went into the frame across both stages, not how long it took to come through
+		trackingCostByProfile[job.capture->camera->profile].add(job.preprocessTime + faceTime);
+		faceThreadStats.addBusy(std::chrono::steady_clock::now() - busyStart);
+		if (AllocationCounter::isCounting())
+		{
+			faceAllocations.push_back(allocations.getCount());
+		}
+	}
+}
+
+void Tracker::drawDebugImages(FrameBuffer &frame, std::shared_ptr<Capture> capture)
+{
+	// Normalize and map depth image (example of further processing), in whichever space tracking ran
+	k4a_image_t debugDepth = capture->hasColor() ? capture->getRegisteredDepth() : capture->depthSpace.depthImage;
+	cv::Mat dImage(k4a_image_get_height_pixels(debugDepth), k4a_image_get_width_pixels(debugDepth), CV_16U, k4a_image_get_buffer(debugDepth), (size_t)k4a_image_get_stride_bytes(debugDepth));
+	cv::Mat normalisedDImage, colorDepthImage;
+
+	cv::normalize(dImage, normalisedDImage, 0, 255, cv::NORM_MINMAX, CV_8U);
+	cv::applyColorMap(normalisedDImage, colorDepthImage, cv::COLORMAP_JET);
+	cv::Mat fullColor = capture->hasColor() ? capture->getFullColor(*debugJpegDecoder) : cv::Mat();
+
+	std::lock_guard<std::mutex> lock(debugMutex);
+	colorDepthImage.copyTo(depthImage);
+	if (capture->hasColor())
+	{
+		fullColor.copyTo(colorImage);
 	}
-	catch (const std::exception &e)
+	else
 	{
-		throw;
+		cv::cvtColor(frame.cvView(), colorImage, cv::COLOR_RGB2BGRA);
 	}
+	debugScale = capture->trackingScale;
+	debugDraw(capture);
 }
 
-void Tracker::createNewTrackingFrame(cv::Mat inputColorImage, std::shared_ptr<Capture> capture)
+std::unique_ptr<FrameBuffer> Tracker::takeFrame()
 {
-	// Store the frame data in an image structure.
-	mp_image image;
-	image.data = inputColorImage.data;
-	image.width = inputColorImage.cols;
-	image.height = inputColorImage.rows;
-	image.format = mp_image_format_srgb;
+	std::lock_guard<std::mutex> lock(spareFramesMutex);
+	if (spareFrames.empty())
+	{
+		// At most queue depth + 2 (one being filled, one at the face stage) are ever made
+		framesAllocated++;
+		return std::make_unique<FrameBuffer>();
+	}
+	std::unique_ptr<FrameBuffer> frame = std::move(spareFrames.back());
+	spareFrames.pop_back();
+	return frame;
+}
+
+void Tracker::giveBackFrame(std::unique_ptr<FrameBuffer> frame)
+{
+	std::lock_guard<std::mutex> lock(spareFramesMutex);
+	spareFrames.push_back(std::move(frame));
+}
 
-	// Wrap the image in a packet and process it.
-	CHECK_MP_RESULT(mp_process(instance, mp_create_packet_image(image)))
+uint64_t Tracker::getFrameSequence()
+{
+	// One load when nothing new has been published
+	tracked.consume(view);
+	return view.sequence;
+}
 
-	// Start face tracking
-	dlib::cv_image<dlib::bgr_pixel> dlib_img = dlib::cv_image<dlib::bgr_pixel>(inputColorImage);
+void Tracker::publish()
+{
+	latest.sequence++;
+	tracked.publish(latest);
+}
 
-	std::vector<dlib::matrix<dlib::rgb_pixel>> batch;
-	dlib::matrix<dlib::rgb_pixel> dlib_matrix;
-	dlib::assign_image(dlib_matrix, dlib_img);
-	batch.push_back(dlib_matrix);
+std::vector<FaceDetector::Detection> Tracker::detectFaces(FrameBuffer &frame, std::shared_ptr<Capture> capture, nlohmann::json &headTrack)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<HeadSearch::Region> regions;
+	if (headSearch)
+	{
+		// Searched in native depth, only the regions found are moved into the tracking frame
+		k4a_image_t depth = capture->foregroundDepth != NULL ? capture->foregroundDepth : capture->depthSpace.depthImage;
+		const k4a_calibration_t &calibration = capture->camera->calibration;
+		for (HeadSearch::Region region : headSearch->find(depth, calibration.depth_camera_calibration.intrinsics.parameters.param.fx))
+		{
+			if (HeadSearch::toFrame(region, calibration, capture->trackingSpace, capture->trackingScale, frame.getWidth(), frame.getHeight()))
+			{
+				regions.push_back(region);
+			}
+		}
+	}
 
-	auto detections = cnn_face_detector(batch);
+	headTrack["regions"] = regions.size();
+	std::vector<FaceDetector::Detection> dets;
+	for (const HeadSearch::Region &region : regions)
+	{
+		std::vector<FaceDetector::Detection> found = faceDetector->detectIn(frame, region.rect, region.faceSize);
+		dets.insert(dets.end(), found.begin(), found.end());
+	}
+	if (!regions.empty())
+	{
+		guidedDetectCost.add(std::chrono::steady_clock::now() - start);
+	}
 
-	// Get first from batch (I think need to double check this)
-	std::vector<dlib::mmod_rect> dets = detections[0];
+	// Nothing at seating distance (or no depth), or nothing that was there is a face: a reaching arm, a shoulder, or
+	// a head just out of range or learnt into the background. Search everything so the face can still be found.
+	headTrack["fullFrame"] = dets.empty();
+	if (dets.empty())
+	{
+		auto fullStart = std::chrono::steady_clock::now();
+		dets = faceDetector->detect(frame);
+		fullDetectCost.add(std::chrono::steady_clock::now() - fullStart);
+	}
+	std::sort(dets.begin(), dets.end(), [](const FaceDetector::Detection &a, const FaceDetector::Detection &b)
+			  { return a.confidence > b.confidence; });
+	return dets;
+}
+
+void Tracker::segmentBackground(std::shared_ptr<Capture> capture)
+{
+	k4a_image_t depth = capture->depthSpace.depthImage;
+	k4a_image_t foreground = capture->camera->foregroundPool->acquire();
+	if (foreground == NULL)
+	{
+		return;
+	}
+	bool segmented = background->segment((const uint16_t *)k4a_image_get_buffer(depth), k4a_image_get_stride_bytes(depth),
+										 capture->depthSpace.width, capture->depthSpace.height, capture->arrivalTime,
+										 (uint16_t *)k4a_image_get_buffer(foreground), k4a_image_get_stride_bytes(foreground));
+	// Still learning
+	if (!segmented)
+	{
+		k4a_image_release(foreground);
+		return;
+	}
+	capture->foregroundDepth = foreground;
+	capture->foregroundRegions = background->getRegions();
+}
+
+std::optional<std::array<glm::vec3, 2>> Tracker::detectPinch(std::shared_ptr<Capture> capture)
+{
+	// Native depth whatever the tracking frame is, so nothing has to be registered
+	k4a_image_t depth = capture->foregroundDepth != NULL ? capture->foregroundDepth : capture->depthSpace.depthImage;
+	const k4a_calibration_t &calibration = capture->camera->calibration;
+	PinchDetector::Tips tips;
+	std::optional<std::array<glm::vec3, 2>> fingertips;
+	if (pinch->detect(depth, calibration.depth_camera_calibration.intrinsics.parameters.param.fx, tips))
+	{
+		std::array<glm::vec3, 2> lifted;
+		bool valid = true;
+		for (int i = 0; i < 2 && valid; i++)
+		{
+			k4a_float2_t pixel = {tips.points[i].x, tips.points[i].y};
+			k4a_float3_t point;
+			int isValid = 0;
+			valid = K4A_RESULT_SUCCEEDED == k4a_calibration_2d_to_3d(&calibration, &pixel, (float)tips.depths[i], K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_DEPTH, &point, &isValid) && isValid;
+			if (valid)
+			{
+				// Same axes as calculate3DPos, pushed into the finger like the graph's fingertips
+				lifted[i] = toScreenSpace(glm::vec3(-point.xyz.x / 10.0f, -point.xyz.y / 10.0f, point.xyz.z / 10.0f) - INTO_FINGER_OFFSET);
+			}
+		}
+		if (valid)
+		{
+			fingertips = lifted;
+		}
+	}
+
+	// Only published once the graph has agreed with it, and taken back when it's lost or the graph stops agreeing
+	// so the getters fall back to the graph's hand
+	if (fingertips.has_value() && pinch->isTrusted())
+	{
+		auto found = std::make_shared<DepthPinch>();
+		found->capture = capture;
+		found->fingertips[0] = fingertips.value()[0];
+		found->fingertips[1] = fingertips.value()[1];
+		found->trackedTime = std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lock(publishMutex);
+		latest.pinch = std::move(found);
+		publish();
+		pinchPublished = true;
+	}
+	else if (pinchPublished)
+	{
+		std::lock_guard<std::mutex> lock(publishMutex);
+		latest.pinch = nullptr;
+		publish();
+		pinchPublished = false;
+	}
+	return fingertips;
+}
+
+void Tracker::submitHand(FrameBuffer &frame, std::shared_ptr<Capture> capture, const std::optional<std::array<glm::vec3, 2>> &pinchTips)
+{
+	// The graph works on its own copy, so the frame can go on to the face stage as soon as this returns
+	HandRoi::Crop crop = HandRoi::fullFrame(frame.getWidth(), frame.getHeight());
+	if (handRoi)
+	{
+		HandRoi::Source source;
+		{
+			std::lock_guard<std::mutex> lock(handMutex);
+			source = handRoi->nextSource();
+			if (source == HandRoi::Source::TRACKED)
+			{
+				crop = handRoi->trackedCrop(frame.getWidth(), frame.getHeight());
+			}
+		}
+		// Only reads the depth and its own scratch buffers, no need to hold the lock
+		if (source == HandRoi::Source::DEPTH)
+		{
+			k4a_image_t depth = capture->foregroundDepth != NULL ? capture->foregroundDepth : capture->depthSpace.depthImage;
+			HandRoi::Crop hint = handRoi->depthCrop(depth, capture->camera->calibration, capture->trackingSpace, capture->trackingScale, frame.getWidth(), frame.getHeight());
+			if (!hint.rect.empty())
+			{
+				crop = hint;
+			}
+		}
+	}
+	mp_image handImage = frame.mpView();
+	if (crop.rect.size() != cv::Size(frame.getWidth(), frame.getHeight()))
+	{
+		handCrop.resize(crop.rect.width, crop.rect.height);
+		cv::Mat handCropView = handCrop.cvView();
+		frame.cvView()(crop.rect).copyTo(handCropView);
+		handImage = handCrop.mpView();
+	}
+	{
+		std::lock_guard<std::mutex> lock(handMutex);
+		handFrames[nextHandFrame] = {capture, crop, pinchTips};
+	}
+	handGraph->submit(handImage, nextHandFrame++);
+}
+
+std::shared_ptr<const Tracker::FaceLandmarks> Tracker::trackFace(FrameBuffer &frame, std::shared_ptr<Capture> capture)
+{
+	// The detector and predictor read the frame buffer directly
+	const dlib::matrix<dlib::rgb_pixel> &dlib_img = frame.dlibImage();
 
 	nlohmann::json headTrack;
 	auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
 									std::chrono::system_clock::now().time_since_epoch())
 									.count();
 	headTrack["time"] = currentTimeInMilliseconds;
+
+	// Follow the face from the last frame with just the landmark predictor, only falling back to the detector when needed
+	auto faceStart = std::chrono::steady_clock::now();
+	std::optional<dlib::full_object_detection> detection;
+	dlib::rectangle faceRect;
+	float faceConfidence = 0.0f;
+	FaceTrack::Reason reason = faceTrack.needsDetection(frame.getWidth(), frame.getHeight());
+	if (reason == FaceTrack::Reason::NONE)
+	{
+		faceRect = faceTrack.predictedBox();
+		dlib::full_object_detection tracked = predictor(dlib_img, faceRect);
+		float trackConfidence = faceTrack.tracked(tracked);
+		if (trackConfidence >= FaceTrack::MIN_CONFIDENCE)
+		{
+			detection = tracked;
+			faceConfidence = lastDetectionConfidence * trackConfidence;
+			faceTrack.addTrackCost(std::chrono::steady_clock::now() - faceStart);
+			headTrack["mode"] = "track";
+		}
+		else
+		{
+			// Lost it, detect on this same frame rather than skipping it
+			reason = FaceTrack::Reason::LOST;
+		}
+	}
+	if (reason != FaceTrack::Reason::NONE)
+	{
+		std::vector<FaceDetector::Detection> dets = detectFaces(frame, capture, headTrack);
+		if (!dets.empty())
+		{
+			faceRect = dets[0].rect;
+			detection = predictor(dlib_img, faceRect);
+			faceTrack.detected(faceRect, *detection);
+			lastDetectionConfidence = dets[0].confidence;
+			faceConfidence = lastDetectionConfidence;
+		}
+		else
+		{
+			faceTrack.notDetected();
+		}
+		faceTrack.addDetectCost(reason, std::chrono::steady_clock::now() - faceStart);
+		headTrack["mode"] = "detect";
+		headTrack["reason"] = FaceTrack::reasonName(reason);
+	}
+	headTrack["faceMs"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - faceStart).count();
+
 	// If face detected
-	if (!dets.empty())
+	std::shared_ptr<FaceLandmarks> face;
+	if (detection)
 	{
-		std::unique_ptr<FaceLandmarks> face = std::make_unique<FaceLandmarks>();
+		face = std::make_shared<FaceLandmarks>();
 
-		face->box = {(int)(dets[0].rect.left() + dets[0].rect.right()) / 2,
-					 (int)(dets[0].rect.top() + dets[0].rect.bottom()) / 2,
-					 (int)(dets[0].rect.right() - dets[0].rect.left()),
-					 (int)(dets[0].rect.bottom() - dets[0].rect.top()),
+		face->box = {(int)(faceRect.left() + faceRect.right()) / 2,
+					 (int)(faceRect.top() + faceRect.bottom()) / 2,
+					 (int)(faceRect.right() - faceRect.left()),
+					 (int)(faceRect.bottom() - faceRect.top()),
 					 (float)0.0f};
+		face->confidence = faceConfidence;
 
-		dlib::full_object_detection detection = predictor(dlib_img, dets[0].rect);
 		for (int j = 0; j < 5; j++)
 		{
-			face->landmarks[j] = {detection.part(j).x(), detection.part(j).y()};
+			face->landmarks[j] = {detection->part(j).x(), detection->part(j).y()};
 		}
 		face->capture = capture;
-		trackF->face = std::move(face);
+		liftFace(*face);
 		headTrack["success"] = true;
 	} else {
 		headTrack["success"] = false;
 	}
 	jsonLog["headTrack"].push_back(headTrack);
+	return face;
+}
 
-	// Wait until the image has been processed.
-	CHECK_MP_RESULT(mp_wait_until_idle(instance))
+void Tracker::handTracked(const HandGraph::Result &result)
+{
+	HandFrame handFrame;
+	{
+		std::lock_guard<std::mutex> lock(handMutex);
+		auto it = handFrames.find(result.frameId);
+		if (it == handFrames.end())
+		{
+			return;
+		}
+		handFrame = it->second;
+		// Anything older was dropped before it reached the graph
+		handFrames.erase(handFrames.begin(), std::next(it));
+	}
 
 	nlohmann::json handTrack;
-	currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-									std::chrono::system_clock::now().time_since_epoch())
-									.count();
-	handTrack["time"] = currentTimeInMilliseconds;
-	// Get hand landmarks
-	// Making the assumption if there is a landmark packet there is a rect packet
-	if (mp_get_queue_size(landmarks_poller) > 0)
+	handTrack["time"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+							std::chrono::system_clock::now().time_since_epoch())
+							.count();
+	handTrack["success"] = result.found;
+	handTrack["handMs"] = std::chrono::duration<double, std::milli>(result.finishedTime - result.submittedTime).count();
+	handTrack["roi"] = HandRoi::sourceName(handFrame.crop.source);
+	handTrack["roiSize"] = handFrame.crop.rect.width;
+
+	// Crops are never scaled, so back in the whole frame is just an offset (z is already in pixels)
+	glm::vec3 offset((float)handFrame.crop.rect.x, (float)handFrame.crop.rect.y, 0.0f);
+	glm::vec2 centre = result.centre + glm::vec2(offset);
+	std::shared_ptr<HandLandmarks> hand;
+	if (result.found)
 	{
-		mp_packet *landmark_packet = mp_poll_packet(landmarks_poller);
-		mp_multi_face_landmark_list *hand_landmarks_list = mp_get_norm_multi_face_landmarks(landmark_packet);
-
-		mp_packet *rects_packet = mp_poll_packet(rects_poller);
-		mp_rect_list *rects = mp_get_norm_rects(rects_packet);
+		hand = std::make_shared<HandLandmarks>();
+		for (int j = 0; j < 21; j++)
+		{
+			hand->landmarks[j] = result.landmarks[j] + offset;
+		}
+		hand->box = {(int)centre.x,
+					 (int)centre.y,
+					 (int)result.size.x,
+					 (int)result.size.y,
+					 result.rotation};
+		hand->capture = handFrame.capture;
+		hand->trackedTime = result.finishedTime;
+		// Lifted here, as soon as it's found, rather than by whichever thread asks for it first
+		liftHand(*hand);
+	}
+	if (pinch)
+	{
+		std::optional<std::array<glm::vec3, 2>> graphTips;
+		if (hand)
+		{
+			graphTips = std::array<glm::vec3, 2>{hand->fingertips[0], hand->fingertips[1]};
+		}
+		pinch->validate(handFrame.pinchTips, graphTips);
+	}
 
-		if (hand_landmarks_list->length > 0)
+	{
+		std::lock_guard<std::mutex> lock(handMutex);
+		if (handRoi)
 		{
-			mp_landmark_list &landmarks = hand_landmarks_list->elements[0];
-			std::unique_ptr<HandLandmarks> hand = std::make_unique<HandLandmarks>();
-			for (int j = 0; j < landmarks.length; j++)
+			if (result.found)
 			{
-				const mp_landmark &p = landmarks.elements[j];
-				float x = (float)inputColorImage.cols * p.x;
-				float y = (float)inputColorImage.rows * p.y;
-				// Mediapipe scales z with x
-				float z = (float)inputColorImage.cols * p.z;
-
-				hand->landmarks[j] = {x, y, z};
+				handRoi->found(handFrame.crop, cv::RotatedRect(cv::Point2f(centre.x, centre.y), cv::Size2f(result.size.x, result.size.y), result.rotation * 180.0f / (float)CV_PI), result.finishedTime - result.submittedTime);
 			}
+			else
+			{
+				handRoi->missed(handFrame.crop, result.finishedTime - result.submittedTime);
+			}
+		}
+		if (hand)
+		{
+			glm::vec3 index = hand->screenPoints[mp_hand_landmark_index_finger_tip];
+			glm::vec3 middle = hand->screenPoints[mp_hand_landmark_middle_finger_tip];
+			handPointLog.push_back({{"time", handTrack["time"]},
+									{"deviceTime", hand->capture->deviceTimestamp},
+									{"index", {{"x", index.x}, {"y", index.y}, {"z", index.z}}},
+									{"middle", {{"x", middle.x}, {"y", middle.y}, {"z", middle.z}}}});
+		}
+		handLog.push_back(handTrack);
+	}
+	if (debug && hand)
+	{
+		// The face stage may not have drawn this capture yet, or may already have moved on to a later one
+		std::lock_guard<std::mutex> lock(debugMutex);
+		if (debugCapture == hand->capture)
+		{
+			debugDrawHand(*hand);
+		}
+		else if (!debugCapture || debugCapture->arrivalTime < hand->capture->arrivalTime)
+		{
+			debugHands.push_back(hand);
+			if (debugHands.size() > MAX_DEBUG_HANDS)
+			{
+				debugHands.pop_front();
+			}
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(publishMutex);
+		latest.hand = std::move(hand);
+		publish();
+	}
+}
 
-			const mp_rect &rect = rects->elements[0];
-			hand->box = {(int)(inputColorImage.cols * rect.x_center),
-						 (int)(inputColorImage.rows * rect.y_center),
-						 (int)(inputColorImage.cols * rect.width),
-						 (int)(inputColorImage.rows * rect.height),
-						 rect.rotation};
-
-			hand->capture = capture;
-			trackF->hand = std::move(hand);
-			handTrack["success"] = true;
-		} else {
-			handTrack["success"] = false;
+void Tracker::debugDraw(std::shared_ptr<Capture> capture)
+{
+	// Only the face found in the capture being drawn, the newest one can be from an earlier capture
+	std::shared_ptr<const FaceLandmarks> face;
+	{
+		std::lock_guard<std::mutex> lock(publishMutex);
+		face = latest.face;
+	}
+	if (face && face->capture != capture)
+	{
+		face.reset();
+	}
+	// The hand if the graph got there first, anything for an earlier capture won't be drawn now.
+	// Otherwise handTracked draws it when it comes in.
+	debugCapture = capture;
+	std::shared_ptr<const HandLandmarks> hand;
+	while (!debugHands.empty() && debugHands.front()->capture->arrivalTime <= capture->arrivalTime)
+	{
+		if (debugHands.front()->capture == capture)
+		{
+			hand = debugHands.front();
 		}
+		debugHands.pop_front();
+	}
+
+	colorImage.copyTo(colorImageSkeletons);
+	colorImage.copyTo(colorImageSkeletonFace);
+	colorImage.copyTo(colorImageSkeletonHand);
+	colorImage.copyTo(colorImageImportant);
+	depthImage.copyTo(depthImageImportant);
 
-		mp_destroy_multi_face_landmarks(hand_landmarks_list);
-		mp_destroy_packet(landmark_packet);
-		mp_destroy_rects(rects);
-		mp_destroy_packet(rects_packet);
+	if (face)
+	{
+		cv::Point2f faceCenter((float)face->box.x, (float)face->box.y);
+		cv::Point2f faceSize((float)face->box.width, (float)face->box.height);
+		float faceRotation = (float)face->box.rotation * (180.0f / (float)CV_PI);
+
+		// Draw hand bounding boxes as blue rectangles.
+		cv::Point2f faceVertices[4];
+		cv::RotatedRect(faceCenter, faceSize, faceRotation).points(faceVertices);
+		for (int j = 0; j < 4; j++)
+		{
+			cv::line(colorImageSkeletons, cv::Point(faceVertices[j].x * debugScale, faceVertices[j].y * debugScale), cv::Point(faceVertices[(j + 1) % 4].x * debugScale, faceVertices[(j + 1) % 4].y * debugScale), CV_RGB(0, 0, 255), 5);
+			cv::line(colorImageSkeletonFace, cv::Point(faceVertices[j].x * debugScale, faceVertices[j].y * debugScale), cv::Point(faceVertices[(j + 1) % 4].x * debugScale, faceVertices[(j + 1) % 4].y * debugScale), CV_RGB(0, 0, 255), 5);
+		}
+		for (unsigned long j = 0; j < 5; j++)
+		{
+			cv::circle(colorImageSkeletons, cv::Point(face->landmarks[j].x * debugScale, face->landmarks[j].y * debugScale), 10, cv::Scalar(0, 0, 255), -1);
+			cv::circle(colorImageSkeletonFace, cv::Point(face->landmarks[j].x * debugScale, face->landmarks[j].y * debugScale), 10, cv::Scalar(0, 0, 255), -1);
+		}
+		cv::Point leftEyeCenter = cv::Point2f((face->landmarks[0].x + face->landmarks[1].x) * 0.5f * debugScale, (face->landmarks[0].y + face->landmarks[1].y) * 0.5f * debugScale);
+		cv::circle(colorImageImportant, leftEyeCenter, 20, cv::Scalar(55, 124, 255), -1);
+		cv::circle(depthImageImportant, leftEyeCenter, 20, cv::Scalar(55, 124, 255), -1);
 	}
-	else
+
+	if (hand)
 	{
-		handTrack["success"] = false;
-		trackF->hand = nullptr;
+		debugDrawHand(*hand);
 	}
-	jsonLog["handTrack"].push_back(handTrack);
 }
 
-void Tracker::debugDraw()
+void Tracker::debugDrawHand(const HandLandmarks &hand)
 {
 	const mp_hand_landmark CONNECTIONS[][2] = {
 		{mp_hand_landmark_wrist, mp_hand_landmark_thumb_cmc},
@@ -484,286 +1047,302 @@ void Tracker::debugDraw()
 		{mp_hand_landmark_pinky_pip, mp_hand_landmark_pinky_dip},
 		{mp_hand_landmark_pinky_dip, mp_hand_landmark_pinky_tip}};
 
-	if (!trackF)
-	{
-		return;
-	}
-	colorImage.copyTo(colorImageSkeletons);
-	colorImage.copyTo(colorImageSkeletonFace);
-	colorImage.copyTo(colorImageSkeletonHand);
-	colorImage.copyTo(colorImageImportant);
-	depthImage.copyTo(depthImageImportant);
-
-	if (trackF->face)
+	for (unsigned long j = 0; j < 21; j++)
 	{
-		cv::Point2f faceCenter((float)trackF->face->box.x, (float)trackF->face->box.y);
-		cv::Point2f faceSize((float)trackF->face->box.width, (float)trackF->face->box.height);
-		float faceRotation = (float)trackF->face->box.rotation * (180.0f / (float)CV_PI);
-
-		// Draw hand bounding boxes as blue rectangles.
-		cv::Point2f faceVertices[4];
-		cv::RotatedRect(faceCenter, faceSize, faceRotation).points(faceVertices);
-		for (int j = 0; j < 4; j++)
-		{
-			cv::line(colorImageSkeletons, cv::Point(faceVertices[j].x * 2, faceVertices[j].y * 2), cv::Point(faceVertices[(j + 1) % 4].x * 2, faceVertices[(j + 1) % 4].y * 2), CV_RGB(0, 0, 255), 5);
-			cv::line(colorImageSkeletonFace, cv::Point(faceVertices[j].x * 2, faceVertices[j].y * 2), cv::Point(faceVertices[(j + 1) % 4].x * 2, faceVertices[(j + 1) % 4].y * 2), CV_RGB(0, 0, 255), 5);
-		}
-		for (unsigned long j = 0; j < 5; j++)
+		for (const auto &connection : CONNECTIONS)
 		{
-			cv::circle(colorImageSkeletons, cv::Point(trackF->face->landmarks[j].x * 2, trackF->face->landmarks[j].y * 2), 10, cv::Scalar(0, 0, 255), -1);
-			cv::circle(colorImageSkeletonFace, cv::Point(trackF->face->landmarks[j].x * 2, trackF->face->landmarks[j].y * 2), 10, cv::Scalar(0, 0, 255), -1);
+			const glm::vec2 &p1 = hand.landmarks[connection[0]];
+			const glm::vec2 &p2 = hand.landmarks[connection[1]];
+			cv::line(colorImageSkeletons, {(int)(p1.x * debugScale), (int)(p1.y * debugScale)}, {(int)(p2.x * debugScale), (int)(p2.y * debugScale)}, CV_RGB(0, 255, 0), 5);
+			cv::line(colorImageSkeletonHand, {(int)(p1.x * debugScale), (int)(p1.y * debugScale)}, {(int)(p2.x * debugScale), (int)(p2.y * debugScale)}, CV_RGB(0, 255, 0), 5);
 		}
-		cv::Point leftEyeCenter = cv::Point2f((trackF->face->landmarks[0].x + trackF->face->landmarks[1].x), (trackF->face->landmarks[0].y + trackF->face->landmarks[1].y));
-		cv::circle(colorImageImportant, leftEyeCenter, 20, cv::Scalar(55, 124, 255), -1);
-		cv::circle(depthImageImportant, leftEyeCenter, 20, cv::Scalar(55, 124, 255), -1);
 	}
 
-	if (trackF->hand)
+	for (unsigned long j = 0; j < 21; j++)
 	{
-		for (unsigned long j = 0; j < 21; j++)
+		float minZ = std::numeric_limits<float>::max();
+		float maxZ = std::numeric_limits<float>::min();
+
+		// Find the minimum and maximum z values
+
+		for (const auto &landmark : hand.landmarks)
 		{
-			for (const auto &connection : CONNECTIONS)
-			{
-				const glm::vec2 &p1 = trackF->hand->landmarks[connection[0]];
-				const glm::vec2 &p2 = trackF->hand->landmarks[connection[1]];
-				cv::line(colorImageSkeletons, {(int)p1.x * 2, (int)p1.y * 2}, {(int)p2.x * 2, (int)p2.y * 2}, CV_RGB(0, 255, 0), 5);
-				cv::line(colorImageSkeletonHand, {(int)p1.x * 2, (int)p1.y * 2}, {(int)p2.x * 2, (int)p2.y * 2}, CV_RGB(0, 255, 0), 5);
-			}
+			minZ = std::min(minZ, landmark.z);
+			maxZ = std::max(maxZ, landmark.z);
 		}
 
-		for (unsigned long j = 0; j < 21; j++)
+		for (const auto &landmark : hand.landmarks)
 		{
-			float minZ = std::numeric_limits<float>::max();
-			float maxZ = std::numeric_limits<float>::min();
-
-			// Find the minimum and maximum z values
-
-			for (const auto &landmark : trackF->hand->landmarks)
-			{
-				minZ = std::min(minZ, landmark.z);
-				maxZ = std::max(maxZ, landmark.z);
-			}
-
-			for (const auto &landmark : trackF->hand->landmarks)
-			{
-				// Normalize the z value
-				float normalizedZ = (landmark.z - minZ) / (maxZ - minZ);
+			// Normalize the z value
+			float normalizedZ = (landmark.z - minZ) / (maxZ - minZ);
 
-				// Calculate the color based on the normalized z value
-				cv::Scalar color(0, 0, 255 * (1 - normalizedZ));
+			// Calculate the color based on the normalized z value
+			cv::Scalar color(0, 0, 255 * (1 - normalizedZ));
 
-				cv::circle(colorImageSkeletons, cv::Point(landmark.x * 2, landmark.y * 2), 10, color, -1);
-				cv::circle(colorImageSkeletonHand, cv::Point(landmark.x * 2, landmark.y * 2), 10, color, -1);
-			}
+			cv::circle(colorImageSkeletons, cv::Point(landmark.x * debugScale, landmark.y * debugScale), 10, color, -1);
+			cv::circle(colorImageSkeletonHand, cv::Point(landmark.x * debugScale, landmark.y * debugScale), 10, color, -1);
 		}
+	}
 
-		cv::Point2f middle = cv::Point2f((float)trackF->hand->landmarks[mp_hand_landmark_middle_finger_tip].x * 2, (float)trackF->hand->landmarks[mp_hand_landmark_middle_finger_tip].y * 2);
-		cv::circle(colorImageImportant, middle, 20, cv::Scalar(163, 69, 143), -1);
-		cv::circle(depthImageImportant, middle, 20, cv::Scalar(163, 69, 143), -1);
-		cv::Point2f index = cv::Point2f((float)trackF->hand->landmarks[mp_hand_landmark_index_finger_tip].x * 2, (float)trackF->hand->landmarks[mp_hand_landmark_index_finger_tip].y * 2);
-		cv::circle(colorImageImportant, index, 20, cv::Scalar(163, 69, 143), -1);
-		cv::circle(depthImageImportant, index, 20, cv::Scalar(163, 69, 143), -1);
-
-		cv::Point2f handCenter((float)trackF->hand->box.x, (float)trackF->hand->box.y);
-		cv::Point2f handSize((float)trackF->hand->box.width, (float)trackF->hand->box.height);
-		float handRotation = (float)trackF->hand->box.rotation * (180.0f / (float)CV_PI);
-
-		// Draw hand bounding boxes as blue rectangles.
-		cv::Point2f handVertices[4];
-		cv::RotatedRect(handCenter, handSize, handRotation).points(handVertices);
-		for (int j = 0; j < 4; j++)
-		{
-			cv::line(colorImageSkeletons, cv::Point(handVertices[j].x * 2, handVertices[j].y * 2), cv::Point(handVertices[(j + 1) % 4].x * 2, handVertices[(j + 1) % 4].y * 2), CV_RGB(0, 0, 255), 5);
-			cv::line(colorImageSkeletonHand, cv::Point(handVertices[j].x * 2, handVertices[j].y * 2), cv::Point(handVertices[(j + 1) % 4].x * 2, handVertices[(j + 1) % 4].y * 2), CV_RGB(0, 0, 255), 5);
-		}
+	cv::Point2f middle = cv::Point2f((float)hand.landmarks[mp_hand_landmark_middle_finger_tip].x * debugScale, (float)hand.landmarks[mp_hand_landmark_middle_finger_tip].y * debugScale);
+	cv::circle(colorImageImportant, middle, 20, cv::Scalar(163, 69, 143), -1);
+	cv::circle(depthImageImportant, middle, 20, cv::Scalar(163, 69, 143), -1);
+	cv::Point2f index = cv::Point2f((float)hand.landmarks[mp_hand_landmark_index_finger_tip].x * debugScale, (float)hand.landmarks[mp_hand_landmark_index_finger_tip].y * debugScale);
+	cv::circle(colorImageImportant, index, 20, cv::Scalar(163, 69, 143), -1);
+	cv::circle(depthImageImportant, index, 20, cv::Scalar(163, 69, 143), -1);
+
+	cv::Point2f handCenter((float)hand.box.x, (float)hand.box.y);
+	cv::Point2f handSize((float)hand.box.width, (float)hand.box.height);
+	float handRotation = (float)hand.box.rotation * (180.0f / (float)CV_PI);
+
+	// Draw hand bounding boxes as blue rectangles.
+	cv::Point2f handVertices[4];
+	cv::RotatedRect(handCenter, handSize, handRotation).points(handVertices);
+	for (int j = 0; j < 4; j++)
+	{
+		cv::line(colorImageSkeletons, cv::Point(handVertices[j].x * debugScale, handVertices[j].y * debugScale), cv::Point(handVertices[(j + 1) % 4].x * debugScale, handVertices[(j + 1) % 4].y * debugScale), CV_RGB(0, 0, 255), 5);
+		cv::line(colorImageSkeletonHand, cv::Point(handVertices[j].x * debugScale, handVertices[j].y * debugScale), cv::Point(handVertices[(j + 1) % 4].x * debugScale, handVertices[(j + 1) % 4].y * debugScale), CV_RGB(0, 0, 255), 5);
 	}
 }
 
-glm::vec3 Tracker::getFilteredPoint(glm::vec3 point, std::shared_ptr<Capture> capture)
+void Tracker::liftHand(HandLandmarks &hand)
 {
-	glm::vec3 bestPoint = calculate3DPos(point.x * 2, point.y * 2, K4A_CALIBRATION_TYPE_COLOR, capture);
-	float minZ = bestPoint.z;
-
-	// Iterate over a 3x3 grid centered on the original point
-	for (int dx = -1; dx <= 1; dx++)
+	std::shared_ptr<Capture> capture = hand.capture;
+	const k4a_calibration_t &calibration = capture->camera->calibration;
+	k4a_image_t depth = capture->depthSpace.depthImage;
+	int width = depth != NULL ? k4a_image_get_width_pixels(depth) : 0;
+	int height = depth != NULL ? k4a_image_get_height_pixels(depth) : 0;
+	int stride = depth != NULL ? k4a_image_get_stride_bytes(depth) : 0;
+	const uint8_t *buffer = depth != NULL ? k4a_image_get_buffer(depth) : nullptr;
+	float scale = capture->trackingScale;
+
+	// Each landmark in the native depth image (found from just that color pixel, like calculate3DPos, rather than
+	// registering the whole depth image), then the nearest valid depth in a 3x3 grid around it and the ray through it
+	for (int j = 0; j < 21; j++)
 	{
-		for (int dy = -1; dy <= 1; dy++)
+		k4a_float2_t pixel = {hand.landmarks[j].x * scale, hand.landmarks[j].y * scale};
+		bool mapped = depth != NULL;
+		if (mapped && capture->trackingSpace == K4A_CALIBRATION_TYPE_COLOR)
 		{
-			if (dx == 0 && dy == 0)
-				continue; // Skip the center point since it's already considered
-
-			glm::vec3 newPoint = calculate3DPos(point.x * 2 + dx, point.y * 2 + dy, K4A_CALIBRATION_TYPE_COLOR, capture);
-			if (newPoint.z < minZ)
+			k4a_float2_t colorPixel = pixel;
+			int valid = 0;
+			mapped = K4A_RESULT_SUCCEEDED == k4a_calibration_color_2d_to_depth_2d(&calibration, &colorPixel, depth, &pixel, &valid) && valid;
+		}
+		glm::vec2 ray;
+		int samples = 0;
+		uint16_t nearest = 0;
+		if (mapped && capture->camera->xyTable->ray(pixel.xy.x, pixel.xy.y, ray))
+		{
+			int u = (int)std::lround(pixel.xy.x);
+			int v = (int)std::lround(pixel.xy.y);
+			for (int y = std::max(v - 1, 0); y <= std::min(v + 1, height - 1); y++)
 			{
-				minZ = newPoint.z;
-				bestPoint = newPoint;
+				const uint16_t *row = (const uint16_t *)(buffer + (size_t)y * stride);
+				for (int x = std::max(u - 1, 0); x <= std::min(u + 1, width - 1); x++)
+				{
+					if (row[x] != 0 && (samples == 0 || row[x] < nearest))
+					{
+						nearest = row[x];
+					}
+					samples += row[x] != 0;
+				}
 			}
 		}
+		hand.depthSamples[j] = samples;
+
+		// Depth camera (mm) -> cm with x and y flipped like calculate3DPos -> screen space. Landmarks without depth
+		// end up where calculate3DPos puts them, at the camera.
+		float z = (float)nearest;
+		hand.cameraPoints[j] = samples > 0 ? glm::vec3(-ray.x * z / 10.0f, -ray.y * z / 10.0f, z / 10.0f) : glm::vec3(0.0f);
+		hand.screenPoints[j] = toScreenSpace(hand.cameraPoints[j]);
 	}
+	hand.depthCoverage = (hand.depthSamples[mp_hand_landmark_index_finger_tip] + hand.depthSamples[mp_hand_landmark_middle_finger_tip]) / 18.0f;
 
-	return bestPoint;
+	hand.fingertips[0] = toScreenSpace(hand.cameraPoints[mp_hand_landmark_index_finger_tip] - INTO_FINGER_OFFSET);
+	hand.fingertips[1] = toScreenSpace(hand.cameraPoints[mp_hand_landmark_middle_finger_tip] - INTO_FINGER_OFFSET);
 }
 
-std::optional<std::vector<glm::vec3>> Tracker::getHandLandmarks()
+void Tracker::liftFace(FaceLandmarks &face)
 {
-	if (trackF && trackF->hand)
-	{
-		std::vector<glm::vec3> landmarks;
-
-		// There will always be a middle if there is a finger
-		if (trackF->hand->cachedIndexFinger.has_value())
-		{
-			landmarks.push_back(trackF->hand->cachedIndexFinger.value());
-			landmarks.push_back(trackF->hand->cachedMiddleFinger.value());
-		}
-		else
-		{
-			// The distance from the surface of the finger to the middle of the finger
-			float intoFingerOffset = 1.0f;
-
-			glm::vec3 landmarkIndexFinger = trackF->hand->landmarks[mp_hand_landmark_index_finger_tip];
-			// Correct for down sample
-			glm::vec3 posIndexFinger = getFilteredPoint(landmarkIndexFinger, trackF->hand->capture);
-			posIndexFinger.y -= intoFingerOffset;
-			posIndexFinger.z -= intoFingerOffset;
-
-			glm::vec3 posIndexFingerScreenSpace = toScreenSpace(posIndexFinger);
-			trackF->hand->cachedIndexFinger = posIndexFingerScreenSpace;
-			
-			landmarks.push_back(posIndexFingerScreenSpace);
-
-			glm::vec3 landmarkMiddleFinger = trackF->hand->landmarks[mp_hand_landmark_middle_finger_tip];
-			// Correct for down sample
-			glm::vec3 posMiddleFinger = getFilteredPoint(landmarkMiddleFinger, trackF->hand->capture);
-			posIndexFinger.y -= intoFingerOffset;
-			posIndexFinger.z -= intoFingerOffset;
+	// Midpoint of the eye corners, scaled back up to the resolution of the camera it was tracked in
+	float scale = face.capture->trackingScale;
+	cv::Point leftEye = cv::Point(
+		(face.landmarks[0].x + face.landmarks[1].x) * 0.5f * scale,
+		(face.landmarks[0].y + face.landmarks[1].y) * 0.5f * scale);
+	cv::Point rightEye = cv::Point(
+		(face.landmarks[2].x + face.landmarks[3].x) * 0.5f * scale,
+		(face.landmarks[2].y + face.landmarks[3].y) * 0.5f * scale);
+
+	glm::vec3 cameraLeftEye = calculate3DPos(leftEye.x, leftEye.y, face.capture->trackingSpace, face.capture);
+	face.leftEyeHasDepth = cameraLeftEye.z > 0.0f;
+	face.leftEye = toScreenSpace(cameraLeftEye);
+	face.rightEye = toScreenSpace(calculate3DPos(rightEye.x, rightEye.y, face.capture->trackingSpace, face.capture));
 
-			glm::vec3 posMiddleFingerScreenSpace = toScreenSpace(posMiddleFinger);
-			trackF->hand->cachedMiddleFinger = posMiddleFingerScreenSpace;
-
-			landmarks.push_back(posMiddleFingerScreenSpace);
-			// Add 'index' finger details to 'hand'.
-			nlohmann::json hand;
-			auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-										std::chrono::system_clock::now().time_since_epoch())
-										.count();
-			hand["time"] = currentTimeInMilliseconds;
-			hand["index"] = {
-				{"x", posIndexFingerScreenSpace.x},
-				{"y", posIndexFingerScreenSpace.y},
-				{"z", posIndexFingerScreenSpace.z}};
+	auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+									std::chrono::system_clock::now().time_since_epoch())
+									.count();
+	jsonLog["leftEye"].push_back({{"time", currentTimeInMilliseconds},
+								  {"deviceTime", face.capture->deviceTimestamp},
+								  {"x", face.leftEye.x},
+								  {"y", face.leftEye.y},
+								  {"z", face.leftEye.z}});
+	jsonLog["rightEye"].push_back({{"time", currentTimeInMilliseconds},
+								   {"deviceTime", face.capture->deviceTimestamp},
+								   {"x", face.rightEye.x},
+								   {"y", face.rightEye.y},
+								   {"z", face.rightEye.z}});
+}
 
-			// Add 'middle' details to 'hand'.
-			hand["middle"] = {
-				{"x", posMiddleFingerScreenSpace.x},
-				{"y", posMiddleFingerScreenSpace.y},
-				{"z", posMiddleFingerScreenSpace.z}};
+bool Tracker::pinchIsNewer() const
+{
+	return view.pinch && (!view.hand || view.pinch->capture->arrivalTime > view.hand->capture->arrivalTime);
+}
 
-			// Push the 'hand' object to 'jsonLog' under key 'hand'.
-			jsonLog["hand"].push_back(hand);
+std::optional<std::vector<glm::vec3>> Tracker::getHandLandmarks()
+{
+	std::vector<glm::vec3> landmarks;
+	if (pinchIsNewer())
+	{
+		landmarks = {view.pinch->fingertips[0], view.pinch->fingertips[1]};
+	}
+	else if (view.hand)
+	{
+		landmarks = {view.hand->fingertips[0], view.hand->fingertips[1]};
+	}
+	if (!landmarks.empty() && glm::distance(landmarks[0], landmarks[1]) < 18.0f)
+	{
+		return landmarks;
+	}
 
-		}
+	return {};
+}
 
-		if (glm::distance(landmarks[0], landmarks[1]) < 18.0f)
+std::optional<Tracker::HandSkeleton> Tracker::getHandSkeleton()
+{
+	if (view.hand)
+	{
+		HandSkeleton skeleton;
+		for (int j = 0; j < 21; j++)
 		{
-			return landmarks;
+			skeleton.points[j] = view.hand->screenPoints[j];
+			skeleton.valid[j] = view.hand->depthSamples[j] > 0;
 		}
+		return skeleton;
 	}
+	return {};
+}
 
+std::optional<Tracker::FrameTimes> Tracker::getFaceFrameTimes()
+{
+	if (view.face)
+	{
+		std::shared_ptr<Capture> capture = view.face->capture;
+		return FrameTimes{capture->deviceTimestamp, capture->arrivalTime, capture->trackedTime};
+	}
 	return {};
 }
 
-std::optional<glm::vec3> Tracker::getLeftEyePos()
+std::optional<Tracker::FrameTimes> Tracker::getHandFrameTimes()
+{
+	if (pinchIsNewer())
+	{
+		std::shared_ptr<Capture> capture = view.pinch->capture;
+		return FrameTimes{capture->deviceTimestamp, capture->arrivalTime, view.pinch->trackedTime};
+	}
+	if (view.hand)
+	{
+		std::shared_ptr<Capture> capture = view.hand->capture;
+		return FrameTimes{capture->deviceTimestamp, capture->arrivalTime, view.hand->trackedTime};
+	}
+	return {};
+}
 
+std::optional<Tracker::Estimate> Tracker::getEyeEstimate()
 {
-	if (trackF && trackF->face)
+	std::optional<glm::vec3> leftEye = getLeftEyePos();
+	std::optional<FrameTimes> times = getFaceFrameTimes();
+	if (!leftEye.has_value() || !times.has_value())
 	{
-		if (trackF->face->cachedLeftEye.has_value())
-		{
-			return trackF->face->cachedLeftEye.value();
-		}
+		return {};
+	}
+	float confidence = view.face->leftEyeHasDepth ? std::max(view.face->confidence, 0.0f) : 0.0f;
+	return Estimate{{leftEye.value()}, confidence, times.value()};
+}
 
-		// We don't need to div by 2 because we pyradown the image
-		cv::Point eye = cv::Point(
-			trackF->face->landmarks[0].x + trackF->face->landmarks[1].x,
-			trackF->face->landmarks[0].y + trackF->face->landmarks[1].y);
+std::optional<Tracker::Estimate> Tracker::getHandEstimate()
+{
+	std::optional<std::vector<glm::vec3>> fingers = getHandLandmarks();
+	std::optional<FrameTimes> times = getHandFrameTimes();
+	if (!fingers.has_value() || !times.has_value())
+	{
+		return {};
+	}
+	// Depth fingertips are only ever found where there is depth
+	float confidence = pinchIsNewer() ? 1.0f : view.hand->depthCoverage;
+	return Estimate{fingers.value(), confidence, times.value()};
+}
 
-		glm::vec3 translatedEye = toScreenSpace(calculate3DPos(eye.x, eye.y, K4A_CALIBRATION_TYPE_COLOR, trackF->face->capture));
-		auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-										std::chrono::system_clock::now().time_since_epoch())
-										.count();
-		jsonLog["leftEye"].push_back({{"time", currentTimeInMilliseconds},
-									  {"x", translatedEye.x},
-									  {"y", translatedEye.y},
-									  {"z", translatedEye.z}});
-		trackF->face->cachedLeftEye = translatedEye;
-		return translatedEye;
+std::optional<glm::vec3> Tracker::getLeftEyePos()
+{
+	if (view.face)
+	{
+		return view.face->leftEye;
 	}
 	return {};
 }
 
 std::optional<glm::vec3> Tracker::getRightEyePos()
 {
-	if (trackF && trackF->face)
+	if (view.face)
 	{
-		if (trackF->face->cachedRightEye.has_value())
-		{
-			return trackF->face->cachedRightEye.value();
-		}
-		// We don't need to div by 2 because we pyradown the image
-		cv::Point eye = cv::Point(
-			trackF->face->landmarks[2].x + trackF->face->landmarks[3].x,
-			trackF->face->landmarks[2].y + trackF->face->landmarks[3].y);
-
-		glm::vec3 translatedEye = toScreenSpace(calculate3DPos(eye.x, eye.y, K4A_CALIBRATION_TYPE_COLOR, trackF->face->capture));
-		auto currentTimeInMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
-										std::chrono::system_clock::now().time_since_epoch())
-										.count();
-		jsonLog["rightEye"].push_back({{"time", currentTimeInMilliseconds},
-									   {"x", translatedEye.x},
-									   {"y", translatedEye.y},
-									   {"z", translatedEye.z}});
-		trackF->face->cachedRightEye = translatedEye;
-		return translatedEye;
+		return view.face->rightEye;
 	}
 	return {};
 }
 
 cv::Mat Tracker::getDepthImage()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return depthImage;
 }
 
 cv::Mat Tracker::getDepthImageImportant()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return depthImageImportant;
 }
 cv::Mat Tracker::getDepthImageOriginal()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return depthImageOriginal;
 }
 
 cv::Mat Tracker::getColorImage()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return colorImage;
 }
 
 cv::Mat Tracker::getColorImageImportant()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return colorImageImportant;
 }
 
 cv::Mat Tracker::getColorImageSkeletons()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return colorImageSkeletons;
 }
 cv::Mat Tracker::getColorImageSkeletonFace()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return colorImageSkeletonFace;
 }
 
 cv::Mat Tracker::getColorImageSkeletonHand()
 {
+	std::lock_guard<std::mutex> lock(debugMutex);
 	return colorImageSkeletonHand;
 }
 
@@ -772,75 +1351,132 @@ bool Tracker::isReady()
 	return ready;
 }
 
-Tracker::~Tracker()
+void Tracker::close()
 {
-	// Shut down the camera when finished with application logic
-	k4a_device_stop_cameras(device);
-	k4a_device_close(device);
+	// No more face or hand results once this returns
+	faceQueue->close();
+	if (faceWorker.joinable())
+	{
+		faceWorker.join();
+	}
+	for (FaceJob &job : faceQueue->drain())
+	{
+		giveBackFrame(std::move(job.frame));
+	}
+	handGraph->stop();
+	// Flush whatever the recorder still has queued
+	if (recorder)
+	{
+		recorder->close();
+	}
 }
 
-class CaptureException : public std::exception
+Tracker::~Tracker()
 {
-private:
-	std::string message;
+	// Both threads call back into the tracker
+	faceQueue->close();
+	if (faceWorker.joinable())
+	{
+		faceWorker.join();
+	}
+	handGraph.reset();
+	recorder.reset();
+}
 
-public:
-	explicit CaptureException(const char *msg) : message(msg) {}
+Tracker::CameraModel::CameraModel(const k4a_calibration_t &calibration, const std::string &profile, bool registersDepth, bool segmentsBackground)
+{
+	this->calibration = calibration;
+	this->profile = profile;
+	transformation = k4a_transformation_create(&calibration);
 
-	virtual const char *what() const throw()
+	// Pools are resident memory (a color sized depth image is 8MB at 2160P), only make the ones something will use
+	int colorWidth = calibration.color_camera_calibration.resolution_width;
+	int colorHeight = calibration.color_camera_calibration.resolution_height;
+	int depthWidth = calibration.depth_camera_calibration.resolution_width;
+	int depthHeight = calibration.depth_camera_calibration.resolution_height;
+	// IR only profiles have no color camera to register to
+	if (registersDepth && colorWidth > 0 && colorHeight > 0)
 	{
-		return message.c_str();
+		registeredDepthPool = std::make_shared<ImagePool>(K4A_IMAGE_FORMAT_DEPTH16, colorWidth, colorHeight, colorWidth * (int)sizeof(uint16_t), REGISTERED_DEPTH_POOL_SIZE);
+	}
+	pointCloudPool = std::make_shared<ImagePool>(K4A_IMAGE_FORMAT_CUSTOM, depthWidth, depthHeight, depthWidth * 3 * (int)sizeof(int16_t), 1);
+	if (segmentsBackground)
+	{
+		foregroundPool = std::make_shared<ImagePool>(K4A_IMAGE_FORMAT_DEPTH16, depthWidth, depthHeight, depthWidth * (int)sizeof(uint16_t), FOREGROUND_POOL_SIZE);
 	}
-};
 
-class CaptureTimeoutException : public CaptureException
-{
-public:
-	CaptureTimeoutException() : CaptureException("Timed out waiting for a capture") {}
-};
+	// Whatever the tracking frame, landmarks are lifted from where they fall in the depth image
+	xyTable = std::make_unique<XyTable>(calibration, K4A_CALIBRATION_TYPE_DEPTH, depthWidth, depthHeight, 1.0f);
+}
 
-class CaptureReadFailedException : public CaptureException
+Tracker::CameraModel::~CameraModel()
 {
-public:
-	CaptureReadFailedException() : CaptureException("Failed to read a capture") {}
-};
+	k4a_transformation_destroy(transformation);
+}
 
-Tracker::Capture::Capture(k4a_device_t device, k4a_transformation_t transformation)
+Tracker::Capture::Capture(k4a_capture_t capture, std::shared_ptr<CameraModel> camera)
 {
-	// Capture a depth frame
-	switch (k4a_device_get_capture(device, &capture, timeout))
-	{
-	case K4A_WAIT_RESULT_SUCCEEDED:
-		break;
-	case K4A_WAIT_RESULT_TIMEOUT:
-		throw CaptureTimeoutException();
-	case K4A_WAIT_RESULT_FAILED:
-		throw CaptureReadFailedException();
-	}
+	// Takes ownership of the capture handle
+	this->capture = capture;
+	// Keeps the transformation and pools alive until the images taken from them have been handed back
+	this->camera = camera;
 
 	colorSpace.colorImage = k4a_capture_get_color_image(capture);
-	colorSpace.width = k4a_image_get_width_pixels(colorSpace.colorImage);
-	colorSpace.height = k4a_image_get_height_pixels(colorSpace.colorImage);
+	colorSpace.width = colorSpace.colorImage != NULL ? k4a_image_get_width_pixels(colorSpace.colorImage) : 0;
+	colorSpace.height = colorSpace.colorImage != NULL ? k4a_image_get_height_pixels(colorSpace.colorImage) : 0;
+	colorSpace.irImage = NULL;
 	depthSpace.depthImage = k4a_capture_get_depth_image(capture);
 	depthSpace.width = k4a_image_get_width_pixels(depthSpace.depthImage);
 	depthSpace.height = k4a_image_get_height_pixels(depthSpace.depthImage);
-	if (K4A_RESULT_FAILED == k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, colorSpace.width, colorSpace.height, colorSpace.width * (int)sizeof(uint16_t), &colorSpace.depthImage))
+	depthSpace.colorImage = NULL;
+	// Comes with every depth frame, but only used when there is no color to track on
+	depthSpace.irImage = colorSpace.colorImage == NULL ? k4a_capture_get_ir_image(capture) : NULL;
+	deviceTimestamp = k4a_image_get_device_timestamp_usec(depthSpace.depthImage);
+
+	// Registering depth to the color camera is only done if someone asks for it
+	colorSpace.depthImage = NULL;
+}
+
+bool Tracker::Capture::hasColor() const
+{
+	return colorSpace.colorImage != NULL;
+}
+
+k4a_image_t Tracker::Capture::getRegisteredDepth()
+{
+	if (!hasColor())
+	{
+		return NULL;
+	}
+	std::call_once(registered, [this]()
+				   { colorSpace.depthImage = registerDepth(depthSpace.depthImage); });
+	return colorSpace.depthImage;
+}
+
+k4a_image_t Tracker::Capture::registerDepth(k4a_image_t depth)
+{
+	// Without a pool (no debug images) it's a one off, straight from the SDK
+	k4a_image_t registeredDepth = NULL;
+	if (camera->registeredDepthPool)
+	{
+		registeredDepth = camera->registeredDepthPool->acquire();
+	}
+	else if (K4A_FAILED(k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, colorSpace.width, colorSpace.height, colorSpace.width * (int)sizeof(uint16_t), &registeredDepth)))
+	{
+		registeredDepth = NULL;
+	}
+	if (registeredDepth == NULL)
 	{
-		k4a_image_release(colorSpace.colorImage);
-		k4a_image_release(depthSpace.depthImage);
-		k4a_capture_release(capture);
 		std::cout << "Failed to create empty transformed_depth_image" << std::endl;
-		exit(EXIT_FAILURE);
+		return NULL;
 	}
-	if (K4A_RESULT_FAILED == k4a_transformation_depth_image_to_color_camera(transformation, depthSpace.depthImage, colorSpace.depthImage))
+	if (K4A_RESULT_FAILED == k4a_transformation_depth_image_to_color_camera(camera->transformation, depth, registeredDepth))
 	{
-		k4a_image_release(colorSpace.colorImage);
-		k4a_image_release(colorSpace.depthImage);
-		k4a_image_release(depthSpace.depthImage);
-		k4a_capture_release(capture);
+		k4a_image_release(registeredDepth);
 		std::cout << "Failed to create transformed_depth_image" << std::endl;
-		exit(EXIT_FAILURE);
+		return NULL;
 	}
+	return registeredDepth;
 }
 
 glm::vec3 Tracker::toScreenSpace(glm::vec3 pos)
@@ -848,14 +1484,128 @@ glm::vec3 Tracker::toScreenSpace(glm::vec3 pos)
 	return glm::vec3(toScreenSpaceMat * glm::vec4(pos, 1.0f)) + cameraOffset;
 }
 
+cv::Mat Tracker::Capture::getFullColor(JpegDecoder &decoder)
+{
+	if (k4a_image_get_format(colorSpace.colorImage) != K4A_IMAGE_FORMAT_COLOR_MJPG)
+	{
+		return cv::Mat(colorSpace.height, colorSpace.width, CV_8UC4, k4a_image_get_buffer(colorSpace.colorImage), (size_t)k4a_image_get_stride_bytes(colorSpace.colorImage));
+	}
+	std::call_once(fullDecoded, [this, &decoder]()
+				   { decoder.decode(colorSpace.colorImage, 1, TJPF_BGRA, fullColor); });
+	return fullColor;
+}
+
+k4a_capture_t Tracker::Capture::getHandle()
+{
+	return capture;
+}
+
 Tracker::Capture::~Capture()
 {
-	k4a_image_release(colorSpace.colorImage);
-	k4a_image_release(colorSpace.depthImage);
+	if (colorSpace.colorImage != NULL)
+	{
+		k4a_image_release(colorSpace.colorImage);
+	}
+	if (colorSpace.depthImage != NULL)
+	{
+		k4a_image_release(colorSpace.depthImage);
+	}
+	if (foregroundDepth != NULL)
+	{
+		k4a_image_release(foregroundDepth);
+	}
+	if (depthSpace.irImage != NULL)
+	{
+		k4a_image_release(depthSpace.irImage);
+	}
 	k4a_image_release(depthSpace.depthImage);
+	k4a_capture_release(capture);
 }
 
 nlohmann::json Tracker::returnJson()
 {
+	nlohmann::json sourceLog = source->returnJson();
+
+	// Sources that know the true poses report them in depth camera mm, put them in screen space alongside the tracked ones
+	if (sourceLog.contains("groundTruth"))
+	{
+		for (auto &truth : sourceLog["groundTruth"])
+		{
+			for (auto &point : truth["points"])
+			{
+				glm::vec3 pos = toScreenSpace(glm::vec3(-point["x"].get<float>() / 10.0f, -point["y"].get<float>() / 10.0f, point["z"].get<float>() / 10.0f));
+				point = {{"x", pos.x}, {"y", pos.y}, {"z", pos.z}};
+			}
+		}
+	}
+	jsonLog["source"] = sourceLog;
+	jsonLog["capture"] = captureLog;
+	jsonLog["capturesPublished"] = captures.getPublished();
+	jsonLog["capturesSuperseded"] = captures.getSuperseded();
+	jsonLog["threads"]["capture"] = captureThreadStats.returnJson();
+	jsonLog["threads"]["tracker"] = trackerThreadStats.returnJson();
+	if (camera->registeredDepthPool)
+	{
+		jsonLog["imagePools"]["registeredDepth"] = camera->registeredDepthPool->returnJson();
+	}
+	jsonLog["imagePools"]["pointCloud"] = camera->pointCloudPool->returnJson();
+	{
+		std::lock_guard<std::mutex> lock(spareFramesMutex);
+		uint64_t reallocations = 0;
+		for (const auto &frame : spareFrames)
+		{
+			reallocations += frame->getReallocations();
+		}
+		jsonLog["frameBuffer"]["reallocations"] = reallocations;
+		jsonLog["frameBuffer"]["allocated"] = framesAllocated;
+	}
+	jsonLog["handTrack"] = handLog;
+	jsonLog["hand"] = handPointLog;
+	jsonLog["handGraph"] = handGraph->returnJson();
+	// Each stage's queue and how long it takes per frame, the slowest one sets the tracking rate
+	jsonLog["pipeline"]["preprocess"]["queue"] = {{"capacity", 1}, {"policy", "dropOldest"}, {"pushed", captures.getPublished()}, {"dropped", captures.getSuperseded()}};
+	jsonLog["pipeline"]["preprocess"]["service"] = preprocessCost.returnJson();
+	jsonLog["pipeline"]["preprocess"]["thread"] = trackerThreadStats.returnJson();
+	jsonLog["pipeline"]["face"]["queue"] = faceQueue->returnJson();
+	jsonLog["pipeline"]["face"]["service"] = faceStageCost.returnJson();
+	jsonLog["pipeline"]["face"]["thread"] = faceThreadStats.returnJson();
+	jsonLog["pipeline"]["hand"]["queue"] = jsonLog["handGraph"]["queue"];
+	jsonLog["pipeline"]["hand"]["service"] = jsonLog["handGraph"]["graphCost"];
+	jsonLog["pipeline"]["hand"]["thread"] = jsonLog["handGraph"]["thread"];
+	if (AllocationCounter::isCounting())
+	{
+		// Per frame, in the order the frames went through each stage
+		jsonLog["allocations"] = {{"capture", captureAllocations}, {"preprocess", preprocessAllocations}, {"face", faceAllocations}};
+	}
+	if (background)
+	{
+		jsonLog["background"] = background->returnJson();
+	}
+	if (handRoi)
+	{
+		jsonLog["handGraph"]["roi"] = handRoi->returnJson();
+	}
+	if (pinch)
+	{
+		jsonLog["pinch"] = pinch->returnJson();
+	}
+	jsonLog["faceTracking"] = faceTrack.returnJson();
+	jsonLog["faceTracking"]["detector"] = faceDetector->getName();
+	// Detector time with the search narrowed by depth, and over the whole frame when there was nothing to narrow it to
+	jsonLog["faceTracking"]["guidedDetectCost"] = guidedDetectCost.returnJson();
+	jsonLog["faceTracking"]["fullDetectCost"] = fullDetectCost.returnJson();
+	jsonLog["profileSwitches"] = profileLog;
+	for (auto &[profile, cost] : captureCostByProfile)
+	{
+		jsonLog["profiles"][profile]["capture"] = cost.returnJson();
+	}
+	for (auto &[profile, cost] : trackingCostByProfile)
+	{
+		jsonLog["profiles"][profile]["tracking"] = cost.returnJson();
+	}
+	if (recorder)
+	{
+		jsonLog["recorder"] = recorder->returnJson();
+	}
 	return jsonLog;
 }
@@ -0,0 +1,58 @@
+#include "xytable.hpp"
+
+XyTable::XyTable(const k4a_calibration_t &calibration, k4a_calibration_type_t camera, int width, int height, float scale)
+{
+	// One more sample than needed on each axis so the last pixels still have something to interpolate towards
+	cols = width / STEP + 2;
+	rows = height / STEP + 2;
+	rays.resize((size_t)cols * rows);
+	valid.resize((size_t)cols * rows);
+	for (int y = 0; y < rows; y++)
+	{
+		for (int x = 0; x < cols; x++)
+		{
+			k4a_float2_t pixel = {(float)(x * STEP) * scale, (float)(y * STEP) * scale};
+			k4a_float3_t point;
+			int isValid = 0;
+			size_t index = (size_t)y * cols + x;
+			if (K4A_RESULT_SUCCEEDED == k4a_calibration_2d_to_3d(&calibration, &pixel, 1.0f, camera, camera, &point, &isValid) && isValid)
+			{
+				rays[index] = glm::vec2(point.xyz.x, point.xyz.y);
+				valid[index] = 1;
+			}
+			else
+			{
+				rays[index] = glm::vec2(0.0f);
+				valid[index] = 0;
+			}
+		}
+	}
+}
+
+bool XyTable::ray(float x, float y, glm::vec2 &ray) const
+{
+	if (x < 0.0f || y < 0.0f)
+	{
+		return false;
+	}
+	float gx = x / STEP;
+	float gy = y / STEP;
+	int x0 = (int)gx;
+	int y0 = (int)gy;
+	if (x0 + 1 >= cols || y0 + 1 >= rows)
+	{
+		return false;
+	}
+	size_t i00 = (size_t)y0 * cols + x0;
+	size_t i10 = i00 + 1;
+	size_t i01 = i00 + cols;
+	size_t i11 = i01 + 1;
+	if (!valid[i00] || !valid[i10] || !valid[i01] || !valid[i11])
+	{
+		return false;
+	}
+	float fx = gx - x0;
+	float fy = gy - y0;
+	ray = glm::mix(glm::mix(rays[i00], rays[i10], fx), glm::mix(rays[i01], rays[i11], fx), fy);
+	return true;
+}
@@ -0,0 +1,140 @@
+// Asserts do the work here so they must never be compiled out
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "background.hpp"
+#include "simdpath.hpp"
+
+// Values past the end of the row, the kernels must leave them alone
+static const uint16_t UNTOUCHED = 0xA5A5;
+
+static void learnReference(const uint16_t *depth, uint16_t *background, int width, bool learned)
+{
+	for (int x = 0; x < width; x++)
+	{
+		if (!learned || background[x] != 0)
+		{
+			background[x] = std::max(background[x], depth[x]);
+		}
+	}
+}
+
+static void segmentReference(const uint16_t *depth, uint16_t *background, uint16_t *foreground, int width, uint16_t margin)
+{
+	for (int x = 0; x < width; x++)
+	{
+		bool inFront = background[x] == 0 || (uint32_t)depth[x] + margin < background[x];
+		foreground[x] = inFront ? depth[x] : 0;
+		learnReference(depth + x, background + x, 1, true);
+	}
+}
+
+// Mostly realistic depths, with holes (0), the far end of the range, and pairs within a margin of each other
+static std::vector<uint16_t> randomRow(std::mt19937 &random, int width, const std::vector<uint16_t> &near)
+{
+	std::vector<uint16_t> row(width + 16, UNTOUCHED);
+	for (int x = 0; x < width; x++)
+	{
+		switch (random() % 8)
+		{
+		case 0:
+			row[x] = 0;
+			break;
+		case 1:
+			row[x] = (uint16_t)(65535 - random() % 64);
+			break;
+		case 2:
+		case 3:
+			// Around the other row's value, either side of any margin
+			row[x] = near.empty() ? (uint16_t)random() : (uint16_t)std::clamp<int>(near[x] + (int)(random() % 161) - 80, 0, 65535);
+			break;
+		default:
+			row[x] = (uint16_t)(200 + random() % 4800);
+		}
+	}
+	return row;
+}
+
+static void report(const char *kernel, int width, const std::vector<uint16_t> &expected, const std::vector<uint16_t> &actual)
+{
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (expected[i] != actual[i])
+		{
+			std::cerr << kernel << " width " << width << ": element " << i << " is " << actual[i] << ", expected " << expected[i] << std::endl;
+			break;
+		}
+	}
+	assert(false);
+}
+
+static void checkLearn(std::mt19937 &random, int width, bool learned)
+{
+	std::vector<uint16_t> background = randomRow(random, width, {});
+	std::vector<uint16_t> depth = randomRow(random, width, background);
+	std::vector<uint16_t> expected = background;
+	learnReference(depth.data(), expected.data(), width, learned);
+	learnBackground(depth.data(), background.data(), width, learned);
+	if (expected != background)
+	{
+		report(learned ? "learnBackground (learned)" : "learnBackground", width, expected, background);
+	}
+}
+
+static void checkSegment(std::mt19937 &random, int width, uint16_t margin)
+{
+	std::vector<uint16_t> background = randomRow(random, width, {});
+	std::vector<uint16_t> depth = randomRow(random, width, background);
+	std::vector<uint16_t> expectedBackground = background;
+	std::vector<uint16_t> expectedForeground(width + 16, UNTOUCHED);
+	std::vector<uint16_t> foreground(width + 16, UNTOUCHED);
+	segmentReference(depth.data(), expectedBackground.data(), expectedForeground.data(), width, margin);
+	segmentForeground(depth.data(), background.data(), foreground.data(), width, margin);
+	if (expectedForeground != foreground)
+	{
+		report("segmentForeground (foreground)", width, expectedForeground, foreground);
+	}
+	if (expectedBackground != background)
+	{
+		report("segmentForeground (background)", width, expectedBackground, background);
+	}
+}
+
+int main()
+{
+	if (!simdPathSupported())
+	{
+		std::cout << "background (" << SIMD_PATH << "): skipped, not supported by this CPU" << std::endl;
+		return 0;
+	}
+	std::mt19937 random(54321);
+	// Every width up to a few vector steps so each path's main loop and every length of scalar tail run, then a
+	// whole row of each depth mode
+	std::vector<int> widths;
+	for (int width = 0; width <= 72; width++)
+	{
+		widths.push_back(width);
+	}
+	widths.push_back(320);
+	widths.push_back(640);
+	widths.push_back(1024);
+	for (int width : widths)
+	{
+		for (int repeat = 0; repeat < 20; repeat++)
+		{
+			checkLearn(random, width, false);
+			checkLearn(random, width, true);
+			// No margin, the default, and one big enough that depth + margin saturates the vector add
+			checkSegment(random, width, 0);
+			checkSegment(random, width, 40);
+			checkSegment(random, width, 65535);
+		}
+	}
+	std::cout << "background (" << SIMD_PATH << "): ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,180 @@
+// Asserts do the work here (push, pop, publish) so they must never be compiled out
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#include "mailbox.hpp"
+
+// Nothing to consume until something is published, then only the newest value
+static void latestValue()
+{
+	LatestMailbox<int> mailbox;
+	int value = -1;
+	assert(!mailbox.consume(value));
+	assert(value == -1);
+
+	mailbox.publish(1);
+	assert(mailbox.consume(value));
+	assert(value == 1);
+	// Seen already
+	assert(!mailbox.consume(value));
+
+	for (int i = 2; i <= 5; i++)
+	{
+		mailbox.publish(i);
+	}
+	assert(mailbox.consume(value));
+	assert(value == 5);
+	assert(!mailbox.consume(value));
+	assert(mailbox.getPublished() == 5);
+	// 2, 3 and 4 were replaced before the consumer got to them
+	assert(mailbox.getSuperseded() == 3);
+}
+
+// Every slot gets reused, none of them hands back a stale value
+static void slotsRecycled()
+{
+	LatestMailbox<int> mailbox;
+	int value = -1;
+	for (int i = 0; i < 100; i++)
+	{
+		mailbox.publish(i);
+		if (i % 3 == 0)
+		{
+			mailbox.publish(i + 1000);
+			assert(mailbox.consume(value));
+			assert(value == i + 1000);
+		}
+		else
+		{
+			assert(mailbox.consume(value));
+			assert(value == i);
+		}
+	}
+}
+
+// Across threads values only ever move forward, and the last one published is the last one consumed
+static void concurrent()
+{
+	const uint64_t COUNT = 200000;
+	LatestMailbox<uint64_t> mailbox;
+	std::thread producer([&]
+						 {
+							 for (uint64_t i = 1; i <= COUNT; i++)
+							 {
+								 mailbox.publish(i);
+							 } });
+	uint64_t last = 0;
+	uint64_t value = 0;
+	uint64_t consumed = 0;
+	while (last < COUNT)
+	{
+		if (mailbox.consume(value))
+		{
+			assert(value > last);
+			last = value;
+			consumed++;
+		}
+	}
+	producer.join();
+	assert(!mailbox.consume(value));
+	assert(mailbox.getPublished() == COUNT);
+	assert(consumed + mailbox.getSuperseded() == COUNT);
+}
+
+// Returns straight away with something fresh, and after the timeout with nothing
+static void waitTimesOut()
+{
+	LatestMailbox<int> mailbox;
+	auto start = std::chrono::steady_clock::now();
+	assert(!mailbox.waitForFresh(std::chrono::milliseconds(20)));
+	assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+	mailbox.publish(1);
+	start = std::chrono::steady_clock::now();
+	assert(mailbox.waitForFresh(std::chrono::seconds(10)));
+	assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+	int value = 0;
+	assert(mailbox.consume(value));
+	assert(!mailbox.waitForFresh(std::chrono::milliseconds(1)));
+}
+
+// A consumer asleep in waitForFresh wakes for each publish, never sleeping through one until its timeout
+static void publishWakesWaiter()
+{
+	const int ROUNDS = 2000;
+	const auto TIMEOUT = std::chrono::seconds(10);
+	LatestMailbox<int> mailbox;
+	// The consumer hands back each value so the producer only publishes once it's waiting again
+	LatestMailbox<int> acks;
+	std::thread consumer([&]
+						 {
+							 int value = 0;
+							 for (int i = 0; i < ROUNDS; i++)
+							 {
+								 auto start = std::chrono::steady_clock::now();
+								 assert(mailbox.waitForFresh(TIMEOUT));
+								 assert(std::chrono::steady_clock::now() - start < TIMEOUT / 2);
+								 assert(mailbox.consume(value));
+								 assert(value == i);
+								 acks.publish(value);
+							 } });
+	int ack = -1;
+	for (int i = 0; i < ROUNDS; i++)
+	{
+		// Every so often give the consumer time to actually be asleep
+		if (i % 100 == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+		mailbox.publish(i);
+		assert(acks.waitForFresh(TIMEOUT));
+		assert(acks.consume(ack));
+		assert(ack == i);
+	}
+	consumer.join();
+}
+
+// The tracker's loop shape: wait with a timeout and check whether to stop, so stopping never needs a publish
+static void shutsDown()
+{
+	LatestMailbox<int> mailbox;
+	std::atomic<bool> running{true};
+	std::atomic<int> consumed{0};
+	std::thread consumer([&]
+						 {
+							 int value = 0;
+							 while (running)
+							 {
+								 if (mailbox.waitForFresh(std::chrono::milliseconds(10)) && mailbox.consume(value))
+								 {
+									 consumed++;
+								 }
+							 } });
+	mailbox.publish(1);
+	while (consumed == 0)
+	{
+		std::this_thread::yield();
+	}
+	auto start = std::chrono::steady_clock::now();
+	running = false;
+	consumer.join();
+	assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+	assert(consumed == 1);
+}
+
+int main()
+{
+	latestValue();
+	slotsRecycled();
+	concurrent();
+	waitTimesOut();
+	publishWakesWaiter();
+	shutsDown();
+	std::cout << "mailbox: ok" << std::endl;
+	return 0;
+}
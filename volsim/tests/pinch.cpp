@@ -0,0 +1,137 @@
+// Asserts do the work here so they must never be compiled out
+#undef NDEBUG
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/imgproc.hpp>
+
+#include "pinch.hpp"
+
+// A 640x576 depth frame, and the depth camera's focal length at that size (pixels)
+static const int WIDTH = 640;
+static const int HEIGHT = 576;
+static const float FX = 504.0f;
+// Fingers reach for the camera a little ahead of the palm (mm), at this distance a pixel is about a millimetre
+static const uint16_t FINGER_DEPTH = 480;
+static const uint16_t PALM_DEPTH = 520;
+// Where the palm starts, the arm runs from there off the bottom of the image
+static const int PALM_TOP = 260;
+static const int PALM_LEFT = 280;
+static const int PALM_WIDTH = 80;
+
+// A finger pointing straight up from the palm with a round end, centred on x and its tip at top
+static void drawFinger(cv::Mat &depth, int x, int width, int top)
+{
+	int radius = width / 2;
+	cv::rectangle(depth, cv::Point(x - radius, top + radius), cv::Point(x - radius + width - 1, PALM_TOP), cv::Scalar(FINGER_DEPTH), cv::FILLED);
+	cv::circle(depth, cv::Point(x, top + radius), radius, cv::Scalar(FINGER_DEPTH), cv::FILLED);
+}
+
+struct Frame
+{
+	k4a_image_t image = NULL;
+	cv::Mat depth;
+
+	Frame()
+	{
+		assert(K4A_RESULT_SUCCEEDED == k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16, WIDTH, HEIGHT, WIDTH * (int)sizeof(uint16_t), &image));
+		depth = cv::Mat(HEIGHT, WIDTH, CV_16U, k4a_image_get_buffer(image), (size_t)k4a_image_get_stride_bytes(image));
+		depth.setTo(cv::Scalar(0));
+	}
+
+	// The palm and arm, without any fingers
+	void drawHand()
+	{
+		cv::rectangle(depth, cv::Point(PALM_LEFT, PALM_TOP), cv::Point(PALM_LEFT + PALM_WIDTH - 1, HEIGHT - 1), cv::Scalar(PALM_DEPTH), cv::FILLED);
+	}
+
+	~Frame()
+	{
+		k4a_image_release(image);
+	}
+};
+
+static float distance(const cv::Point2f &a, const cv::Point2f &b)
+{
+	return std::hypot(a.x - b.x, a.y - b.y);
+}
+
+// Nothing between handMinDepth and handMaxDepth
+static void nothingInRange()
+{
+	PinchDetector detector(nlohmann::json::object());
+	Frame frame;
+	frame.depth.setTo(cv::Scalar(2000));
+	PinchDetector::Tips tips;
+	assert(!detector.detect(frame.image, FX, tips));
+	assert(!detector.detect(NULL, FX, tips));
+}
+
+// Index and middle apart: two tips, a finger gap and two half fingers apart
+static void fingersApart()
+{
+	PinchDetector detector(nlohmann::json::object());
+	Frame frame;
+	frame.drawHand();
+	drawFinger(frame.depth, 305, 18, 180);
+	drawFinger(frame.depth, 337, 18, 172);
+	PinchDetector::Tips tips;
+	assert(detector.detect(frame.image, FX, tips));
+	assert(distance(tips.points[0], tips.points[1]) > 20.0f);
+	for (int i = 0; i < 2; i++)
+	{
+		assert(tips.depths[i] == FINGER_DEPTH);
+		assert(tips.points[i].y < 200.0f);
+	}
+	assert(detector.returnJson()["together"] == 0);
+}
+
+// Index and middle held together for a grab: one tip two fingers wide, reported as both
+static void fingersTogether()
+{
+	PinchDetector detector(nlohmann::json::object());
+	Frame frame;
+	frame.drawHand();
+	drawFinger(frame.depth, 320, 36, 172);
+	PinchDetector::Tips tips;
+	assert(detector.detect(frame.image, FX, tips));
+	assert(tips.points[0] == tips.points[1]);
+	assert(tips.depths[0] == tips.depths[1] && tips.depths[0] == FINGER_DEPTH);
+	assert(std::abs(tips.points[0].x - 320.0f) < 12.0f && tips.points[0].y < 185.0f);
+	assert(detector.returnJson()["together"] == 1);
+}
+
+// One finger pointing, the rest curled into the palm: not a pinch, the hand graph has to decide
+static void pointing()
+{
+	PinchDetector detector(nlohmann::json::object());
+	Frame frame;
+	frame.drawHand();
+	drawFinger(frame.depth, 310, 18, 172);
+	PinchDetector::Tips tips;
+	assert(!detector.detect(frame.image, FX, tips));
+	assert(detector.returnJson()["together"] == 0);
+}
+
+// A fist has no corner sharp enough to be a tip
+static void fist()
+{
+	PinchDetector detector(nlohmann::json::object());
+	Frame frame;
+	frame.drawHand();
+	cv::rectangle(frame.depth, cv::Point(PALM_LEFT, PALM_TOP - 30), cv::Point(PALM_LEFT + PALM_WIDTH - 1, PALM_TOP), cv::Scalar(FINGER_DEPTH), cv::FILLED);
+	PinchDetector::Tips tips;
+	assert(!detector.detect(frame.image, FX, tips));
+}
+
+int main()
+{
+	nothingInRange();
+	fingersApart();
+	fingersTogether();
+	pointing();
+	fist();
+	std::cout << "pinch: ok" << std::endl;
+	return 0;
+}
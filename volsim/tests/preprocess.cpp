@@ -0,0 +1,132 @@
+// Asserts do the work here so they must never be compiled out
+#undef NDEBUG
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "preprocess.hpp"
+#include "simdpath.hpp"
+
+// Bytes past the end of each row, the kernels must neither read meaning into nor write over them
+static const int PADDING = 37;
+static const uint8_t UNTOUCHED = 0xA5;
+
+// What halfScaleBgraToBgr/Rgb should produce, one pixel and channel at a time
+static void halfScaleReference(const uint8_t *src, int srcStride, int width, int height, uint8_t *dst, int dstStride, bool rgb)
+{
+	for (int y = 0; y < height / 2; y++)
+	{
+		for (int x = 0; x < width / 2; x++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int in = rgb ? 2 - c : c;
+				const uint8_t *topLeft = src + (size_t)(2 * y) * srcStride + 8 * x + in;
+				int sum = topLeft[0] + topLeft[4] + topLeft[srcStride] + topLeft[srcStride + 4];
+				dst[(size_t)y * dstStride + 3 * x + c] = (uint8_t)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+static void checkHalfScale(std::mt19937 &random, int width, int height, bool rgb)
+{
+	int srcStride = width * 4 + PADDING;
+	int dstStride = (width / 2) * 3 + PADDING;
+	std::vector<uint8_t> src((size_t)srcStride * height);
+	for (uint8_t &byte : src)
+	{
+		byte = (uint8_t)random();
+	}
+	// Runs of black and white too, for the ends of the range
+	for (int i = 0; i < width && i < srcStride; i += 7)
+	{
+		src[i] = 0;
+		src[srcStride * (height - 1) + i] = 255;
+	}
+
+	std::vector<uint8_t> expected((size_t)dstStride * (height / 2), UNTOUCHED);
+	std::vector<uint8_t> actual((size_t)dstStride * (height / 2), UNTOUCHED);
+	halfScaleReference(src.data(), srcStride, width, height, expected.data(), dstStride, rgb);
+	if (rgb)
+	{
+		halfScaleBgraToRgb(src.data(), srcStride, width, height, actual.data(), dstStride);
+	}
+	else
+	{
+		halfScaleBgraToBgr(src.data(), srcStride, width, height, actual.data(), dstStride);
+	}
+	if (expected != actual)
+	{
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			if (expected[i] != actual[i])
+			{
+				std::cerr << (rgb ? "halfScaleBgraToRgb" : "halfScaleBgraToBgr") << " " << width << "x" << height
+						  << ": byte " << i % dstStride << " of row " << i / dstStride << " is " << (int)actual[i]
+						  << ", expected " << (int)expected[i] << std::endl;
+				break;
+			}
+		}
+		assert(false);
+	}
+}
+
+// The cv::Mat overloads size the output from the input
+static void checkMatOverloads(std::mt19937 &random)
+{
+	cv::Mat bgra(7, 45, CV_8UC4);
+	for (int y = 0; y < bgra.rows; y++)
+	{
+		for (int x = 0; x < bgra.cols * 4; x++)
+		{
+			bgra.ptr<uint8_t>(y)[x] = (uint8_t)random();
+		}
+	}
+	cv::Mat bgr, rgb;
+	halfScaleBgraToBgr(bgra, bgr);
+	halfScaleBgraToRgb(bgra, rgb);
+	assert(bgr.rows == 3 && bgr.cols == 22 && bgr.type() == CV_8UC3);
+	assert(rgb.rows == 3 && rgb.cols == 22 && rgb.type() == CV_8UC3);
+
+	std::vector<uint8_t> expected(3 * 22 * 3);
+	halfScaleReference(bgra.data, (int)bgra.step, bgra.cols, bgra.rows, expected.data(), 22 * 3, false);
+	for (int y = 0; y < 3; y++)
+	{
+		assert(std::memcmp(bgr.ptr<uint8_t>(y), expected.data() + y * 22 * 3, 22 * 3) == 0);
+	}
+	halfScaleReference(bgra.data, (int)bgra.step, bgra.cols, bgra.rows, expected.data(), 22 * 3, true);
+	for (int y = 0; y < 3; y++)
+	{
+		assert(std::memcmp(rgb.ptr<uint8_t>(y), expected.data() + y * 22 * 3, 22 * 3) == 0);
+	}
+}
+
+int main()
+{
+	if (!simdPathSupported())
+	{
+		std::cout << "preprocess (" << SIMD_PATH << "): skipped, not supported by this CPU" << std::endl;
+		return 0;
+	}
+	std::mt19937 random(12345);
+	// Every output width up to a few vector steps, so each path's main loop and every length of scalar tail run,
+	// and odd sizes whose last column and row are dropped
+	for (int width = 2; width <= 100; width++)
+	{
+		for (int height : {2, 3, 6})
+		{
+			checkHalfScale(random, width, height, false);
+			checkHalfScale(random, width, height, true);
+		}
+	}
+	// A whole half size color frame
+	checkHalfScale(random, 1280, 720, false);
+	checkHalfScale(random, 1280, 720, true);
+	checkMatOverloads(random);
+	std::cout << "preprocess (" << SIMD_PATH << "): ok" << std::endl;
+	return 0;
+}
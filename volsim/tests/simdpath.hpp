@@ -0,0 +1,29 @@
+#ifndef SIMD_PATH_H
+#define SIMD_PATH_H
+
+// Which vector loops the kernels under test were built with. The tests are built once per instruction set, so one
+// built for more than the machine running it has skips itself rather than dying on an illegal instruction.
+#if defined(__AVX2__)
+static const char *SIMD_PATH = "avx2";
+#elif defined(__SSE4_1__)
+static const char *SIMD_PATH = "sse4.1";
+#elif defined(__SSSE3__)
+static const char *SIMD_PATH = "ssse3";
+#else
+static const char *SIMD_PATH = "scalar";
+#endif
+
+inline bool simdPathSupported()
+{
+#if defined(__AVX2__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(__SSE4_1__)
+    return __builtin_cpu_supports("sse4.1");
+#elif defined(__SSSE3__)
+    return __builtin_cpu_supports("ssse3");
+#else
+    return true;
+#endif
+}
+
+#endif
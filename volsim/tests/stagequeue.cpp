@@ -0,0 +1,187 @@
+// Asserts do the work here (push, pop, publish) so they must never be compiled out
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "stagequeue.hpp"
+
+// A full queue hands back its oldest entry to make room, the rest come out in order
+static void dropOldest()
+{
+	StageQueue<int> queue(2, QueuePolicy::DROP_OLDEST);
+	std::optional<int> dropped;
+	assert(queue.push(1, dropped));
+	assert(queue.push(2, dropped));
+	assert(!dropped.has_value());
+	assert(queue.push(3, dropped));
+	assert(dropped.has_value() && dropped.value() == 1);
+
+	int value = 0;
+	assert(queue.pop(value) && value == 2);
+	assert(queue.pop(value) && value == 3);
+	nlohmann::json log = queue.returnJson();
+	assert(log["pushed"] == 3);
+	assert(log["dropped"] == 1);
+	assert(log["maxDepth"] == 2);
+	assert(log["policy"] == "dropOldest");
+}
+
+// There's always room for one
+static void zeroCapacity()
+{
+	StageQueue<int> queue(0, QueuePolicy::DROP_OLDEST);
+	std::optional<int> dropped;
+	assert(queue.push(1, dropped));
+	assert(!dropped.has_value());
+	assert(queue.push(2, dropped));
+	assert(dropped.value() == 1);
+	int value = 0;
+	assert(queue.pop(value) && value == 2);
+}
+
+// A full queue holds the producer until the consumer takes something, and drops nothing
+static void block()
+{
+	StageQueue<int> queue(1, QueuePolicy::BLOCK);
+	std::optional<int> dropped;
+	assert(queue.push(1, dropped));
+	std::atomic<bool> pushed{false};
+	std::thread producer([&]
+						 {
+							 std::optional<int> producerDropped;
+							 assert(queue.push(2, producerDropped));
+							 assert(!producerDropped.has_value());
+							 pushed = true; });
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	assert(!pushed);
+
+	int value = 0;
+	assert(queue.pop(value) && value == 1);
+	producer.join();
+	assert(pushed);
+	assert(queue.pop(value) && value == 2);
+	nlohmann::json log = queue.returnJson();
+	assert(log["dropped"] == 0);
+	assert(log["policy"] == "block");
+}
+
+// Closing lets a producer held by a full queue go, without taking its value
+static void closeWhileBlocked()
+{
+	StageQueue<std::unique_ptr<int>> queue(1, QueuePolicy::BLOCK);
+	std::optional<std::unique_ptr<int>> dropped;
+	assert(queue.push(std::make_unique<int>(1), dropped));
+	std::atomic<bool> refused{false};
+	std::thread producer([&]
+						 {
+							 std::optional<std::unique_ptr<int>> producerDropped;
+							 std::unique_ptr<int> value = std::make_unique<int>(2);
+							 assert(!queue.push(std::move(value), producerDropped));
+							 assert(value != nullptr && *value == 2);
+							 assert(!producerDropped.has_value());
+							 refused = true; });
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	assert(!refused);
+	queue.close();
+	producer.join();
+	assert(refused);
+}
+
+// Nothing goes in once closed and the producer keeps its value, pop stops at once and drain hands back the rest
+static void pushAfterClose()
+{
+	StageQueue<std::unique_ptr<int>> queue(2, QueuePolicy::DROP_OLDEST);
+	std::optional<std::unique_ptr<int>> dropped;
+	assert(queue.push(std::make_unique<int>(1), dropped));
+	queue.close();
+
+	std::unique_ptr<int> value = std::make_unique<int>(2);
+	assert(!queue.push(std::move(value), dropped));
+	assert(value != nullptr && *value == 2);
+	assert(!dropped.has_value());
+
+	std::unique_ptr<int> popped;
+	assert(!queue.pop(popped));
+	assert(popped == nullptr);
+
+	std::vector<std::unique_ptr<int>> left = queue.drain();
+	assert(left.size() == 1 && *left[0] == 1);
+	assert(queue.drain().empty());
+	nlohmann::json log = queue.returnJson();
+	assert(log["pushed"] == 1);
+	assert(log["dropped"] == 1);
+}
+
+// Closing wakes a consumer waiting on an empty queue
+static void closeWakesConsumer()
+{
+	StageQueue<int> queue(1, QueuePolicy::DROP_OLDEST);
+	std::atomic<bool> stopped{false};
+	std::thread consumer([&]
+						 {
+							 int value = 0;
+							 assert(!queue.pop(value));
+							 stopped = true; });
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	assert(!stopped);
+	queue.close();
+	consumer.join();
+	assert(stopped);
+}
+
+// Across threads: blocking loses nothing, dropping keeps the order and always delivers the last frame
+static void concurrent(QueuePolicy policy)
+{
+	const int COUNT = 20000;
+	StageQueue<int> queue(2, policy);
+	std::atomic<int> recycled{0};
+	std::thread producer([&]
+						 {
+							 for (int i = 1; i <= COUNT; i++)
+							 {
+								 std::optional<int> dropped;
+								 assert(queue.push(std::move(i), dropped));
+								 recycled += dropped.has_value();
+							 } });
+	int last = 0;
+	int popped = 0;
+	int value = 0;
+	while (last < COUNT)
+	{
+		assert(queue.pop(value));
+		assert(value > last);
+		if (policy == QueuePolicy::BLOCK)
+		{
+			assert(value == last + 1);
+		}
+		last = value;
+		popped++;
+	}
+	producer.join();
+	assert(popped + recycled == COUNT);
+	nlohmann::json log = queue.returnJson();
+	assert(log["pushed"] == COUNT);
+	assert(log["dropped"] == recycled.load());
+	assert(log["maxDepth"] <= 2);
+	queue.close();
+}
+
+int main()
+{
+	dropOldest();
+	zeroCapacity();
+	block();
+	closeWhileBlocked();
+	pushAfterClose();
+	closeWakesConsumer();
+	concurrent(QueuePolicy::DROP_OLDEST);
+	concurrent(QueuePolicy::BLOCK);
+	assert(parseQueuePolicy("block") == QueuePolicy::BLOCK);
+	assert(parseQueuePolicy("dropOldest") == QueuePolicy::DROP_OLDEST);
+	std::cout << "stagequeue: ok" << std::endl;
+	return 0;
+}